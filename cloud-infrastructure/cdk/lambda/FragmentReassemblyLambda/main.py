@@ -0,0 +1,207 @@
+# Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+# SPDX-License-Identifier: MIT-0
+
+# Reassembles messages the badge sent in fragments (see firmware/src/mqtt/mqtt_fragment.c) and publishes
+# them to their target topic.
+#
+# Fragment: "F1 <message id> <sequence> <encoding><more> [<target topic>] <data>"
+#
+# Fragments of a message may be delivered out of order, more than once, and to concurrent invocations.
+# They are stored in a DynamoDB table until all of them arrived; the invocation that wins the conditional
+# write of the completion marker publishes the message. Incomplete messages expire with the table's TTL.
+
+import base64
+import json
+import os
+import re
+import time
+
+import boto3
+from botocore.exceptions import ClientError
+
+dynamodb = boto3.client("dynamodb")
+iot_data = boto3.client("iot-data")
+iotwireless = boto3.client("iotwireless")
+
+# config
+table_name = os.environ.get("FRAGMENT_TABLE_NAME")
+fragment_ttl = int(os.environ.get("FRAGMENT_TTL_SECONDS", "300"))
+
+FRAGMENT_RE = re.compile(r"^F1 ([0-9a-f]{4}) (\d+) ([tb])([ml]) (.*)$", re.DOTALL)
+DEVICE_LOCATION_RE = re.compile(r"^\$aws/device_location/([^/]+)/get_position_estimate$")
+COMPLETION_MARKER = -1
+
+
+class ValidationError(Exception):
+    pass
+
+
+def parse_fragment(payload):
+    m = FRAGMENT_RE.match(payload)
+    if m is None:
+        raise ValidationError("Not a fragment")
+
+    message_id, sequence, encoding, more, rest = m.groups()
+    sequence = int(sequence)
+    target = None
+    if sequence == 0:
+        target, _, rest = rest.partition(" ")
+        if not target:
+            raise ValidationError("Missing target topic")
+
+    return {
+        "message_id": message_id,
+        "sequence": sequence,
+        "binary": encoding == "b",
+        "last": more == "l",
+        "target": target,
+        "data": rest,
+    }
+
+
+class FragmentStore:
+    """Fragments in DynamoDB: partition key "message_key" (client id/message id), sort key "fragment"."""
+
+    def __init__(self, client, table):
+        self.client = client
+        self.table = table
+
+    def put(self, key, fragment):
+        item = {
+            "message_key": {"S": key},
+            "fragment": {"N": str(fragment["sequence"])},
+            "payload": {"S": fragment["data"]},
+            "is_binary": {"BOOL": fragment["binary"]},
+            "is_last": {"BOOL": fragment["last"]},
+            "expires": {"N": str(int(time.time()) + fragment_ttl)},
+        }
+        if fragment["target"] is not None:
+            item["target_topic"] = {"S": fragment["target"]}
+        self.client.put_item(TableName=self.table, Item=item)
+
+    def get_all(self, key):
+        fragments = []
+        kwargs = {
+            "TableName": self.table,
+            "KeyConditionExpression": "message_key = :m AND fragment >= :s",
+            "ExpressionAttributeValues": {":m": {"S": key}, ":s": {"N": "0"}},
+            "ConsistentRead": True,
+        }
+        now = int(time.time())
+        while True:
+            response = self.client.query(**kwargs)
+            for item in response["Items"]:
+                # expired items are deleted by DynamoDB eventually, not right away
+                if int(item["expires"]["N"]) < now:
+                    continue
+                fragments.append(
+                    {
+                        "sequence": int(item["fragment"]["N"]),
+                        "data": item["payload"]["S"],
+                        "binary": item["is_binary"]["BOOL"],
+                        "last": item["is_last"]["BOOL"],
+                        "target": item.get("target_topic", {}).get("S"),
+                    }
+                )
+            if "LastEvaluatedKey" not in response:
+                return fragments
+            kwargs["ExclusiveStartKey"] = response["LastEvaluatedKey"]
+
+    def claim(self, key):
+        now = int(time.time())
+        try:
+            self.client.put_item(
+                TableName=self.table,
+                Item={
+                    "message_key": {"S": key},
+                    "fragment": {"N": str(COMPLETION_MARKER)},
+                    "expires": {"N": str(now + fragment_ttl)},
+                },
+                # message ids are reused eventually
+                ConditionExpression="attribute_not_exists(message_key) OR expires < :now",
+                ExpressionAttributeValues={":now": {"N": str(now)}},
+            )
+            return True
+        except ClientError as e:
+            if e.response["Error"]["Code"] == "ConditionalCheckFailedException":
+                return False
+            raise
+
+    def delete(self, key, sequences):
+        # the completion marker is kept until it expires, so late duplicates are not published again
+        for sequence in sequences:
+            self.client.delete_item(
+                TableName=self.table,
+                Key={"message_key": {"S": key}, "fragment": {"N": str(sequence)}},
+            )
+
+
+def assemble(fragments):
+    """Returns (target, payload) if all fragments arrived, otherwise None."""
+    by_sequence = {f["sequence"]: f for f in fragments}
+    last = [f["sequence"] for f in fragments if f["last"]]
+    if not last or 0 not in by_sequence:
+        return None
+    if any(s not in by_sequence for s in range(last[0] + 1)):
+        return None
+
+    parts = [by_sequence[s] for s in range(last[0] + 1)]
+    if parts[0]["binary"]:
+        payload = b"".join(base64.b64decode(p["data"]) for p in parts)
+    else:
+        payload = "".join(p["data"] for p in parts).encode()
+    return parts[0]["target"], payload
+
+
+def resolve_device_location(thing_name, payload):
+    # the reserved device location topics only accept requests from the device itself
+    topic = f"demo_badge/{thing_name}/location"
+    try:
+        request = json.loads(payload)
+        response = iotwireless.get_position_estimate(WiFiAccessPoints=request["WiFiAccessPoints"])
+        iot_data.publish(topic=f"{topic}/accepted", qos=1, payload=response["GeoJsonPayload"].read())
+    except (ValueError, KeyError, ClientError) as e:
+        print("Position estimate failed:", e)
+        iot_data.publish(topic=f"{topic}/rejected", qos=1, payload=json.dumps({"errorMessage": str(e)}))
+
+
+def deliver(client_id, target, payload):
+    m = DEVICE_LOCATION_RE.match(target)
+    if m is not None:
+        if m.group(1) != client_id:
+            raise ValidationError(f"{client_id} cannot request the location of {m.group(1)}")
+        resolve_device_location(m.group(1), payload)
+    else:
+        iot_data.publish(topic=target, qos=1, payload=payload)
+
+
+def handle_fragment(store, client_id, payload):
+    fragment = parse_fragment(payload)
+    key = f"{client_id}/{fragment['message_id']}"
+    store.put(key, fragment)
+
+    assembled = assemble(store.get_all(key))
+    if assembled is None:
+        return None
+    if not store.claim(key):
+        # completed by a concurrent invocation or a duplicate of an already published message
+        return None
+
+    target, message = assembled
+    deliver(client_id, target, message)
+    store.delete(key, [f["sequence"] for f in store.get_all(key)])
+    return target, message
+
+
+def lambda_handler(event, context):
+    # SELECT encode(*, 'base64') AS payload, clientid() AS client_id FROM '$aws/rules/demo_badge_fragments'
+    payload = base64.b64decode(event["payload"]).decode()
+    try:
+        result = handle_fragment(FragmentStore(dynamodb, table_name), event["client_id"], payload)
+    except ValidationError as e:
+        print("Dropping fragment from", event["client_id"], ":", e, payload[:64])
+        return {}
+
+    if result is not None:
+        print("Reassembled message for", result[0], ":", len(result[1]), "bytes")
+    return {}
@@ -0,0 +1,211 @@
+# Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+# SPDX-License-Identifier: MIT-0
+
+import base64
+import io
+import json
+import os
+import random
+from unittest import TestCase
+
+from botocore.response import StreamingBody
+from botocore.stub import Stubber
+
+os.environ.setdefault("AWS_DEFAULT_REGION", "us-east-1")
+os.environ["FRAGMENT_TABLE_NAME"] = "fragments"
+
+from main import (
+    FragmentStore,
+    ValidationError,
+    dynamodb,
+    handle_fragment,
+    iot_data,
+    iotwireless,
+    lambda_handler,
+    parse_fragment,
+)
+
+FRAGMENT_SIZE = 256  # CONFIG_MQTT_PUBLISH_MAX_PAYLOAD
+HEADER_MAX_LENGTH = len("F1 ffff 65535 tm ")
+
+
+def fragment(message, target, message_id="00a1", binary=False):
+    """Splits a message like mqtt_fragment.c on the badge does."""
+    data = base64.b64encode(message).decode() if binary else message.decode()
+    fragments = []
+    sequence = 0
+    while True:
+        capacity = FRAGMENT_SIZE - HEADER_MAX_LENGTH - (len(target) + 1 if sequence == 0 else 0)
+        if binary:
+            capacity = capacity // 4 * 4
+        chunk, data = data[:capacity], data[capacity:]
+        header = f"F1 {message_id} {sequence} {'b' if binary else 't'}{'m' if data else 'l'} "
+        fragments.append(header + (target + " " if sequence == 0 else "") + chunk)
+        if not data:
+            return fragments
+        sequence += 1
+
+
+class InMemoryFragmentStore:
+    """Local stand-in for the DynamoDB table."""
+
+    def __init__(self):
+        self.items = {}
+        self.claimed = set()
+
+    def put(self, key, fragment):
+        self.items[(key, fragment["sequence"])] = dict(fragment)
+
+    def get_all(self, key):
+        return [dict(f) for (k, _), f in sorted(self.items.items()) if k == key]
+
+    def claim(self, key):
+        if key in self.claimed:
+            return False
+        self.claimed.add(key)
+        return True
+
+    def delete(self, key, sequences):
+        for sequence in sequences:
+            self.items.pop((key, sequence), None)
+
+
+def scan_result(networks):
+    access_points = [{"MacAddress": f"ab:cd:ef:12:34:{i:02x}", "Rss": -40 - i} for i in range(networks)]
+    return json.dumps({"WiFiAccessPoints": access_points}, separators=(",", ":")).encode()
+
+
+class TestMain(TestCase):
+    def setUp(self):
+        self.store = InMemoryFragmentStore()
+        self.iot_data = Stubber(iot_data)
+        self.iotwireless = Stubber(iotwireless)
+
+    def deliver_all(self, fragments, client_id="badge"):
+        results = [handle_fragment(self.store, client_id, f) for f in fragments]
+        return [r for r in results if r is not None]
+
+    def test_parse_fragment(self):
+        f = parse_fragment("F1 00a1 0 tm hello/world {\"a\":")
+        self.assertEqual(f["message_id"], "00a1")
+        self.assertEqual(f["sequence"], 0)
+        self.assertEqual(f["target"], "hello/world")
+        self.assertEqual(f["data"], "{\"a\":")
+        self.assertFalse(f["binary"])
+        self.assertFalse(f["last"])
+
+        f = parse_fragment("F1 00a1 7 bl AAEC")
+        self.assertEqual(f["sequence"], 7)
+        self.assertIsNone(f["target"])
+        self.assertTrue(f["binary"])
+        self.assertTrue(f["last"])
+
+        with self.assertRaises(ValidationError):
+            parse_fragment("{\"not\":\"a fragment\"}")
+        with self.assertRaises(ValidationError):
+            parse_fragment("F1 00a1 0 tl ")
+
+    def test_single_fragment(self):
+        self.iot_data.add_response("publish", {}, {"topic": "hello/world", "qos": 1, "payload": b"{\"a\":1}"})
+        with self.iot_data:
+            results = self.deliver_all(fragment(b"{\"a\":1}", "hello/world"))
+        self.iot_data.assert_no_pending_responses()
+        self.assertEqual(results, [("hello/world", b"{\"a\":1}")])
+        self.assertEqual(self.store.items, {})
+
+    def test_out_of_order_and_duplicates(self):
+        message = scan_result(60)  # way more than the 2048 bytes the badge used to truncate to
+        fragments = fragment(message, "demo_badge/diagnostics")
+        self.assertGreater(len(fragments), 10)
+
+        shuffled = fragments + fragments[3:6]
+        random.Random(42).shuffle(shuffled)
+
+        self.iot_data.add_response("publish", {}, {"topic": "demo_badge/diagnostics", "qos": 1, "payload": message})
+        with self.iot_data:
+            results = self.deliver_all(shuffled)
+        self.iot_data.assert_no_pending_responses()
+        self.assertEqual(results, [("demo_badge/diagnostics", message)])
+
+    def test_binary(self):
+        for length in [0, 1, 2, 3, 500, 1001]:
+            message = bytes(random.Random(length).getrandbits(8) for _ in range(length))
+            message_id = f"{length:04x}"
+            for f in fragment(message, "demo_badge/blob", message_id, binary=True):
+                self.assertLessEqual(len(f), FRAGMENT_SIZE)
+
+            self.iot_data.add_response("publish", {}, {"topic": "demo_badge/blob", "qos": 1, "payload": message})
+            with self.iot_data:
+                results = self.deliver_all(fragment(message, "demo_badge/blob", message_id, binary=True))
+            self.iot_data.assert_no_pending_responses()
+            self.assertEqual(results, [("demo_badge/blob", message)])
+
+    def test_incomplete(self):
+        fragments = fragment(scan_result(20), "demo_badge/diagnostics")
+        with self.iot_data:
+            results = self.deliver_all(fragments[:-1])
+        self.assertEqual(results, [])
+        self.assertEqual(len(self.store.items), len(fragments) - 1)
+
+    def test_messages_of_different_devices(self):
+        self.iot_data.add_response("publish", {}, {"topic": "demo_badge/a", "qos": 1, "payload": b"first"})
+        self.iot_data.add_response("publish", {}, {"topic": "demo_badge/b", "qos": 1, "payload": b"second"})
+        with self.iot_data:
+            self.assertEqual(self.deliver_all(fragment(b"first", "demo_badge/a"), "badge1"), [("demo_badge/a", b"first")])
+            self.assertEqual(self.deliver_all(fragment(b"second", "demo_badge/b"), "badge2"), [("demo_badge/b", b"second")])
+        self.iot_data.assert_no_pending_responses()
+
+    def test_device_location(self):
+        message = scan_result(80)
+        target = "$aws/device_location/badge/get_position_estimate"
+        geojson = b'{"coordinates":[13.37,52.52],"type":"Point"}'
+
+        self.iotwireless.add_response(
+            "get_position_estimate",
+            {"GeoJsonPayload": StreamingBody(io.BytesIO(geojson), len(geojson))},
+            {"WiFiAccessPoints": json.loads(message)["WiFiAccessPoints"]},
+        )
+        self.iot_data.add_response("publish", {}, {"topic": "demo_badge/badge/location/accepted", "qos": 1, "payload": geojson})
+        with self.iot_data, self.iotwireless:
+            results = self.deliver_all(fragment(message, target))
+        self.iot_data.assert_no_pending_responses()
+        self.iotwireless.assert_no_pending_responses()
+        self.assertEqual(len(results), 1)
+
+    def test_device_location_of_other_thing(self):
+        fragments = fragment(scan_result(1), "$aws/device_location/other/get_position_estimate")
+        with self.assertRaises(ValidationError):
+            self.deliver_all(fragments, "badge")
+
+    def test_lambda_handler_with_dynamodb(self):
+        f = fragment(b"{}", "hello/world")[0]
+        event = {"payload": base64.b64encode(f.encode()).decode(), "client_id": "badge"}
+        stored = {
+            "message_key": {"S": "badge/00a1"},
+            "fragment": {"N": "0"},
+            "payload": {"S": "{}"},
+            "is_binary": {"BOOL": False},
+            "is_last": {"BOOL": True},
+            "target_topic": {"S": "hello/world"},
+            "expires": {"N": "99999999999"},
+        }
+
+        with Stubber(dynamodb) as ddb, self.iot_data:
+            ddb.add_response("put_item", {})
+            ddb.add_response("query", {"Items": [stored]})
+            ddb.add_client_error("put_item", "ConditionalCheckFailedException")  # already published
+            lambda_handler(event, None)
+            ddb.assert_no_pending_responses()
+
+    def test_dynamodb_store_ignores_expired_fragments(self):
+        expired = {
+            "message_key": {"S": "badge/00a1"},
+            "fragment": {"N": "0"},
+            "payload": {"S": "old"},
+            "is_binary": {"BOOL": False},
+            "is_last": {"BOOL": True},
+            "expires": {"N": "1"},
+        }
+        with Stubber(dynamodb) as ddb:
+            ddb.add_response("query", {"Items": [expired]})
+            self.assertEqual(FragmentStore(dynamodb, "fragments").get_all("badge/00a1"), [])
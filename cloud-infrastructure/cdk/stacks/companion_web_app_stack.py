@@ -443,6 +443,8 @@ class CompanionWebAppStack(NestedWorkshopStudioStack):
                     f"arn:{self.partition}:iot:{self.region}:{self.account}:topic/$aws/events/presence/disconnected/*",
                     f"arn:{self.partition}:iot:{self.region}:{self.account}:topic/$aws/device_location/*/get_position_estimate/accepted",
                     f"arn:{self.partition}:iot:{self.region}:{self.account}:topic/$aws/device_location/*/get_position_estimate/rejected",
+                    f"arn:{self.partition}:iot:{self.region}:{self.account}:topic/demo_badge/*/location/accepted",
+                    f"arn:{self.partition}:iot:{self.region}:{self.account}:topic/demo_badge/*/location/rejected",
                     f"arn:{self.partition}:iot:{self.region}:{self.account}:topic/demo_badge/sensors",
                 ],
             )
@@ -460,6 +462,8 @@ class CompanionWebAppStack(NestedWorkshopStudioStack):
                     f"arn:{self.partition}:iot:{self.region}:{self.account}:topicfilter/$aws/things/*/shadow/*",
                     f"arn:{self.partition}:iot:{self.region}:{self.account}:topicfilter/$aws/device_location/*/get_position_estimate/accepted",
                     f"arn:{self.partition}:iot:{self.region}:{self.account}:topicfilter/$aws/device_location/*/get_position_estimate/rejected",
+                    f"arn:{self.partition}:iot:{self.region}:{self.account}:topicfilter/demo_badge/+/location/accepted",
+                    f"arn:{self.partition}:iot:{self.region}:{self.account}:topicfilter/demo_badge/+/location/rejected",
                     f"arn:{self.partition}:iot:{self.region}:{self.account}:topicfilter/demo_badge/sensors",
                     f"arn:{self.partition}:iot:{self.region}:{self.account}:topicfilter/hello/badge",
                     f"arn:{self.partition}:iot:{self.region}:{self.account}:topicfilter/hello/cloud",
@@ -0,0 +1,98 @@
+# Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+# SPDX-License-Identifier: MIT-0
+
+from pathlib import Path
+import aws_cdk as cdk
+from aws_cdk import Duration, aws_iam as iam
+from aws_cdk import aws_dynamodb as dynamodb
+from aws_cdk import aws_iot as iot
+from aws_cdk import aws_lambda as _lambda
+from constructs import Construct
+
+from .workshop_studio import NestedWorkshopStudioStack
+
+
+class FragmentReassemblyStack(NestedWorkshopStudioStack):
+    def __init__(self, scope: Construct, construct_id: str, **kwargs) -> None:
+        super().__init__(scope, construct_id, **kwargs)
+
+        # Messages larger than the badge's publish buffers are sent in fragments (firmware/src/mqtt/mqtt_fragment.c),
+        # stored here until complete and then published to their target topic.
+
+        fragment_table = dynamodb.Table(
+            self,
+            "FragmentTable",
+            partition_key=dynamodb.Attribute(name="message_key", type=dynamodb.AttributeType.STRING),
+            sort_key=dynamodb.Attribute(name="fragment", type=dynamodb.AttributeType.NUMBER),
+            billing_mode=dynamodb.BillingMode.PAY_PER_REQUEST,
+            time_to_live_attribute="expires",
+            removal_policy=cdk.RemovalPolicy.DESTROY,
+        )
+
+        fragment_lambda_role = iam.Role(
+            self,
+            "FragmentReassemblyLambdaRole",
+            assumed_by=iam.ServicePrincipal("lambda.amazonaws.com"),
+            managed_policies=[
+                iam.ManagedPolicy.from_aws_managed_policy_name("service-role/AWSLambdaBasicExecutionRole")
+            ],
+        )
+        fragment_table.grant_read_write_data(fragment_lambda_role)
+        fragment_lambda_role.add_to_policy(
+            iam.PolicyStatement(
+                effect=iam.Effect.ALLOW,
+                actions=["iot:Publish"],
+                resources=[f"arn:{self.partition}:iot:{self.region}:{self.account}:topic/*"],
+            )
+        )
+        fragment_lambda_role.add_to_policy(
+            iam.PolicyStatement(
+                effect=iam.Effect.ALLOW,
+                actions=["iotwireless:GetPositionEstimate"],
+                resources=["*"],
+            )
+        )
+
+        lambda_path = (
+            Path(__file__).parents[1].joinpath("lambda", "FragmentReassemblyLambda")
+        )
+        fragment_lambda = _lambda.Function(
+            self,
+            "FragmentReassemblyLambda",
+            runtime=_lambda.Runtime.PYTHON_3_11,
+            code=_lambda.Code.from_asset(path=str(lambda_path), exclude=["test_main.py"]),
+            handler="main.lambda_handler",
+            role=fragment_lambda_role,
+            timeout=Duration.seconds(10),
+            environment={
+                "FRAGMENT_TABLE_NAME": fragment_table.table_name,
+                "FRAGMENT_TTL_SECONDS": "300",
+            },
+        )
+
+        # This is needed for IoT Rule to be able to trigger the Lambda function
+        fragment_lambda.add_permission(
+            id="fragment_reassembly_lambda_invoke_function",
+            principal=iam.ServicePrincipal("iot.amazonaws.com"),
+            source_arn=f"arn:{self.partition}:iot:{self.region}:{self.account}:*",
+            action="lambda:InvokeFunction",
+        )
+
+        # fragments are sent via Basic Ingest, they are not valid JSON
+        rule_name = "demo_badge_fragments"
+        iot.CfnTopicRule(
+            self,
+            "FragmentRule",
+            rule_name=rule_name,
+            topic_rule_payload=iot.CfnTopicRule.TopicRulePayloadProperty(
+                sql=f"SELECT encode(*, 'base64') AS payload, clientid() AS client_id FROM '$aws/rules/{rule_name}'",
+                aws_iot_sql_version="2016-03-23",
+                actions=[
+                    iot.CfnTopicRule.ActionProperty(
+                        lambda_=iot.CfnTopicRule.LambdaActionProperty(
+                            function_arn=fragment_lambda.function_arn,
+                        )
+                    )
+                ],
+            ),
+        )
@@ -5,6 +5,7 @@ from constructs import Construct
 
 from .companion_web_app_stack import *
 from .credentials_stack import *
+from .fragment_reassembly_stack import *
 from .grafana_stack import *
 from .iot_policy_stack import *
 from .sidewalk_provisioning_stack import *
@@ -34,6 +35,8 @@ class DemoBadgeWorkshopStack(WorkshopStudioStack):
 
         sidewalk_stack = SidewalkStack(self, "Sidewalk")
 
+        fragment_reassembly_stack = FragmentReassemblyStack(self, "FragmentReassembly")
+
         sidewalk_provisioning_stack = SidewalkProvisioningStack(
             self,
             "SidewalkProvisioning",
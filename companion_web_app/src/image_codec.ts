@@ -0,0 +1,96 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+// Compressed RGB565 images for the Image Transfer module, decoded by the badge while they are downloaded.
+// The format is described in firmware/src/image_codec.c.
+
+const OP_INDEX = 0x00;
+const OP_DIFF = 0x40;
+const OP_LUMA = 0x80;
+const OP_RUN = 0xC0;
+const OP_RGB565 = 0xFE;
+const MAX_RUN = 62;
+
+export const IMAGE_HEADER_SIZE = 14;
+export const IMAGE_FLAG_LOSSY = 0x01;
+
+function hash(px: number) {
+    return ((px >> 11) * 3 + ((px >> 5) & 0x3F) * 5 + (px & 0x1F) * 7) & 0x3F;
+}
+
+// difference of two components of the given number of bits, wrapped around
+function wrap(d: number, bits: number) {
+    const range = 1 << bits;
+    return ((d + range / 2) & (range - 1)) - range / 2;
+}
+
+// keeps 4 bits per component, runs and small differences become much more likely
+export function quantizeRGB565(px: number) {
+    return px & 0b11110_111100_11110;
+}
+
+// pixels: RGB565 values, row by row
+export function encodeImage(pixels: Uint16Array | number[], width: number, height: number, lossy = false): Uint8Array {
+    // worst case: every pixel as RGB565
+    const out = new Uint8Array(IMAGE_HEADER_SIZE + width * height * 3);
+    const index = new Uint16Array(64);
+    let o = IMAGE_HEADER_SIZE;
+    let previous = 0;
+    let run = 0;
+
+    for (let i = 0; i < width * height; i++) {
+        const px = lossy ? quantizeRGB565(pixels[i]) : pixels[i];
+
+        if (px === previous) {
+            run++;
+            if (run === MAX_RUN) {
+                out[o++] = OP_RUN | (run - 1);
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            out[o++] = OP_RUN | (run - 1);
+            run = 0;
+        }
+
+        const h = hash(px);
+        if (index[h] === px) {
+            out[o++] = OP_INDEX | h;
+        } else {
+            index[h] = px;
+
+            const dr = wrap((px >> 11) - (previous >> 11), 5);
+            const dg = wrap(((px >> 5) & 0x3F) - ((previous >> 5) & 0x3F), 6);
+            const db = wrap((px & 0x1F) - (previous & 0x1F), 5);
+            const half = Math.floor(dg / 2);
+            const drg = dr - half;
+            const dbg = db - half;
+
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                out[o++] = OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2);
+            } else if (drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+                out[o++] = OP_LUMA | (dg + 32);
+                out[o++] = ((drg + 8) << 4) | (dbg + 8);
+            } else {
+                out[o++] = OP_RGB565;
+                out[o++] = px >> 8;
+                out[o++] = px & 0xFF;
+            }
+        }
+        previous = px;
+    }
+    if (run > 0) {
+        out[o++] = OP_RUN | (run - 1);
+    }
+
+    const header = new DataView(out.buffer);
+    const length = o - IMAGE_HEADER_SIZE;
+    out.set([0x51, 0x35, 0x36, 0x35], 0); // "Q565"
+    header.setUint16(4, width);
+    header.setUint16(6, height);
+    header.setUint8(8, lossy ? IMAGE_FLAG_LOSSY : 0);
+    header.setUint8(9, 0);
+    header.setUint32(10, length);
+    return out.slice(0, o);
+}
@@ -8,6 +8,7 @@ import { fromCognitoIdentityPool } from "@aws-sdk/credential-provider-cognito-id
 import { getIoTClient } from "./aws_access";
 import { CreateJobCommand, CreateStreamCommand, TargetSelection } from "@aws-sdk/client-iot";
 import { v4 as uuid } from "uuid";
+import { encodeImage } from "./image_codec";
 
 const imageHeight = 240;
 const imageWidth = 240;
@@ -20,6 +21,7 @@ let startCameraButton: HTMLButtonElement;
 let takeImageButton: HTMLButtonElement;
 let uploadImageToS3Button: HTMLButtonElement;
 let uploadImageToS3Spinner: HTMLElement;
+let imageFormatSelect: HTMLSelectElement;
 let createOTAJobButton: HTMLButtonElement;
 let createOTAJobSpinner: HTMLElement;
 let startOverButton: HTMLButtonElement;
@@ -36,6 +38,7 @@ export async function initImageTransfer(writeToSerialPort) {
     takeImageButton = document.getElementById('take_image')! as HTMLButtonElement;
     uploadImageToS3Button = document.getElementById('upload_to_s3')! as HTMLButtonElement;
     uploadImageToS3Spinner = document.getElementById('upload_to_s3_spinner')! as HTMLElement;
+    imageFormatSelect = document.getElementById('image_format')! as HTMLSelectElement;
     createOTAJobButton = document.getElementById('create_ota_job')! as HTMLButtonElement;
     createOTAJobSpinner = document.getElementById('create_ota_job_spinner')! as HTMLElement;
     startOverButton = document.getElementById('start_over_image_transfer')! as HTMLButtonElement;
@@ -184,13 +187,29 @@ function convertToRGB565(imgd: ImageData) {
     return rgb565;
 }
 
+// imageData holds the RGB565 pixels high byte first, as the badge renders them
+function encodeImageData(format: string) {
+    if (format === 'raw') {
+        return new Uint16Array(imageData);
+    }
+
+    const pixels = Array.from(imageData, (v) => ((v & 0xFF) << 8) | (v >> 8));
+    const encoded = encodeImage(pixels, imageWidth, imageHeight, format === 'lossy');
+    if (encoded.length >= imageData.byteLength) {
+        // e.g. pure noise, the badge takes uncompressed images as well
+        return new Uint16Array(imageData);
+    }
+    console.log(`Image compressed to ${encoded.length} bytes (${(imageData.byteLength / encoded.length).toFixed(1)}x)`);
+    return encoded;
+}
+
 async function uploadImageToS3() {
     if (imageData === null) {
         console.error("imageData is null!");
         return;
     }
 
-    const blob = new Blob([new Uint16Array(imageData)], { type: "application/octet-stream" });
+    const blob = new Blob([encodeImageData(imageFormatSelect.value)], { type: "application/octet-stream" });
 
     getEnv().image_s3_object_name = 'MyImage.bin';
     getEnv().image_s3_object_size = blob.size;
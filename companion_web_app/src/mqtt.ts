@@ -110,6 +110,9 @@ export async function initMqtt() {
             subscriptions: [
                 { topicFilter: '$aws/device_location/+/get_position_estimate/accepted', qos: mqtt5.QoS.AtLeastOnce },
                 { topicFilter: '$aws/device_location/+/get_position_estimate/rejected', qos: mqtt5.QoS.AtLeastOnce },
+                // large scan results are sent in fragments and resolved by the FragmentReassemblyLambda
+                { topicFilter: 'demo_badge/+/location/accepted', qos: mqtt5.QoS.AtLeastOnce },
+                { topicFilter: 'demo_badge/+/location/rejected', qos: mqtt5.QoS.AtLeastOnce },
             ]
         });
 
@@ -166,7 +169,7 @@ export async function initMqtt() {
             if (!r.clientId.startsWith('iotconsole-')) {
                 console.log("MQTT event presence disconnected:", eventData.message.payload?.toString());
             }
-        } else if (topic.match('\\$aws/device_location/.+/get_position_estimate/accepted')) {
+        } else if (topic.match('\\$aws/device_location/.+/get_position_estimate/accepted') || topic.match('demo_badge/.+/location/accepted')) {
             console.log("MQTT get_position_estimate/accepted:", eventData.message.payload?.toString());
             const r = JSON.parse(eventData.message.payload!.toString());
 
@@ -178,7 +181,7 @@ export async function initMqtt() {
 
             const rawResult = document.getElementById('device_location_result') as HTMLPreElement;
             rawResult.textContent = JSON.stringify(r, null, 2);
-        } else if (topic.match('\\$aws/device_location/.+/get_position_estimate/rejected')) {
+        } else if (topic.match('\\$aws/device_location/.+/get_position_estimate/rejected') || topic.match('demo_badge/.+/location/rejected')) {
             console.log("MQTT get_position_estimate/rejected:", eventData.message.payload?.toString());
         } else if (topic == 'hello/cloud') {
             console.log("MQTT hello/cloud:", eventData.message.payload?.toString());
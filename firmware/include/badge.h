@@ -10,12 +10,11 @@
 #include <zephyr/drivers/sensor.h>
 #include <zephyr/shell/shell.h>
 
+#include "mqtt/mqtt.h"
 #include "peripherals/expresslink.h"
 
 #define USB_PATH(file) ( "/" CONFIG_MASS_STORAGE_DISK_NAME ":/" file )
 
-#define HEX_TO_BYTE(_a, _b) (((((_a) % 32 + 9) % 25) << 4) + (((_b) % 32 + 9) % 25))
-
 #define WORKSHOP_MODULE_WELCOME_SCREEN "welcome_screen"
 #define WORKSHOP_MODULE_SELF_TEST "self_test"
 #define WORKSHOP_MODULE_MQTT_PUB_SUB "mqtt_pub_sub"
@@ -59,6 +58,7 @@ void device_location(void *, void *, void *);
 void sensor_data_ingestion(void *, void *, void *);
 void digital_twin_and_shadow(void *, void *, void *);
 void image_transfer(void *, void *, void *);
+int image_transfer_benchmark(const struct shell *sh);
 void start_sidewalk_sample(void *, void *, void *);
 void ble_sensor_peripheral(void *, void *, void *);
 
@@ -79,6 +79,7 @@ void display_handler();
 void display_handler_async();
 lv_obj_t *show_picture(const char *path);
 void delete_picture();
+int draw_pixels(uint16_t x, uint16_t y, uint16_t width, uint16_t height, const void *pixels);
 lv_obj_t *show_qr_code(const char *url);
 void delete_qr_code();
 void set_display_brightness(int v);
@@ -92,8 +93,10 @@ typedef struct init_retcode_t {
     int8_t sht31;
     int8_t lsm6dsl;
     int8_t expresslink;
+    int8_t mqtt_publish;
     int8_t display;
     int8_t usb_mass_storage;
+    int8_t mqtt_journal;
     int8_t settings;
 } init_retcode_t;
 
@@ -0,0 +1,18 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef HEX_H
+#define HEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Decodes hex_length hex digits (upper or lower case) into hex_length / 2 bytes, see hex.c.
+// out may point to hex itself to decode in place. Returns the number of bytes,
+// -EINVAL for an odd length or an invalid digit, and -ENOBUFS if out_length is too small.
+int hex_decode(const char *hex, size_t hex_length, uint8_t *out, size_t out_length);
+
+// Returns the byte of two hex digits, or -EINVAL.
+int hex_decode_byte(char hi, char lo);
+
+#endif // HEX_H
@@ -0,0 +1,51 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef IMAGE_CODEC_H
+#define IMAGE_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Compressed RGB565 images of the Image Transfer module, see image_codec.c.
+// Encoded by the companion web app (companion_web_app/src/image_codec.ts).
+#define IMAGE_HEADER_SIZE (14)
+#define IMAGE_FLAG_LOSSY (0x01) // pixels were quantized before encoding, decoded like lossless images
+
+struct image_header {
+    uint16_t width;
+    uint16_t height;
+    uint8_t flags;
+    uint32_t length; // of the encoded pixel data behind the header
+};
+
+// Returns 0, -ENOMSG if data does not start with the magic of a compressed image, or -EINVAL.
+int image_header_parse(const uint8_t *data, size_t len, struct image_header *header);
+
+// Called with decoded pixels (RGB565, high byte first) at their offset in the raw image,
+// returning non-zero stops decoding with that error.
+typedef int (*image_decoder_output_cb)(size_t offset, const uint8_t *data, size_t len, void *user_data);
+
+struct image_decoder {
+    uint8_t *out; // decoded pixels are collected here, an even number of bytes
+    size_t out_length;
+    image_decoder_output_cb output;
+    void *user_data;
+
+    // managed by image_codec.c
+    size_t used;
+    size_t offset; // of out in the decoded image
+    uint32_t remaining; // pixels
+    uint16_t previous;
+    uint16_t index[64];
+    uint8_t op[3];
+    uint8_t op_length;
+};
+
+void image_decoder_init(struct image_decoder *dec, uint32_t pixels, uint8_t *out, size_t out_length, image_decoder_output_cb output, void *user_data);
+// Decodes the next bytes of the encoded data, in chunks of any size. Returns -EINVAL if the data is corrupt.
+int image_decoder_write(struct image_decoder *dec, const uint8_t *data, size_t len);
+// Passes the last decoded pixels to the output, returns -ENODATA if the image is incomplete.
+int image_decoder_finish(struct image_decoder *dec);
+
+#endif // IMAGE_CODEC_H
@@ -0,0 +1,29 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef LINE_ASSEMBLER_H
+#define LINE_ASSEMBLER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Collects a line from the spans of a receive buffer as they arrive, see line_assembler.c.
+struct line_assembler {
+    char *buffer;
+    size_t size; // including the string terminator
+    size_t length;
+    size_t dropped; // bytes of a line longer than the buffer
+    bool complete;  // the line ending was received
+};
+
+void line_assembler_init(struct line_assembler *a, char *buffer, size_t size);
+
+// Takes received bytes up to and including the line ending, returns how many were taken.
+// They can be released from the receive buffer right away, so lines may be longer than the receive buffer.
+size_t line_assembler_put(struct line_assembler *a, const uint8_t *data, size_t len);
+
+// Terminates the line, without the line ending ("\n" or "\r\n").
+char *line_assembler_finish(struct line_assembler *a);
+
+#endif // LINE_ASSEMBLER_H
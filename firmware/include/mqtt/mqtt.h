@@ -0,0 +1,132 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef MQTT_H
+#define MQTT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/kernel.h>
+
+struct shell;
+struct expresslink_event;
+
+enum mqtt_drop_policy {
+    MQTT_DROP_OLDEST, // telemetry: the most recent samples are the most useful
+    MQTT_DROP_NEWEST, // events: keep what is queued, reject new messages
+};
+
+// An ExpressLink topic slot used by a workshop module, e.g. {1, "hello/badge", false}
+// The remaining fields only apply to messages sent with mqtt_queue_publish().
+struct mqtt_topic {
+    uint8_t index;
+    const char *topic;
+    bool subscribe;
+    uint8_t priority;           // higher priorities are sent first and evict lower priorities from a full queue
+    bool coalesce;              // latest value wins, e.g. for state topics
+    enum mqtt_drop_policy drop; // if the queue is full
+};
+
+// Declares the topics and subscriptions a workshop module needs on the shared connection.
+// The callbacks are called whenever the connection (re-)enters or leaves the connected state,
+// either from the ExpressLink event thread or from mqtt_connection_acquire().
+struct mqtt_profile {
+    const char *name;
+    const struct mqtt_topic *topics;
+    size_t topic_count;
+    bool shadow; // enables the device shadow, the module sends AT+SHADOW INIT itself
+    uint8_t qos; // QoS of all messages sent by ExpressLink, 1 to receive PUBACK events
+    void (*connected)(void *user_data);
+    void (*disconnected)(void *user_data);
+    // called after an OVERRUN event to fetch the messages buffered by the module, returns their number;
+    // the messages are drained if not set
+    size_t (*overrun)(void *user_data);
+    void *user_data;
+};
+
+enum mqtt_connection_state {
+    MQTT_DISCONNECTED,
+    MQTT_CONNECTING, // AT+CONNECT! sent, waiting for the CONNECT event
+    MQTT_BACKOFF,    // waiting for the next connection attempt
+    MQTT_CONNECTED,
+    MQTT_SLEEPING, // disconnected and the module is asleep until shortly before the next publish
+};
+
+// hint = connection hint of the last CONNECT or CONLOST event, 0 if none
+typedef void (*mqtt_connection_state_cb)(enum mqtt_connection_state state, int hint, void *user_data);
+
+int mqtt_connection_acquire(const struct mqtt_profile *profile);
+void mqtt_connection_release(const struct mqtt_profile *profile);
+bool mqtt_connection_is_connected(void);
+enum mqtt_connection_state mqtt_connection_get_state(void);
+
+// Callbacks are called on every state change while holding the connection mutex, they must not block.
+int mqtt_connection_state_subscribe(mqtt_connection_state_cb callback, void *user_data);
+void mqtt_connection_state_unsubscribe(mqtt_connection_state_cb callback);
+
+const char *mqtt_connection_state_str(enum mqtt_connection_state state);
+const char *mqtt_connection_hint_str(int hint);
+// Duty cycling between scheduled publishes: disconnects and puts the module to sleep, and wakes it up early
+// enough to be connected again at the deadline (uptime in milliseconds). Any mqtt_connection_acquire() or
+// release wakes it up right away. Returns -EBUSY while messages are queued, in flight or journaled,
+// or while connecting, and -EAGAIN if the deadline is too close for sleeping to pay off.
+int mqtt_connection_sleep_until(int64_t deadline);
+void mqtt_connection_print_status(const struct shell *sh);
+void mqtt_connection_reset_stats(void);
+
+// Copies the payload into the in-flight window and sends it as soon as the connection is available.
+// Waits up to timeout for a free slot, returns -EAGAIN if the window is still full.
+// The QoS must match the QoS configured by the active profile, QoS1 messages are sent again until acknowledged.
+int mqtt_publish(uint8_t topic_index, const char *payload, size_t payload_length, uint8_t qos, k_timeout_t timeout);
+void mqtt_publish_handle_puback(const struct expresslink_event *event, void *user_data); // subscribed by mqtt_connection.c
+size_t mqtt_publish_inflight(void);
+void mqtt_publish_print_stats(const struct shell *sh);
+void mqtt_publish_reset_stats(void);
+int init_mqtt_publish(void);
+
+// Never blocks: queues the message and moves it to the in-flight window of mqtt_publish() in the background.
+// Returns -ENOBUFS if the queue is full and the topic's drop policy rejects the message.
+int mqtt_queue_publish(const struct mqtt_topic *topic, uint8_t qos, const char *payload, size_t payload_length);
+void mqtt_queue_kick(void); // called by mqtt_publish.c whenever a window slot becomes free
+size_t mqtt_queue_depth(void);
+void mqtt_queue_print_stats(const struct shell *sh);
+void mqtt_queue_reset_stats(void);
+
+// Topic of the fragments of large messages, reassembled in the cloud and published to their target topic
+#define MQTT_FRAGMENT_TOPIC "$aws/rules/demo_badge_fragments"
+
+// Streams a message of any size as a sequence of fragments through mqtt_publish(), see mqtt_fragment.c.
+// Binary messages are base64 encoded, text messages must not contain line endings.
+struct mqtt_fragment_writer {
+    uint8_t topic_index; // configured as MQTT_FRAGMENT_TOPIC
+    uint8_t qos;
+    const char *target;
+    bool binary;
+    uint16_t message_id;
+    uint16_t sequence;
+    uint16_t fragments_sent;
+    int error;
+    uint8_t pending[2]; // binary data not yet base64 encoded
+    size_t pending_length;
+    size_t used;
+    char buffer[CONFIG_MQTT_PUBLISH_MAX_PAYLOAD];
+};
+
+int mqtt_fragment_begin(struct mqtt_fragment_writer *w, uint8_t topic_index, uint8_t qos, const char *target, bool binary);
+int mqtt_fragment_write(struct mqtt_fragment_writer *w, const void *data, size_t length); // may block for a free window slot
+int mqtt_fragment_end(struct mqtt_fragment_writer *w);
+// Sends a message from memory with a writer shared by all callers, one message at a time.
+int mqtt_publish_fragmented(uint8_t topic_index, uint8_t qos, const char *target, const void *payload, size_t payload_length, bool binary);
+
+// Like mqtt_queue_publish(), but appends the message to the journal on the USB mass storage volume while not
+// connected or if the queue rejects it. Journaled messages are replayed once connected, JSON objects get a
+// "timestamp" field (milliseconds since the epoch) of the time they were produced, if known.
+int mqtt_journal_publish(const struct mqtt_topic *topic, uint8_t qos, const char *payload, size_t payload_length);
+bool mqtt_journal_backlog(void); // journaled messages are waiting to be replayed
+void mqtt_journal_print_stats(const struct shell *sh);
+void mqtt_journal_reset_stats(void);
+int init_mqtt_journal(void); // after the USB mass storage volume is mounted
+
+#endif // MQTT_H
@@ -5,49 +5,193 @@
 #define EXPRESSLINK_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/kernel.h>
 
 // https://docs.aws.amazon.com/iot-expresslink/latest/programmersguide/elpg-event-handling.html#elpg-event-handling-commands
-#define EL_EVENT_MSG                "1 "  // parameter = topic index. A message was received on topic #.
-#define EL_EVENT_STARTUP            "2 "  // parameter = 0. The module has entered the active state.
-#define EL_EVENT_CONLOST            "3 "  // parameter = 0. Connection unexpectedly lost.
-#define EL_EVENT_OVERRUN            "4 "  // parameter = 0. Receive buffer Overrun (topic in detail).
-#define EL_EVENT_OTA                "5 "  // parameter = 0. OTA event (see OTA? command for details).
-#define EL_EVENT_CONNECT            "6 "  // parameter = Connection Hint. Connection established (== 0) or failed (> 0).
-#define EL_EVENT_CONFMODE           "7 "  // parameter = 0. CONFMODE exit with success.
-#define EL_EVENT_SUBACK             "8 "  // parameter = Topic Index. Subscription accepted.
-#define EL_EVENT_SUBNACK            "9 "  // parameter = Topic Index. Subscription rejected.
-#define EL_EVENT_PUBACK             "10"  // parameter = Topic Index. QoS1 PUBACK was received.
-// 11..19 RESERVED
-#define EL_EVENT_SHADOW_INIT        "20 " // parameter = Shadow Index. Shadow initialization successfully.
-#define EL_EVENT_SHADOW_INIT_FAILED "21 " // parameter = Shadow Index. Shadow initialization failed.
-#define EL_EVENT_SHADOW_DOC         "22 " // parameter = Shadow Index. Shadow document received.
-#define EL_EVENT_SHADOW_UPDATE      "23 " // parameter = Shadow Index. Shadow update result received.
-#define EL_EVENT_SHADOW_DELTA       "24 " // parameter = Shadow Index. Shadow delta update received.
-#define EL_EVENT_SHADOW_DELETE      "25 " // parameter = Shadow Index. Shadow delete result received
-#define EL_EVENT_SHADOW_SUBACK      "26 " // parameter = Shadow Index. Shadow delta subscription accepted.
-#define EL_EVENT_SHADOW_SUBNACK     "27 " // parameter = Shadow Index. Shadow delta subscription rejected.
-// 28..39 RESERVED
-#define EL_EVENT_BLE_CONNECTED             "40 " // parameter = 0. BLE Connection was established peripheral role.
-#define EL_EVENT_BLE_DISCOVER_COMPLETE     "41 " // parameter = 0 or Hint Code. 0 for successful; >0 vendor defined Hint Codes.
-#define EL_EVENT_BLE_CONNECTION_LOST       "42 " // parameter = 0 or Central Index. Connection was terminated or 0 if peripheral role.
-#define EL_EVENT_BLE_SUBSCRIBE_START       "43 " // parameter = GATT Index. Subscription started on BLEGATT# while on peripheral mode.
-#define EL_EVENT_BLE_SUBSCRIBE_STOP        "44 " // parameter = GATT Index. Subscription terminated on BLEGATT# while on peripheral mode.
-#define EL_EVENT_BLE_READ_REQUEST          "45 " // parameter = GATT Index. Read operation requested at BLEGATT# while on peripheral mode.
-#define EL_EVENT_BLE_WRITE_REQUEST         "46 " // parameter = GATT Index. Write operation requested at BLEGATT# while on peripheral mode.
-#define EL_EVENT_BLE_SUBSCRIPTION_RECEIVED "47 " // parameter = Subscription Index. Subscription was received on BLECentral# connection.
-// <= 999 RESERVED
+enum expresslink_event_id {
+    EL_EVENT_ANY                = 0,   // wildcard for expresslink_event_subscribe(), matches every event.
+    EL_EVENT_MSG                = 1,   // parameter = topic index. A message was received on topic #.
+    EL_EVENT_STARTUP            = 2,   // parameter = 0. The module has entered the active state.
+    EL_EVENT_CONLOST            = 3,   // parameter = 0. Connection unexpectedly lost.
+    EL_EVENT_OVERRUN            = 4,   // parameter = 0. Receive buffer Overrun (topic in detail).
+    EL_EVENT_OTA                = 5,   // parameter = 0. OTA event (see OTA? command for details).
+    EL_EVENT_CONNECT            = 6,   // parameter = Connection Hint. Connection established (== 0) or failed (> 0).
+    EL_EVENT_CONFMODE           = 7,   // parameter = 0. CONFMODE exit with success.
+    EL_EVENT_SUBACK             = 8,   // parameter = Topic Index. Subscription accepted.
+    EL_EVENT_SUBNACK            = 9,   // parameter = Topic Index. Subscription rejected.
+    EL_EVENT_PUBACK             = 10,  // parameter = Topic Index. QoS1 PUBACK was received.
+    // 11..19 RESERVED
+    EL_EVENT_SHADOW_INIT        = 20,  // parameter = Shadow Index. Shadow initialization successfully.
+    EL_EVENT_SHADOW_INIT_FAILED = 21,  // parameter = Shadow Index. Shadow initialization failed.
+    EL_EVENT_SHADOW_DOC         = 22,  // parameter = Shadow Index. Shadow document received.
+    EL_EVENT_SHADOW_UPDATE      = 23,  // parameter = Shadow Index. Shadow update result received.
+    EL_EVENT_SHADOW_DELTA       = 24,  // parameter = Shadow Index. Shadow delta update received.
+    EL_EVENT_SHADOW_DELETE      = 25,  // parameter = Shadow Index. Shadow delete result received
+    EL_EVENT_SHADOW_SUBACK      = 26,  // parameter = Shadow Index. Shadow delta subscription accepted.
+    EL_EVENT_SHADOW_SUBNACK     = 27,  // parameter = Shadow Index. Shadow delta subscription rejected.
+    // 28..39 RESERVED
+    EL_EVENT_BLE_CONNECTED             = 40,  // parameter = 0. BLE Connection was established peripheral role.
+    EL_EVENT_BLE_DISCOVER_COMPLETE     = 41,  // parameter = 0 or Hint Code. 0 for successful; >0 vendor defined Hint Codes.
+    EL_EVENT_BLE_CONNECTION_LOST       = 42,  // parameter = 0 or Central Index. Connection was terminated or 0 if peripheral role.
+    EL_EVENT_BLE_SUBSCRIBE_START       = 43,  // parameter = GATT Index. Subscription started on BLEGATT# while on peripheral mode.
+    EL_EVENT_BLE_SUBSCRIBE_STOP        = 44,  // parameter = GATT Index. Subscription terminated on BLEGATT# while on peripheral mode.
+    EL_EVENT_BLE_READ_REQUEST          = 45,  // parameter = GATT Index. Read operation requested at BLEGATT# while on peripheral mode.
+    EL_EVENT_BLE_WRITE_REQUEST         = 46,  // parameter = GATT Index. Write operation requested at BLEGATT# while on peripheral mode.
+    EL_EVENT_BLE_SUBSCRIPTION_RECEIVED = 47,  // parameter = Subscription Index. Subscription was received on BLECentral# connection.
+    // <= 999 RESERVED
+};
 
 void expresslink_reset(void);
 void expresslink_wake(void);
+// AT+SLEEP<mode> <duration in seconds>: the module wakes up after the duration or via the WAKE pin,
+// which is also pulsed before the next command is sent. Disconnect first, the connection is lost anyway.
+bool expresslink_sleep(uint8_t mode, uint32_t duration);
+bool expresslink_is_sleeping(void);
 
 bool expresslink_check_event_pending(void);
-bool expresslink_is_event(const char*, const char*);
 
+// A parsed `AT+EVENT?` response, e.g. "OK 6 0 CONNECT" => {EL_EVENT_CONNECT, 0}
+struct expresslink_event {
+    enum expresslink_event_id id;
+    int parameter;
+};
+
+typedef void (*expresslink_event_cb)(const struct expresslink_event *event, void *user_data);
+
+// Callbacks are called from the ExpressLink event dispatcher thread and may send AT commands.
+// Pending events are only drained from the module while at least one callback is subscribed.
+int expresslink_event_subscribe(enum expresslink_event_id id, expresslink_event_cb callback, void *user_data);
+void expresslink_event_unsubscribe(expresslink_event_cb callback);
+void expresslink_event_notify(void);
+int init_expresslink_events(void);
+
+struct k_sem;
+struct expresslink_request;
+
+typedef void (*expresslink_request_cb)(struct expresslink_request *request);
+
+// Called with the additional lines of an OKn response straight from the RX ring, without copying.
+// Long lines are delivered in several chunks, end_of_line is set on the last one (the line ending is stripped).
+// Returning non-zero skips the rest of the response, which is then returned by expresslink_stream_response_lines().
+// -EIO is returned if a line lost bytes to a receive overrun, after its chunks were passed to the callback.
+typedef int (*expresslink_response_chunk_cb)(const char *data, size_t len, bool end_of_line, void *user_data);
+
+// One segment of a command that is transmitted without copying, e.g. {"AT+SEND1 ", payload, "\n"}.
+struct expresslink_iovec {
+    const void *base;
+    size_t len;
+};
+
+// An AT command queued for the ExpressLink I/O thread.
+// The request and the command string (or segments) must stay valid until the request is no longer pending.
+struct expresslink_request {
+    const char *command;
+    const struct expresslink_iovec *iov; // optional, replaces command
+    size_t iovcnt;
+    char *response;                 // optional, receives the response without the "OK " prefix
+    size_t response_length;
+    expresslink_response_chunk_cb stream; // optional, receives the payload of an "OK " response instead of response
+    expresslink_request_cb callback; // optional, called from the I/O thread; may read additional response lines
+    void *user_data;                 // passed to stream and callback
+    uint32_t timeout;               // optional, response timeout in milliseconds, 0 = default for the AT command
+
+    // managed by the driver
+    volatile bool pending;
+    bool success;
+    struct k_sem *done;
+    bool read_response_lines; // synchronous requests: the requester reads the additional lines of an OKn response
+};
+
+// Response and command buffers of EXPRESSLINK_BUFFER_SIZE bytes, borrowed from a fixed pool instead of the heap.
+// Only CONFIG_EXPRESSLINK_BUFFER_COUNT buffers exist, return them when the workshop module shuts down.
+#define EXPRESSLINK_BUFFER_SIZE CONFIG_EXPRESSLINK_BUFFER_SIZE
+char *expresslink_buffer_alloc(k_timeout_t timeout);
+void expresslink_buffer_free(char *buffer);
+
+int expresslink_submit(struct expresslink_request *request);
 bool expresslink_send_command(const char *command, char *response, size_t response_length);
+bool expresslink_send_commandv(const struct expresslink_iovec *iov, size_t iovcnt, char *response, size_t response_length);
+// Like expresslink_send_command(), but the payload of an "OK " response is passed to the callback from the I/O thread
+// while it arrives, so it does not have to fit into a buffer, e.g. the result of a crowded AT+DIAG WIFI SCAN.
+// Other responses (e.g. errors) are returned in response. The callback must not send commands.
+bool expresslink_send_command_streamed(const char *command, char *response, size_t response_length, expresslink_response_chunk_cb callback, void *user_data);
+// Like expresslink_send_command(), but the additional lines of an OKn response are kept for
+// expresslink_read_response_line() or expresslink_stream_response_lines(). All other synchronous commands discard them.
+bool expresslink_send_command_multiline(const char *command, char *response, size_t response_length);
+// Returns -EIO if the line lost bytes to a receive overrun, the rest of the response is then discarded.
 int expresslink_read_response_line(char *buffer, size_t buffer_length);
+// Passes the additional lines of an OKn response to the callback, see expresslink_response_chunk_cb.
+int expresslink_stream_response_lines(size_t lines, expresslink_response_chunk_cb callback, void *user_data);
+void expresslink_cancel(void);
+
+enum expresslink_command_result {
+    EL_COMMAND_OK,
+    EL_COMMAND_ERROR,
+    EL_COMMAND_TIMEOUT,
+};
+
+void expresslink_stats_record_command(const char *command, uint32_t latency, enum expresslink_command_result result);
+void expresslink_stats_add_tx(size_t bytes);
+void expresslink_stats_add_rx(size_t bytes, size_t dropped);
+void expresslink_stats_record_rx_overrun(void);
+void expresslink_stats_record_resync(void);
+void expresslink_stats_record_sleep(uint32_t awake); // milliseconds the module was awake since it was woken up
+void expresslink_stats_record_wake(uint32_t asleep);
+void expresslink_stats_print(const struct shell *sh);
+void expresslink_stats_reset(void);
+int init_expresslink_stats(void);
+
+bool expresslink_config_cache_lookup(const char *command, char *response, size_t response_length);
+void expresslink_config_cache_update(const char *command, const char *response_line);
+void expresslink_config_cache_invalidate(void);
+void expresslink_config_cache_print(const struct shell *sh);
 
 void expresslink_provisioning(void);
 int expresslink_export_certificate(const struct shell *sh, size_t argc, char **argv, bool force_write);
 int expresslink_over_the_wire_update(const char *path, const char *expected_version, bool force_update);
 
+// Host OTA download of the image received by the module (AT+OTA READ), see expresslink_ota.c.
+// Called with verified bytes only, in order; returning non-zero aborts the download with that error.
+typedef int (*expresslink_ota_sink_cb)(size_t offset, const uint8_t *data, size_t len, void *user_data);
+
+struct expresslink_ota_download {
+    char *buffer; // receives the hex encoded blocks, e.g. from expresslink_buffer_alloc()
+    size_t buffer_length;
+    expresslink_ota_sink_cb sink;
+    void *user_data;
+
+    // managed by expresslink_ota.c
+    size_t position; // read position of the module, SIZE_MAX if unknown
+    size_t block_size;
+    size_t max_block_size;
+    uint32_t good_blocks; // since the block size last changed
+    size_t bytes;
+    uint32_t blocks;
+    uint32_t retries;
+    uint32_t checksum_errors;
+    int64_t started_at;
+    int64_t io_time;   // milliseconds the ExpressLink module took for the reads
+    int64_t sink_time; // milliseconds spent in the sink
+    int64_t wait_time; // milliseconds the caller waited for a prefetched block
+
+    // prefetching, see expresslink_ota_enable_prefetch()
+    char *prefetch_buffer;
+    struct expresslink_request prefetch;
+    char prefetch_command[32];
+    int64_t prefetch_submitted;
+    struct k_sem prefetch_done;
+};
+
+void expresslink_ota_begin(struct expresslink_ota_download *d, char *buffer, size_t buffer_length, expresslink_ota_sink_cb sink, void *user_data);
+// Splits the buffer in two: the ExpressLink I/O thread reads the next block while the sink consumes the current one.
+void expresslink_ota_enable_prefetch(struct expresslink_ota_download *d);
+// Reads length bytes at offset in blocks, damaged blocks are read again up to CONFIG_EXPRESSLINK_OTA_MAX_RETRIES times.
+// Returns -ENODATA if the image ends early and -EIO if a block could not be read.
+int expresslink_ota_read(struct expresslink_ota_download *d, size_t offset, size_t length);
+uint32_t expresslink_ota_bytes_per_second(const struct expresslink_ota_download *d);
+void expresslink_ota_log_stats(const struct expresslink_ota_download *d);
+
 #endif // EXPRESSLINK_H
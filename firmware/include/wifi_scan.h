@@ -0,0 +1,45 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#ifndef WIFI_SCAN_H
+#define WIFI_SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct wifi_access_point {
+    uint8_t mac[6];
+    int8_t rss;
+};
+
+// Collects the access points of an AT+DIAG WIFI SCAN result ({"WiFiAccessPoints":[{"MacAddress":..,"Rss":..},..]})
+// while it is received in chunks, see wifi_scan.c.
+struct wifi_scan_parser {
+    struct wifi_access_point *access_points;
+    size_t max_access_points;
+    size_t count; // stored in access_points
+    size_t found; // in the scan result, the weakest ones are dropped if there are more than max_access_points
+
+    // tokenizer state
+    char token[24];
+    size_t token_length;
+    bool in_string;
+    bool escape; // the previous character of the string was a backslash
+    bool in_number;
+    bool value; // the token is the value of key
+    uint8_t key;
+    struct wifi_access_point current;
+    bool has_mac;
+    bool has_rss;
+};
+
+void wifi_scan_parser_init(struct wifi_scan_parser *p, struct wifi_access_point *access_points, size_t max_access_points);
+void wifi_scan_parser_put(struct wifi_scan_parser *p, const char *data, size_t len);
+
+// Formats an access point like the scan result, e.g. {"MacAddress":"ab:cd:ef:12:34:56","Rss":-50}
+// Returns the length, WIFI_ACCESS_POINT_JSON_LENGTH at most (without the string terminator).
+#define WIFI_ACCESS_POINT_JSON_LENGTH (sizeof("{\"MacAddress\":\"ab:cd:ef:12:34:56\",\"Rss\":-128}") - 1)
+size_t wifi_access_point_to_json(const struct wifi_access_point *ap, char *out, size_t out_length);
+
+#endif // WIFI_SCAN_H
@@ -0,0 +1,54 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+// Kept free of Zephyr APIs, so tools/hex_codec can build it on the host.
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hex.h"
+
+#define VALID (0x10)
+
+// value of every hex digit, marked with VALID; all other characters are 0
+static const uint8_t hex_digits[256] = {
+    ['0'] = VALID | 0x0, ['1'] = VALID | 0x1, ['2'] = VALID | 0x2, ['3'] = VALID | 0x3,
+    ['4'] = VALID | 0x4, ['5'] = VALID | 0x5, ['6'] = VALID | 0x6, ['7'] = VALID | 0x7,
+    ['8'] = VALID | 0x8, ['9'] = VALID | 0x9,
+    ['A'] = VALID | 0xA, ['B'] = VALID | 0xB, ['C'] = VALID | 0xC, ['D'] = VALID | 0xD, ['E'] = VALID | 0xE, ['F'] = VALID | 0xF,
+    ['a'] = VALID | 0xA, ['b'] = VALID | 0xB, ['c'] = VALID | 0xC, ['d'] = VALID | 0xD, ['e'] = VALID | 0xE, ['f'] = VALID | 0xF,
+};
+
+int hex_decode_byte(char hi, char lo) {
+    uint8_t h = hex_digits[(uint8_t)hi];
+    uint8_t l = hex_digits[(uint8_t)lo];
+    if ((h & l & VALID) == 0) {
+        return -EINVAL;
+    }
+    return (uint8_t)((h << 4) | (l & 0x0F));
+}
+
+int hex_decode(const char *hex, size_t hex_length, uint8_t *out, size_t out_length) {
+    if (hex_length % 2 != 0) {
+        return -EINVAL;
+    }
+    size_t length = hex_length / 2;
+    if (length > out_length) {
+        return -ENOBUFS;
+    }
+
+    // no branch per byte: the VALID marks of all digits are collected and checked once,
+    // the shift drops the mark of the high digit out of the byte
+    const uint8_t *p = (const uint8_t *)hex;
+    uint8_t valid = VALID;
+    for (size_t i = 0; i < length; i++) {
+        uint8_t h = hex_digits[p[i * 2]];
+        uint8_t l = hex_digits[p[i * 2 + 1]];
+        valid &= h & l;
+        // out trails the input by at least one byte, decoding in place is safe
+        out[i] = (uint8_t)((h << 4) | (l & 0x0F));
+    }
+
+    return valid ? (int)length : -EINVAL;
+}
@@ -0,0 +1,174 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+// Lossless compression of RGB565 images in the spirit of QOI (https://qoiformat.org), kept free of Zephyr APIs,
+// so tools/image_codec can build it on the host.
+//
+// Header (big endian): "Q565" width:u16 height:u16 flags:u8 reserved:u8 length:u32
+//
+// Pixels are encoded row by row with the following ops, r/g/b are the 5/6/5 bit components:
+// - 00iiiiii           INDEX: the pixel at index i of the 64 recently seen pixels, see hash()
+// - 01rrggbb           DIFF: r, g and b differ from the previous pixel by -2..1 (stored +2)
+// - 10gggggg rrrrbbbb  LUMA: g differs by -32..31 (stored +32), r and b by half of it plus -8..7 (stored +8)
+// - 11nnnnnn           RUN: the previous pixel repeated n + 1 times, n = 0..61
+// - 11111110 hi lo     RGB565: the pixel itself
+// - 11111111           invalid
+// Components wrap around, the previous pixel starts as black. The index is updated with every pixel that is
+// not encoded as RUN or INDEX. The decoder only keeps the index and the previous pixel, about 130 bytes.
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "image_codec.h"
+
+#define OP_INDEX (0x00)
+#define OP_DIFF (0x40)
+#define OP_LUMA (0x80)
+#define OP_RUN (0xC0)
+#define OP_RGB565 (0xFE)
+#define OP_INVALID (0xFF)
+#define OP_MASK (0xC0)
+
+#define MAGIC "Q565"
+
+static inline uint8_t hash(uint16_t px) {
+    return ((px >> 11) * 3 + ((px >> 5) & 0x3F) * 5 + (px & 0x1F) * 7) & 0x3F;
+}
+
+static inline uint16_t add(uint16_t px, int dr, int dg, int db) {
+    uint16_t r = ((px >> 11) + dr) & 0x1F;
+    uint16_t g = (((px >> 5) & 0x3F) + dg) & 0x3F;
+    uint16_t b = ((px & 0x1F) + db) & 0x1F;
+    return (r << 11) | (g << 5) | b;
+}
+
+int image_header_parse(const uint8_t *data, size_t len, struct image_header *header) {
+    if (len < IMAGE_HEADER_SIZE || memcmp(data, MAGIC, 4) != 0) {
+        return -ENOMSG;
+    }
+
+    header->width = (data[4] << 8) | data[5];
+    header->height = (data[6] << 8) | data[7];
+    header->flags = data[8];
+    header->length = ((uint32_t)data[10] << 24) | ((uint32_t)data[11] << 16) | ((uint32_t)data[12] << 8) | data[13];
+    if (header->width == 0 || header->height == 0 || header->length == 0) {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+void image_decoder_init(struct image_decoder *dec, uint32_t pixels, uint8_t *out, size_t out_length, image_decoder_output_cb output, void *user_data) {
+    memset(dec, 0, sizeof(*dec));
+    dec->out = out;
+    dec->out_length = out_length & ~1;
+    dec->output = output;
+    dec->user_data = user_data;
+    dec->remaining = pixels;
+}
+
+static int flush(struct image_decoder *dec) {
+    if (dec->used == 0) {
+        return 0;
+    }
+    int ret = dec->output(dec->offset, dec->out, dec->used, dec->user_data);
+    dec->offset += dec->used;
+    dec->used = 0;
+    return ret;
+}
+
+static int emit(struct image_decoder *dec, uint16_t px, uint32_t count) {
+    if (count > dec->remaining) {
+        return -EINVAL;
+    }
+    dec->remaining -= count;
+    dec->previous = px;
+
+    while (count-- > 0) {
+        dec->out[dec->used++] = px >> 8;
+        dec->out[dec->used++] = px & 0xFF;
+        if (dec->used == dec->out_length) {
+            int ret = flush(dec);
+            if (ret != 0) {
+                return ret;
+            }
+        }
+    }
+    return 0;
+}
+
+static inline uint8_t op_length(uint8_t op) {
+    if (op == OP_RGB565) {
+        return 3;
+    }
+    return (op & OP_MASK) == OP_LUMA ? 2 : 1;
+}
+
+static int decode_op(struct image_decoder *dec, const uint8_t *op) {
+    uint16_t px;
+
+    if (op[0] == OP_RGB565) {
+        px = (op[1] << 8) | op[2];
+    } else if (op[0] == OP_INVALID) {
+        return -EINVAL;
+    } else {
+        switch (op[0] & OP_MASK) {
+        case OP_INDEX:
+            return emit(dec, dec->index[op[0] & 0x3F], 1);
+        case OP_RUN:
+            return emit(dec, dec->previous, (op[0] & 0x3F) + 1);
+        case OP_DIFF:
+            px = add(dec->previous, ((op[0] >> 4) & 0x03) - 2, ((op[0] >> 2) & 0x03) - 2, (op[0] & 0x03) - 2);
+            break;
+        default: { // OP_LUMA
+            int dg = (op[0] & 0x3F) - 32;
+            int half = (dg + 32) / 2 - 16; // rounded down, also for negative differences
+            px = add(dec->previous, half + (op[1] >> 4) - 8, dg, half + (op[1] & 0x0F) - 8);
+            break;
+        }
+        }
+    }
+
+    dec->index[hash(px)] = px;
+    return emit(dec, px, 1);
+}
+
+int image_decoder_write(struct image_decoder *dec, const uint8_t *data, size_t len) {
+    size_t i = 0;
+
+    // an op split across chunks
+    while (dec->op_length > 0 && i < len) {
+        dec->op[dec->op_length++] = data[i++];
+        if (dec->op_length == op_length(dec->op[0])) {
+            dec->op_length = 0;
+            int ret = decode_op(dec, dec->op);
+            if (ret != 0) {
+                return ret;
+            }
+        }
+    }
+
+    while (i < len) {
+        uint8_t n = op_length(data[i]);
+        if (i + n > len) {
+            memcpy(dec->op, &data[i], len - i);
+            dec->op_length = len - i;
+            return 0;
+        }
+        int ret = decode_op(dec, &data[i]);
+        if (ret != 0) {
+            return ret;
+        }
+        i += n;
+    }
+    return 0;
+}
+
+int image_decoder_finish(struct image_decoder *dec) {
+    int ret = flush(dec);
+    if (ret != 0) {
+        return ret;
+    }
+    return dec->remaining > 0 || dec->op_length > 0 ? -ENODATA : 0;
+}
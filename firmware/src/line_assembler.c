@@ -0,0 +1,48 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+// Kept free of Zephyr APIs, so tools/line_assembler can build it on the host.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "line_assembler.h"
+
+void line_assembler_init(struct line_assembler *a, char *buffer, size_t size) {
+    a->buffer = buffer;
+    a->size = size;
+    a->length = 0;
+    a->dropped = 0;
+    a->complete = false;
+}
+
+size_t line_assembler_put(struct line_assembler *a, const uint8_t *data, size_t len) {
+    if (a->complete) {
+        return 0;
+    }
+
+    // the line ending itself is not stored
+    const uint8_t *eol = memchr(data, '\n', len);
+    size_t line_length = (eol != NULL) ? (size_t)(eol - data) : len;
+    // the rest of a line longer than the buffer is dropped, its line ending is still found
+    size_t copy_length = line_length;
+    if (copy_length > a->size - 1 - a->length) {
+        copy_length = a->size - 1 - a->length;
+    }
+    memcpy(a->buffer + a->length, data, copy_length);
+    a->length += copy_length;
+    a->dropped += line_length - copy_length;
+    a->complete = (eol != NULL);
+    return (eol != NULL) ? line_length + 1 : len;
+}
+
+char *line_assembler_finish(struct line_assembler *a) {
+    size_t length = a->length;
+    // a carriage return that was dropped with the rest of a long line cannot be stripped
+    if (a->complete && a->dropped == 0 && length > 0 && a->buffer[length - 1] == '\r') {
+        length--;
+    }
+    a->buffer[length] = 0;
+    return a->buffer;
+}
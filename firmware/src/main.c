@@ -24,8 +24,10 @@ int main(void) {
     init_retcode.sht31 = init_sht31();
     init_retcode.lsm6dsl = init_lsm6dsl();
     init_retcode.expresslink = init_expresslink();
+    init_retcode.mqtt_publish = init_mqtt_publish();
     init_retcode.display = init_display();
     init_retcode.usb_mass_storage = init_usb_mass_storage();
+    init_retcode.mqtt_journal = init_mqtt_journal();
 
     k_msleep(1000);
     restore_active_workshop_module();
@@ -0,0 +1,591 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/random/rand32.h>
+#include <zephyr/shell/shell.h>
+LOG_MODULE_REGISTER(mqtt_connection);
+
+#include "badge.h"
+
+// The connection to AWS IoT Core is owned by this service instead of the workshop modules, so it stays up
+// while switching between modules. A module only declares its topics and subscriptions in a profile,
+// which is applied on top of the existing connection. The module is only reset if that fails.
+//
+// Failed connection attempts are retried with exponential backoff and jitter from the system work queue,
+// so neither the module thread nor the event thread is blocked, and many badges in the same room do not
+// retry in lockstep after the access point went down.
+
+// draining messages of the previous module, so the next module does not receive them with AT+GET
+#define MAX_DRAINED_MESSAGES (16)
+
+#define MAX_STATE_SUBSCRIPTIONS (4)
+
+// Duty cycling: a module publishing every few seconds or minutes lets the connection sleep in between.
+// The ExpressLink module is disconnected and put to sleep with AT+SLEEP, and woken via the WAKE pin by
+// wake_work ahead of the next publish, by the average time to connect plus a margin.
+
+// retry later if the connection mutex is held by a module thread waiting for the modem
+#define CONNECT_WORK_RETRY_DELAY K_MSEC(100)
+
+// assumed time to connect after waking up, until the first connection was measured
+#define DEFAULT_TIME_TO_CONNECT (5000) // milliseconds
+
+struct state_subscription {
+    mqtt_connection_state_cb callback;
+    void *user_data;
+};
+
+static enum mqtt_connection_state state = MQTT_DISCONNECTED;
+static const struct mqtt_profile *active_profile = NULL;
+static int last_hint = 0;
+static uint32_t backoff = CONFIG_MQTT_RECONNECT_BACKOFF_MIN; // milliseconds
+
+static struct state_subscription state_subscriptions[MAX_STATE_SUBSCRIPTIONS];
+static size_t state_subscription_count = 0;
+
+// counters, see `expresslink connection`
+static uint32_t connect_attempts = 0;
+static uint32_t connect_failures = 0;
+static uint32_t connections = 0;
+static uint32_t connections_lost = 0;
+static uint32_t overruns = 0; // OVERRUN events of the module
+static uint32_t overrun_messages = 0; // messages fetched or drained after an OVERRUN event
+static uint32_t sleeps = 0;
+static uint32_t late_wakeups = 0; // not connected again at the deadline
+static int64_t sleep_deadline = -1;
+static int64_t connecting_since = -1;     // first attempt of the current connection, -1 while connected or idle
+static uint32_t last_time_to_connect = 0; // milliseconds
+static uint64_t total_time_to_connect = 0;
+static int64_t connected_since = 0;
+static uint64_t total_time_connected = 0;
+
+// serializes the event handlers against acquire/release from the module thread
+K_MUTEX_DEFINE(connection_mutex);
+
+static void connect_work_handler(struct k_work *work);
+K_WORK_DELAYABLE_DEFINE(connect_work, connect_work_handler);
+
+static void wake_work_handler(struct k_work *work);
+K_WORK_DELAYABLE_DEFINE(wake_work, wake_work_handler);
+
+// set from the ExpressLink I/O thread if AT+CONNECT! was rejected
+static atomic_t connect_rejected = ATOMIC_INIT(0);
+
+static void connect_request_done(struct expresslink_request *request);
+static struct expresslink_request connect_request = {
+    .command = "AT+CONNECT!\n",
+    .callback = connect_request_done,
+};
+
+// see the ExpressLink Programmer's Guide, "Connection Hints"
+static const char *const connection_hints[] = {
+    "connected",
+    "internal failure",
+    "access point not found",
+    "access point authentication failed",
+    "failed to obtain an IP address",
+    "failed to resolve the endpoint",
+    "failed to reach the endpoint",
+    "endpoint authentication failed",
+    "device authentication failed",
+    "connection rejected by AWS IoT Core",
+};
+
+const char *mqtt_connection_hint_str(int hint) {
+    if (hint < 0 || hint >= ARRAY_SIZE(connection_hints)) {
+        return "unknown";
+    }
+    return connection_hints[hint];
+}
+
+const char *mqtt_connection_state_str(enum mqtt_connection_state s) {
+    switch (s) {
+    case MQTT_DISCONNECTED:
+        return "disconnected";
+    case MQTT_CONNECTING:
+        return "connecting";
+    case MQTT_BACKOFF:
+        return "waiting to reconnect";
+    case MQTT_CONNECTED:
+        return "connected";
+    case MQTT_SLEEPING:
+        return "sleeping";
+    }
+    return "unknown";
+}
+
+static void set_state(enum mqtt_connection_state new_state, int hint) {
+    last_hint = hint;
+    if (new_state == state) {
+        return;
+    }
+
+    int64_t now = k_uptime_get();
+    if (state == MQTT_CONNECTED) {
+        total_time_connected += now - connected_since;
+    }
+    if (new_state == MQTT_CONNECTED) {
+        connected_since = now;
+        connections++;
+        if (sleep_deadline >= 0 && now > sleep_deadline) {
+            late_wakeups++;
+        }
+        sleep_deadline = -1;
+        if (connecting_since >= 0) {
+            last_time_to_connect = (uint32_t)(now - connecting_since);
+            total_time_to_connect += last_time_to_connect;
+            connecting_since = -1;
+        }
+    } else if (new_state == MQTT_CONNECTING && connecting_since < 0) {
+        connecting_since = now;
+    } else if (new_state == MQTT_DISCONNECTED && state != MQTT_CONNECTED) {
+        // nobody is waiting for the connection anymore
+        connecting_since = -1;
+    }
+
+    LOG_INF("%s -> %s", mqtt_connection_state_str(state), mqtt_connection_state_str(new_state));
+    state = new_state;
+
+    for (size_t i = 0; i < state_subscription_count; i++) {
+        state_subscriptions[i].callback(new_state, hint, state_subscriptions[i].user_data);
+    }
+}
+
+static void start_connecting(void) {
+    k_work_reschedule(&connect_work, K_NO_WAIT);
+}
+
+// waits a random time between half and all of the current backoff ("equal jitter"), then doubles it
+static void schedule_reconnect(int hint) {
+    if (active_profile == NULL) {
+        set_state(MQTT_DISCONNECTED, hint);
+        return;
+    }
+
+    uint32_t delay = backoff / 2 + sys_rand32_get() % (backoff / 2 + 1);
+    backoff = MIN(backoff * 2, CONFIG_MQTT_RECONNECT_BACKOFF_MAX);
+
+    LOG_INF("Reconnecting in %u ms ...", delay);
+    set_state(MQTT_BACKOFF, hint);
+    k_work_reschedule(&connect_work, K_MSEC(delay));
+}
+
+static void connect_work_handler(struct k_work *work) {
+    if (k_mutex_lock(&connection_mutex, K_NO_WAIT) != 0) {
+        k_work_reschedule(&connect_work, CONNECT_WORK_RETRY_DELAY);
+        return;
+    }
+
+    if (atomic_cas(&connect_rejected, 1, 0)) {
+        if (state == MQTT_CONNECTING) {
+            LOG_WRN("AT+CONNECT! failed!");
+            connect_failures++;
+            schedule_reconnect(0);
+        }
+        k_mutex_unlock(&connection_mutex);
+        return;
+    }
+
+    if (active_profile == NULL || state == MQTT_CONNECTING || state == MQTT_CONNECTED) {
+        k_mutex_unlock(&connection_mutex);
+        return;
+    }
+
+    connect_attempts++;
+    set_state(MQTT_CONNECTING, last_hint);
+    // the result arrives as CONNECT event, only a rejected command is handled by connect_request_done()
+    if (expresslink_submit(&connect_request) != 0) {
+        connect_failures++;
+        schedule_reconnect(0);
+    }
+    k_mutex_unlock(&connection_mutex);
+}
+
+// called from the ExpressLink I/O thread, which must not wait for the connection mutex
+static void connect_request_done(struct expresslink_request *request) {
+    if (!request->success) {
+        atomic_set(&connect_rejected, 1);
+        k_work_reschedule(&connect_work, K_NO_WAIT);
+    }
+}
+
+static void wake_up(void) {
+    k_work_cancel_delayable(&wake_work);
+    expresslink_wake();
+    set_state(MQTT_DISCONNECTED, last_hint);
+}
+
+static void wake_work_handler(struct k_work *work) {
+    if (k_mutex_lock(&connection_mutex, K_NO_WAIT) != 0) {
+        k_work_reschedule(&wake_work, CONNECT_WORK_RETRY_DELAY);
+        return;
+    }
+
+    if (state == MQTT_SLEEPING) {
+        LOG_INF("Waking up %lld ms ahead of the next publish.", sleep_deadline - k_uptime_get());
+        wake_up();
+        start_connecting();
+    }
+    k_mutex_unlock(&connection_mutex);
+}
+
+// returns false if the module is in an unexpected state and has to be reset
+static bool apply_profile(const struct mqtt_profile *profile) {
+    char cmd[192];
+    bool success = true;
+
+    snprintf(cmd, sizeof(cmd), "AT+CONF QoS=%u\n", profile->qos);
+    success &= expresslink_send_command(cmd, NULL, 0);
+
+    if (profile->shadow) {
+        // unchanged configuration is not sent again, see expresslink_config.c
+        success &= expresslink_send_command("AT+CONF EnableShadow=1\n", NULL, 0);
+    }
+
+    for (size_t i = 0; i < profile->topic_count; i++) {
+        const struct mqtt_topic *t = &profile->topics[i];
+        snprintf(cmd, sizeof(cmd), "AT+CONF Topic%u=%s\n", t->index, t->topic);
+        success &= expresslink_send_command(cmd, NULL, 0);
+        if (t->subscribe) {
+            snprintf(cmd, sizeof(cmd), "AT+SUBSCRIBE%u\n", t->index);
+            success &= expresslink_send_command(cmd, NULL, 0);
+        }
+    }
+    return success;
+}
+
+static size_t drain_messages(void) {
+    char response[16];
+    size_t drained = 0;
+    for (; drained < MAX_DRAINED_MESSAGES; drained++) {
+        // "OK" without a topic means there are no more messages, the message lines are discarded by the driver
+        if (!expresslink_send_command("AT+GET\n", response, sizeof(response)) || response[0] == 0) {
+            break;
+        }
+    }
+    return drained;
+}
+
+static bool remove_profile(const struct mqtt_profile *profile) {
+    char cmd[32];
+    bool success = true;
+    bool subscribed = false;
+
+    for (size_t i = 0; i < profile->topic_count; i++) {
+        const struct mqtt_topic *t = &profile->topics[i];
+        if (t->subscribe) {
+            snprintf(cmd, sizeof(cmd), "AT+UNSUBSCRIBE%u\n", t->index);
+            success &= expresslink_send_command(cmd, NULL, 0);
+            subscribed = true;
+        }
+    }
+    if (profile->shadow) {
+        success &= expresslink_send_command("AT+SHADOW UNSUBSCRIBE\n", NULL, 0);
+    }
+
+    if (subscribed) {
+        drain_messages();
+    }
+    return success;
+}
+
+static void reset_connection(void) {
+    LOG_WRN("Unexpected ExpressLink state, resetting module...");
+    k_work_cancel_delayable(&connect_work);
+    set_state(MQTT_DISCONNECTED, 0);
+    // the STARTUP event triggers a new connection attempt
+    expresslink_reset();
+}
+
+// the state only changes to connected once the topics are configured, so queued messages are not sent too early
+static void enter_connected_state(void) {
+    const struct mqtt_profile *profile = active_profile;
+    if (profile != NULL && !apply_profile(profile)) {
+        reset_connection();
+        return;
+    }
+
+    set_state(MQTT_CONNECTED, 0);
+    if (profile != NULL && profile->connected != NULL) {
+        profile->connected(profile->user_data);
+    }
+}
+
+static void handle_startup(const struct expresslink_event *event, void *user_data) {
+    k_mutex_lock(&connection_mutex, K_FOREVER);
+    set_state(MQTT_DISCONNECTED, 0);
+    if (active_profile != NULL) {
+        start_connecting();
+    }
+    k_mutex_unlock(&connection_mutex);
+}
+
+static void handle_conlost(const struct expresslink_event *event, void *user_data) {
+    k_mutex_lock(&connection_mutex, K_FOREVER);
+    if (state == MQTT_SLEEPING) {
+        // disconnected on purpose, see mqtt_connection_sleep_until()
+        k_mutex_unlock(&connection_mutex);
+        return;
+    }
+    LOG_INF("CONLOST EVENT received: %s (%d)", mqtt_connection_hint_str(event->parameter), event->parameter);
+    if (state == MQTT_CONNECTED) {
+        connections_lost++;
+    }
+    if (active_profile != NULL && active_profile->disconnected != NULL) {
+        active_profile->disconnected(active_profile->user_data);
+    }
+    // all badges in the room lose the connection at the same time if the access point goes down,
+    // so even the first reconnect is delayed by a random time
+    schedule_reconnect(event->parameter);
+    k_mutex_unlock(&connection_mutex);
+}
+
+// The receive buffer of the module overflowed: messages were lost, and the MSG events of the messages still
+// buffered might be lost as well. The backlog is fetched by the module (or drained), so messages flow again.
+static void handle_overrun(const struct expresslink_event *event, void *user_data) {
+    k_mutex_lock(&connection_mutex, K_FOREVER);
+    LOG_WRN("OVERRUN EVENT received, messages were lost.");
+    overruns++;
+    const struct mqtt_profile *profile = active_profile;
+    if (profile != NULL && profile->overrun != NULL) {
+        overrun_messages += profile->overrun(profile->user_data);
+    } else if (profile != NULL) {
+        overrun_messages += drain_messages();
+    }
+    k_mutex_unlock(&connection_mutex);
+}
+
+static void handle_connect(const struct expresslink_event *event, void *user_data) {
+    k_mutex_lock(&connection_mutex, K_FOREVER);
+    if (event->parameter == 0) {
+        LOG_INF("Successfully connected to AWS IoT Core!");
+        backoff = CONFIG_MQTT_RECONNECT_BACKOFF_MIN;
+        enter_connected_state();
+    } else {
+        LOG_WRN("Connection attempt failed: %s (%d)", mqtt_connection_hint_str(event->parameter), event->parameter);
+        connect_failures++;
+        schedule_reconnect(event->parameter);
+    }
+    k_mutex_unlock(&connection_mutex);
+}
+
+// the module could have been reset in the meantime, e.g., by the self test or the Sidewalk module
+static bool verify_connection(void) {
+    char response[32];
+    if (!expresslink_send_command("AT+CONNECT?\n", response, sizeof(response))) {
+        return false;
+    }
+    return response[0] == '1';
+}
+
+static void subscribe_events(void) {
+    expresslink_event_subscribe(EL_EVENT_STARTUP, handle_startup, NULL);
+    expresslink_event_subscribe(EL_EVENT_CONLOST, handle_conlost, NULL);
+    expresslink_event_subscribe(EL_EVENT_CONNECT, handle_connect, NULL);
+    expresslink_event_subscribe(EL_EVENT_PUBACK, mqtt_publish_handle_puback, NULL);
+    expresslink_event_subscribe(EL_EVENT_OVERRUN, handle_overrun, NULL);
+}
+
+static void unsubscribe_events(void) {
+    expresslink_event_unsubscribe(handle_startup);
+    expresslink_event_unsubscribe(handle_conlost);
+    expresslink_event_unsubscribe(handle_connect);
+    expresslink_event_unsubscribe(mqtt_publish_handle_puback);
+    expresslink_event_unsubscribe(handle_overrun);
+}
+
+int mqtt_connection_acquire(const struct mqtt_profile *profile) {
+    if (active_profile != NULL && active_profile != profile) {
+        LOG_WRN("Connection still used by %s, releasing it.", active_profile->name);
+        mqtt_connection_release(active_profile);
+    }
+
+    // events which arrived while no module was using the connection are dispatched from now on,
+    // the event handlers take the connection mutex, so this must not be called while holding it
+    subscribe_events();
+
+    k_mutex_lock(&connection_mutex, K_FOREVER);
+    active_profile = profile;
+
+    if (state == MQTT_CONNECTED && !verify_connection()) {
+        set_state(MQTT_DISCONNECTED, 0);
+    }
+
+    int64_t start = k_uptime_get();
+    switch (state) {
+    case MQTT_CONNECTED:
+        LOG_INF("Reusing connection for %s.", profile->name);
+        enter_connected_state();
+        LOG_INF("%s ready after %lld ms.", profile->name, k_uptime_get() - start);
+        break;
+    case MQTT_SLEEPING:
+        wake_up();
+        sleep_deadline = -1;
+        start_connecting();
+        break;
+    case MQTT_DISCONNECTED:
+        start_connecting();
+        break;
+    case MQTT_CONNECTING:
+    case MQTT_BACKOFF:
+        // the profile is applied by the CONNECT event handler
+        break;
+    }
+    k_mutex_unlock(&connection_mutex);
+    return 0;
+}
+
+void mqtt_connection_release(const struct mqtt_profile *profile) {
+    if (active_profile != profile) {
+        return;
+    }
+
+    // without subscribers the events stay pending until the next module acquires the connection
+    unsubscribe_events();
+
+    k_mutex_lock(&connection_mutex, K_FOREVER);
+    active_profile = NULL;
+
+    // the connection itself is kept for the next module, but pending retries are not needed anymore
+    if (state == MQTT_BACKOFF) {
+        k_work_cancel_delayable(&connect_work);
+        set_state(MQTT_DISCONNECTED, last_hint);
+    } else if (state == MQTT_SLEEPING) {
+        // the next module might not use the connection at all, but the module has to answer commands
+        wake_up();
+        sleep_deadline = -1;
+    } else if (state == MQTT_CONNECTED && !remove_profile(profile)) {
+        reset_connection();
+    }
+    k_mutex_unlock(&connection_mutex);
+}
+
+int mqtt_connection_sleep_until(int64_t deadline) {
+    // QoS1 messages are only done once acknowledged
+    if (mqtt_queue_depth() > 0 || mqtt_publish_inflight() > 0 || mqtt_journal_backlog()) {
+        return -EBUSY;
+    }
+
+    k_mutex_lock(&connection_mutex, K_FOREVER);
+    if (active_profile == NULL || state == MQTT_SLEEPING) {
+        k_mutex_unlock(&connection_mutex);
+        return -EINVAL;
+    }
+    if (state == MQTT_CONNECTING) {
+        k_mutex_unlock(&connection_mutex);
+        return -EBUSY;
+    }
+
+    uint32_t time_to_connect = connections > 0 ? (uint32_t)(total_time_to_connect / connections) : DEFAULT_TIME_TO_CONNECT;
+    int64_t wake_at = deadline - time_to_connect - CONFIG_MQTT_SLEEP_WAKE_MARGIN;
+    int64_t duration = wake_at - k_uptime_get();
+    if (duration < CONFIG_MQTT_SLEEP_MIN_DURATION) {
+        k_mutex_unlock(&connection_mutex);
+        return -EAGAIN;
+    }
+
+    k_work_cancel_delayable(&connect_work);
+    if (state == MQTT_CONNECTED) {
+        expresslink_send_command("AT+DISCONNECT\n", NULL, 0);
+        if (active_profile->disconnected != NULL) {
+            active_profile->disconnected(active_profile->user_data);
+        }
+    }
+
+    // the module wakes up by itself a little later, in case the WAKE pin is not pulsed for some reason
+    uint32_t timer = (uint32_t)(duration / 1000) + 2;
+    if (!expresslink_sleep(CONFIG_MQTT_SLEEP_MODE, timer)) {
+        LOG_WRN("AT+SLEEP failed, staying awake.");
+        set_state(MQTT_DISCONNECTED, last_hint);
+        start_connecting();
+        k_mutex_unlock(&connection_mutex);
+        return -EIO;
+    }
+
+    LOG_INF("Sleeping for %lld ms.", duration);
+    sleeps++;
+    sleep_deadline = deadline;
+    set_state(MQTT_SLEEPING, last_hint);
+    k_work_reschedule(&wake_work, K_MSEC(duration));
+    k_mutex_unlock(&connection_mutex);
+    return 0;
+}
+
+bool mqtt_connection_is_connected(void) {
+    return state == MQTT_CONNECTED;
+}
+
+enum mqtt_connection_state mqtt_connection_get_state(void) {
+    return state;
+}
+
+int mqtt_connection_state_subscribe(mqtt_connection_state_cb callback, void *user_data) {
+    k_mutex_lock(&connection_mutex, K_FOREVER);
+    if (state_subscription_count == MAX_STATE_SUBSCRIPTIONS) {
+        k_mutex_unlock(&connection_mutex);
+        LOG_ERR("too many connection state subscriptions!");
+        return -ENOMEM;
+    }
+    state_subscriptions[state_subscription_count].callback = callback;
+    state_subscriptions[state_subscription_count].user_data = user_data;
+    state_subscription_count++;
+
+    // let the subscriber know the current state
+    callback(state, last_hint, user_data);
+    k_mutex_unlock(&connection_mutex);
+    return 0;
+}
+
+void mqtt_connection_state_unsubscribe(mqtt_connection_state_cb callback) {
+    k_mutex_lock(&connection_mutex, K_FOREVER);
+    size_t i = 0;
+    while (i < state_subscription_count) {
+        if (state_subscriptions[i].callback == callback) {
+            state_subscription_count--;
+            state_subscriptions[i] = state_subscriptions[state_subscription_count];
+        } else {
+            i++;
+        }
+    }
+    k_mutex_unlock(&connection_mutex);
+}
+
+void mqtt_connection_print_status(const struct shell *sh) {
+    k_mutex_lock(&connection_mutex, K_FOREVER);
+    int64_t now = k_uptime_get();
+    uint64_t time_connected = total_time_connected + (state == MQTT_CONNECTED ? now - connected_since : 0);
+
+    shell_print(sh, "state: %s (used by %s)", mqtt_connection_state_str(state), active_profile != NULL ? active_profile->name : "none");
+    shell_print(sh, "last connection hint: %s (%d)", mqtt_connection_hint_str(last_hint), last_hint);
+    shell_print(sh, "connect attempts: %u, failed: %u, connections: %u, lost: %u", connect_attempts, connect_failures, connections, connections_lost);
+    shell_print(sh, "time to connect: last %u ms, average %u ms",
+                last_time_to_connect,
+                connections > 0 ? (uint32_t)(total_time_to_connect / connections) : 0);
+    shell_print(sh, "time connected: %u s, next backoff: %u ms", (uint32_t)(time_connected / 1000), backoff);
+    shell_print(sh, "module receive overruns: %u, messages fetched afterwards: %u", overruns, overrun_messages);
+    shell_print(sh, "sleep cycles: %u, connected too late for the next publish: %u", sleeps, late_wakeups);
+    k_mutex_unlock(&connection_mutex);
+}
+
+void mqtt_connection_reset_stats(void) {
+    k_mutex_lock(&connection_mutex, K_FOREVER);
+    connect_attempts = 0;
+    connect_failures = 0;
+    connections = 0;
+    connections_lost = 0;
+    overruns = 0;
+    overrun_messages = 0;
+    sleeps = 0;
+    late_wakeups = 0;
+    last_time_to_connect = 0;
+    total_time_to_connect = 0;
+    total_time_connected = 0;
+    connected_since = k_uptime_get();
+    k_mutex_unlock(&connection_mutex);
+}
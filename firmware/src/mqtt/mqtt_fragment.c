@@ -0,0 +1,202 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/random/rand32.h>
+#include <zephyr/sys/base64.h>
+LOG_MODULE_REGISTER(mqtt_fragment);
+
+#include "badge.h"
+
+// Messages larger than a slot of the in-flight window are split into fragments, each sent as a separate
+// message to MQTT_FRAGMENT_TOPIC and reassembled by the FragmentReassemblyLambda, which then publishes the
+// original message to its target topic. Fragments are streamed: only the fragment being filled is buffered.
+//
+// Fragment: "F1 <message id> <sequence> <encoding><more> [<target topic>] <data>"
+// - message id: 4 hex digits, unique per device for the lifetime of a message
+// - sequence: 0, 1, 2, ...
+// - encoding: 't' for text (must not contain line endings), 'b' for base64 encoded binary data
+// - more: 'm' if more fragments follow, 'l' for the last fragment
+// - target topic: only in fragment 0
+// Every fragment of a binary message contains complete base64 groups, so fragments are decoded one by one.
+
+#define FRAGMENT_HEADER_MAX_LENGTH (sizeof("F1 ffff 65535 tm ") - 1)
+#define FRAGMENT_TIMEOUT K_SECONDS(10) // waiting for a free slot of the in-flight window
+
+static atomic_t next_message_id = ATOMIC_INIT(0);
+
+static size_t header_reserve(const struct mqtt_fragment_writer *w) {
+    return FRAGMENT_HEADER_MAX_LENGTH + (w->sequence == 0 ? strlen(w->target) + 1 : 0);
+}
+
+static size_t data_capacity(const struct mqtt_fragment_writer *w) {
+    size_t capacity = sizeof(w->buffer) - header_reserve(w);
+    // binary fragments contain complete base64 groups
+    return w->binary ? capacity / 4 * 4 : capacity;
+}
+
+static char *data_start(struct mqtt_fragment_writer *w) {
+    return w->buffer + header_reserve(w);
+}
+
+// the header is written right in front of the data, so the fragment is passed to mqtt_publish() in place
+static int send_fragment(struct mqtt_fragment_writer *w, bool last) {
+    char header[FRAGMENT_HEADER_MAX_LENGTH + 1];
+    int header_length = snprintf(header,
+                                 sizeof(header),
+                                 "F1 %04x %u %c%c ",
+                                 w->message_id,
+                                 w->sequence,
+                                 w->binary ? 'b' : 't',
+                                 last ? 'l' : 'm');
+
+    char *start = data_start(w);
+    if (w->sequence == 0) {
+        size_t target_length = strlen(w->target);
+        start -= target_length + 1;
+        memcpy(start, w->target, target_length);
+        start[target_length] = ' ';
+    }
+    start -= header_length;
+    memcpy(start, header, header_length);
+
+    size_t length = data_start(w) + w->used - start;
+    int ret = mqtt_publish(w->topic_index, start, length, w->qos, FRAGMENT_TIMEOUT);
+    if (ret != 0) {
+        LOG_WRN("Fragment %u of message %04x not sent: %d", w->sequence, w->message_id, ret);
+        w->error = ret;
+        return ret;
+    }
+
+    w->sequence++;
+    w->used = 0;
+    w->fragments_sent++;
+    return 0;
+}
+
+int mqtt_fragment_begin(struct mqtt_fragment_writer *w, uint8_t topic_index, uint8_t qos, const char *target, bool binary) {
+    if (strlen(target) + 1 + FRAGMENT_HEADER_MAX_LENGTH + 4 > sizeof(w->buffer) || strchr(target, ' ') != NULL) {
+        return -EINVAL;
+    }
+
+    if (atomic_get(&next_message_id) == 0) {
+        // avoids reusing the message ids of the previous boot while their fragments are still stored
+        atomic_cas(&next_message_id, 0, sys_rand32_get() | 1);
+    }
+
+    w->topic_index = topic_index;
+    w->qos = qos;
+    w->target = target;
+    w->binary = binary;
+    w->message_id = (uint16_t)atomic_inc(&next_message_id);
+    w->sequence = 0;
+    w->used = 0;
+    w->pending_length = 0;
+    w->fragments_sent = 0;
+    w->error = 0;
+    return 0;
+}
+
+static int append(struct mqtt_fragment_writer *w, const char *data, size_t length) {
+    while (length > 0) {
+        size_t capacity = data_capacity(w);
+        if (w->used == capacity) {
+            // only sent once more data follows, the last fragment is flagged as such
+            int ret = send_fragment(w, false);
+            if (ret != 0) {
+                return ret;
+            }
+            continue;
+        }
+        size_t n = MIN(length, capacity - w->used);
+        memcpy(data_start(w) + w->used, data, n);
+        w->used += n;
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static int append_base64(struct mqtt_fragment_writer *w, const uint8_t *data, size_t length, bool final) {
+    uint8_t group[48]; // multiple of 3 bytes
+    char encoded[sizeof(group) / 3 * 4 + 1];
+
+    while (length > 0 || (final && w->pending_length > 0)) {
+        size_t n = w->pending_length;
+        memcpy(group, w->pending, n);
+        size_t take = MIN(length, sizeof(group) - n);
+        memcpy(group + n, data, take);
+        n += take;
+        data += take;
+        length -= take;
+
+        // keep an incomplete group for the next write, unless this is the end of the message
+        size_t complete = final && length == 0 ? n : n / 3 * 3;
+        w->pending_length = n - complete;
+        memcpy(w->pending, group + complete, w->pending_length);
+
+        size_t encoded_length = 0;
+        if (complete > 0) {
+            base64_encode((uint8_t *)encoded, sizeof(encoded), &encoded_length, group, complete);
+        }
+        int ret = append(w, encoded, encoded_length);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+int mqtt_fragment_write(struct mqtt_fragment_writer *w, const void *data, size_t length) {
+    if (w->error != 0) {
+        return w->error;
+    }
+    if (w->binary) {
+        return append_base64(w, data, length, false);
+    }
+    if (memchr(data, '\n', length) != NULL || memchr(data, '\r', length) != NULL) {
+        return -EINVAL;
+    }
+    return append(w, data, length);
+}
+
+int mqtt_fragment_end(struct mqtt_fragment_writer *w) {
+    if (w->error != 0) {
+        return w->error;
+    }
+    if (w->binary) {
+        int ret = append_base64(w, NULL, 0, true);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+    int ret = send_fragment(w, true);
+    if (ret == 0) {
+        LOG_DBG("Message %04x sent in %u fragments.", w->message_id, w->fragments_sent);
+    }
+    return ret;
+}
+
+// the writer is as large as a window slot, so it is shared instead of taken from the heap or the stack
+static struct mqtt_fragment_writer shared_writer;
+K_MUTEX_DEFINE(shared_writer_mutex);
+
+int mqtt_publish_fragmented(uint8_t topic_index, uint8_t qos, const char *target, const void *payload, size_t payload_length, bool binary) {
+    k_mutex_lock(&shared_writer_mutex, K_FOREVER);
+
+    int ret = mqtt_fragment_begin(&shared_writer, topic_index, qos, target, binary);
+    if (ret == 0) {
+        ret = mqtt_fragment_write(&shared_writer, payload, payload_length);
+    }
+    if (ret == 0) {
+        ret = mqtt_fragment_end(&shared_writer);
+    }
+
+    k_mutex_unlock(&shared_writer_mutex);
+    return ret;
+}
@@ -0,0 +1,450 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <zephyr/fs/fs.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/random/rand32.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/timeutil.h>
+LOG_MODULE_REGISTER(mqtt_journal);
+
+#include "badge.h"
+
+// Telemetry produced while not connected is appended to a journal on the USB mass storage volume (QSPI NOR)
+// and replayed in rate-limited batches once the connection is back.
+//
+// The journal is a sequence of segment files, journal/00000001.log, journal/00000002.log, ..., which are only
+// ever appended to. Each record is a single line with a CRC, so a record torn by a reset is skipped on replay.
+// A segment is deleted once it has been replayed completely. If the journal is full, the oldest segment is
+// deleted. A reset during replay sends the records of the current segment again (at-least-once delivery).
+//
+// Record: "<crc16> <topic index> <qos> <epoch ms> <uptime ms> <boot id> <topic> <payload>\n"
+
+#define JOURNAL_DIR USB_PATH("journal")
+#define SEGMENT_PATH_FMT USB_PATH("journal/%08u.log")
+#define MAX_PATH_LENGTH (32)
+#define MAX_RECORD_LENGTH (CONFIG_MQTT_PUBLISH_MAX_PAYLOAD + 160)
+
+#define mqtt_journal_TASK_PRIORITY 11 // below the workshop modules, replay is background work
+K_THREAD_STACK_DEFINE(mqtt_journal_task_stack, 2048);
+static struct k_work_q journal_work_q;
+
+static void replay_work_handler(struct k_work *work);
+K_WORK_DELAYABLE_DEFINE(replay_work, replay_work_handler);
+
+// held while accessing the segment files, by producers and by the replay
+K_MUTEX_DEFINE(journal_mutex);
+
+static bool journal_available = false;
+static uint32_t first_segment = 0; // 0 = journal empty
+static uint32_t last_segment = 0;
+static size_t last_segment_size = 0;
+static off_t replay_offset = 0; // within the first segment
+static uint32_t boot_id = 0;
+
+// wall clock from AT+TIME?, records keep the time they were produced
+static int64_t clock_epoch = 0; // milliseconds, 0 = not synchronized
+static int64_t clock_uptime = 0;
+
+static char record[MAX_RECORD_LENGTH + 8];
+static char replay_payload[CONFIG_MQTT_PUBLISH_MAX_PAYLOAD];
+static char replay_topic[128]; // configured at CONFIG_MQTT_JOURNAL_REPLAY_TOPIC_INDEX, empty = unknown
+
+// counters, see `expresslink journal`
+static uint32_t records_journaled = 0;
+static uint32_t bytes_journaled = 0;
+static uint32_t records_replayed = 0;
+static uint32_t bytes_replayed = 0;
+static uint32_t records_corrupt = 0;
+static uint32_t records_skipped = 0; // their topic could not be configured
+static uint32_t segments_dropped = 0;
+static int64_t replay_started = -1;
+static uint32_t replay_throughput = 0; // bytes per second of the last replay
+
+static void segment_path(char *path, uint32_t segment) {
+    snprintf(path, MAX_PATH_LENGTH, SEGMENT_PATH_FMT, segment);
+}
+
+static int64_t now_epoch(void) {
+    if (clock_epoch == 0) {
+        return 0;
+    }
+    return clock_epoch + (k_uptime_get() - clock_uptime);
+}
+
+static bool backlog(void) {
+    return first_segment != 0;
+}
+
+static void delete_first_segment(void) {
+    char path[MAX_PATH_LENGTH];
+    segment_path(path, first_segment);
+    int ret = fs_unlink(path);
+    if (ret != 0 && ret != -ENOENT) {
+        LOG_WRN("fs_unlink %s failed: %d", path, ret);
+    }
+
+    replay_offset = 0;
+    if (first_segment == last_segment) {
+        first_segment = 0;
+        last_segment = 0;
+        last_segment_size = 0;
+    } else {
+        first_segment++;
+    }
+}
+
+static int append_record(const struct mqtt_topic *topic, uint8_t qos, const char *payload, size_t payload_length) {
+    char *body = record + 5; // room for the CRC
+    int body_length = snprintf(body,
+                               MAX_RECORD_LENGTH - 5,
+                               "%u %u %lld %lld %08x %s %.*s",
+                               topic->index,
+                               qos,
+                               now_epoch(),
+                               k_uptime_get(),
+                               boot_id,
+                               topic->topic,
+                               (int)payload_length,
+                               payload);
+    if (body_length >= MAX_RECORD_LENGTH - 5) {
+        return -EMSGSIZE;
+    }
+    snprintf(record, 6, "%04x", crc16_ccitt(0, body, body_length));
+    record[4] = ' ';
+    body[body_length] = '\n';
+    size_t record_length = 5 + body_length + 1;
+
+    if (last_segment == 0 || last_segment_size + record_length > CONFIG_MQTT_JOURNAL_SEGMENT_SIZE) {
+        // rotate, a new segment only becomes visible with its first complete record
+        last_segment++;
+        last_segment_size = 0;
+        if (first_segment == 0) {
+            first_segment = last_segment;
+        }
+        if (last_segment - first_segment + 1 > CONFIG_MQTT_JOURNAL_MAX_SEGMENTS) {
+            LOG_WRN("Journal full, dropping segment %u.", first_segment);
+            segments_dropped++;
+            delete_first_segment();
+        }
+    }
+
+    char path[MAX_PATH_LENGTH];
+    segment_path(path, last_segment);
+    struct fs_file_t file;
+    fs_file_t_init(&file);
+    int ret = fs_open(&file, path, FS_O_CREATE | FS_O_APPEND | FS_O_WRITE);
+    if (ret != 0) {
+        LOG_ERR("fs_open %s failed: %d", path, ret);
+        return ret;
+    }
+    ssize_t written = fs_write(&file, record, record_length);
+    // closing flushes the data and the directory entry, so the record survives a reset
+    fs_close(&file);
+    if (written != record_length) {
+        LOG_ERR("fs_write failed: %d", (int)written);
+        return written < 0 ? written : -EIO;
+    }
+
+    last_segment_size += record_length;
+    records_journaled++;
+    bytes_journaled += record_length;
+    return 0;
+}
+
+int mqtt_journal_publish(const struct mqtt_topic *topic, uint8_t qos, const char *payload, size_t payload_length) {
+    if (memchr(payload, '\n', payload_length) != NULL) {
+        return -EINVAL;
+    }
+
+    if (mqtt_connection_is_connected()) {
+        int ret = mqtt_queue_publish(topic, qos, payload, payload_length);
+        if (ret != -ENOBUFS) {
+            // the topic of the backlog is most likely configured now
+            if (backlog()) {
+                k_work_schedule_for_queue(&journal_work_q, &replay_work, K_NO_WAIT);
+            }
+            return ret;
+        }
+    }
+
+    if (!journal_available) {
+        return -ENODEV;
+    }
+
+    k_mutex_lock(&journal_mutex, K_FOREVER);
+    int ret = append_record(topic, qos, payload, payload_length);
+    k_mutex_unlock(&journal_mutex);
+    return ret;
+}
+
+// "OK date 2023/11/27 time 14:02:33.25 SNTP"
+static void synchronize_clock(void) {
+    char response[64];
+    if (!expresslink_send_command("AT+TIME?\n", response, sizeof(response))) {
+        return;
+    }
+
+    struct tm t = {0};
+    if (sscanf(response, "date %d/%d/%d time %d:%d:%d", &t.tm_year, &t.tm_mon, &t.tm_mday, &t.tm_hour, &t.tm_min, &t.tm_sec) != 6) {
+        LOG_WRN("Unexpected AT+TIME? response: %s", response);
+        return;
+    }
+    t.tm_year -= 1900;
+    t.tm_mon -= 1;
+    clock_uptime = k_uptime_get();
+    clock_epoch = timeutil_timegm64(&t) * 1000;
+}
+
+// reads the record at the replay offset, returns its length including the line ending, 0 at the end of the segment
+static size_t read_record(struct fs_file_t *file, char **line, size_t *line_length) {
+    if (fs_seek(file, replay_offset, FS_SEEK_SET) != 0) {
+        return 0;
+    }
+    ssize_t n = fs_read(file, record, MAX_RECORD_LENGTH);
+    if (n <= 0) {
+        return 0;
+    }
+
+    char *end = memchr(record, '\n', n);
+    if (end == NULL) {
+        // torn by a reset while writing, or garbage: skip the rest of the segment
+        records_corrupt++;
+        return n;
+    }
+    *end = 0;
+    *line = record;
+    *line_length = end - record;
+    return *line_length + 1;
+}
+
+// publishes a single record, returns false if it has to be retried later
+static bool replay_record(char *line, size_t line_length) {
+    unsigned int crc, topic_index, qos, record_boot_id;
+    long long epoch, uptime;
+    int payload_start = 0;
+    char topic_name[128];
+    if (line_length < 5 ||
+        sscanf(line, "%4x %u %u %lld %lld %x %127s %n", &crc, &topic_index, &qos, &epoch, &uptime, &record_boot_id, topic_name, &payload_start) != 7 ||
+        payload_start == 0 || crc != crc16_ccitt(0, line + 5, line_length - 5)) {
+        records_corrupt++;
+        return true;
+    }
+
+    // the topic index could be used by another workshop module at the moment, the record is then sent through
+    // the replay topic index configured with the stored topic
+    uint8_t index = topic_index;
+    char cmd[160];
+    char configured_topic[128];
+    snprintf(cmd, sizeof(cmd), "AT+CONF? Topic%u\n", topic_index);
+    if (!expresslink_send_command(cmd, configured_topic, sizeof(configured_topic)) || strcmp(configured_topic, topic_name) != 0) {
+        if (strcmp(replay_topic, topic_name) != 0) {
+            // queued or unacknowledged messages of the previous topic would be sent to the new one
+            if (mqtt_queue_depth() > 0 || mqtt_publish_inflight() > 0) {
+                return false;
+            }
+            snprintf(cmd, sizeof(cmd), "AT+CONF Topic%u=%s\n", CONFIG_MQTT_JOURNAL_REPLAY_TOPIC_INDEX, topic_name);
+            if (!expresslink_send_command(cmd, NULL, 0)) {
+                LOG_WRN("Cannot configure topic %s, skipping journaled message.", topic_name);
+                replay_topic[0] = 0;
+                records_skipped++;
+                return true;
+            }
+            strcpy(replay_topic, topic_name);
+        }
+        index = CONFIG_MQTT_JOURNAL_REPLAY_TOPIC_INDEX;
+    }
+
+    if (epoch == 0 && record_boot_id == boot_id && clock_epoch != 0) {
+        epoch = clock_epoch - (clock_uptime - uptime);
+    }
+
+    const char *payload = line + payload_start;
+    size_t payload_length = line_length - payload_start;
+    int n = -1;
+    if (epoch != 0 && payload[0] == '{') {
+        // {"timestamp":1701093753250,...original fields...}
+        n = snprintf(replay_payload,
+                     sizeof(replay_payload),
+                     "{\"timestamp\":%lld%s%.*s",
+                     epoch,
+                     payload[1] == '}' ? "" : ",",
+                     (int)payload_length - 1,
+                     payload + 1);
+    }
+    if (n < 0 || n >= sizeof(replay_payload)) {
+        n = MIN(payload_length, sizeof(replay_payload));
+        memcpy(replay_payload, payload, n);
+    }
+
+    // replayed messages never evict live ones from the queue
+    const struct mqtt_topic topic = {.index = index, .topic = NULL, .drop = MQTT_DROP_NEWEST};
+    if (mqtt_queue_publish(&topic, qos, replay_payload, n) == -ENOBUFS) {
+        return false;
+    }
+
+    records_replayed++;
+    bytes_replayed += line_length + 1;
+    return true;
+}
+
+static void replay_work_handler(struct k_work *work) {
+    if (!mqtt_connection_is_connected()) {
+        // resumed by the connection state change
+        return;
+    }
+    if (clock_epoch == 0) {
+        synchronize_clock();
+    }
+
+    k_mutex_lock(&journal_mutex, K_FOREVER);
+    if (!backlog()) {
+        k_mutex_unlock(&journal_mutex);
+        return;
+    }
+    if (replay_started < 0) {
+        replay_started = k_uptime_get();
+        LOG_INF("Replaying journal segments %u to %u...", first_segment, last_segment);
+    }
+
+    char path[MAX_PATH_LENGTH];
+    segment_path(path, first_segment);
+    struct fs_file_t file;
+    fs_file_t_init(&file);
+    int ret = fs_open(&file, path, FS_O_READ);
+
+    bool blocked = false;
+    for (size_t i = 0; ret == 0 && i < CONFIG_MQTT_JOURNAL_REPLAY_BATCH; i++) {
+        char *line;
+        size_t line_length = 0;
+        size_t consumed = read_record(&file, &line, &line_length);
+        if (consumed == 0) {
+            break;
+        }
+        if (line_length > 0 && !replay_record(line, line_length)) {
+            blocked = true;
+            break;
+        }
+        replay_offset += consumed;
+    }
+
+    bool segment_done = false;
+    if (ret == 0) {
+        segment_done = !blocked && (first_segment != last_segment || replay_offset >= last_segment_size) &&
+                       fs_seek(&file, replay_offset, FS_SEEK_SET) == 0 && fs_read(&file, record, 1) <= 0;
+        fs_close(&file);
+    } else {
+        LOG_WRN("fs_open %s failed: %d", path, ret);
+        segment_done = true;
+    }
+    if (segment_done) {
+        delete_first_segment();
+    }
+
+    if (backlog()) {
+        k_work_schedule_for_queue(&journal_work_q, &replay_work, K_MSEC(CONFIG_MQTT_JOURNAL_REPLAY_INTERVAL));
+    } else {
+        uint32_t elapsed = MAX(1, (uint32_t)(k_uptime_get() - replay_started));
+        replay_throughput = (uint32_t)((uint64_t)bytes_replayed * 1000 / elapsed);
+        replay_started = -1;
+        LOG_INF("Journal replayed.");
+    }
+    k_mutex_unlock(&journal_mutex);
+}
+
+bool mqtt_journal_backlog(void) {
+    return backlog();
+}
+
+static void handle_connection_state(enum mqtt_connection_state state, int hint, void *user_data) {
+    if (state == MQTT_CONNECTED) {
+        // the module might have been reset while disconnected
+        replay_topic[0] = 0;
+    }
+    if (state == MQTT_CONNECTED && backlog()) {
+        k_work_reschedule_for_queue(&journal_work_q, &replay_work, K_NO_WAIT);
+    }
+}
+
+static void scan_segments(void) {
+    struct fs_dir_t dir;
+    fs_dir_t_init(&dir);
+    if (fs_opendir(&dir, JOURNAL_DIR) != 0) {
+        return;
+    }
+
+    struct fs_dirent entry;
+    while (fs_readdir(&dir, &entry) == 0 && entry.name[0] != 0) {
+        char *end;
+        uint32_t segment = strtoul(entry.name, &end, 10);
+        if (entry.type != FS_DIR_ENTRY_FILE || segment == 0 || *end != '.') {
+            continue;
+        }
+        if (first_segment == 0 || segment < first_segment) {
+            first_segment = segment;
+        }
+        if (segment > last_segment) {
+            last_segment = segment;
+            last_segment_size = entry.size;
+        }
+    }
+    fs_closedir(&dir);
+}
+
+void mqtt_journal_print_stats(const struct shell *sh) {
+    k_mutex_lock(&journal_mutex, K_FOREVER);
+    if (backlog()) {
+        shell_print(sh, "segments: %u to %u, replay offset: %u", first_segment, last_segment, (uint32_t)replay_offset);
+    } else {
+        shell_print(sh, "journal empty%s", journal_available ? "" : " (not available)");
+    }
+    shell_print(sh, "journaled: %u records, %u bytes", records_journaled, bytes_journaled);
+    shell_print(sh, "replayed: %u records, %u bytes, last replay: %u bytes/s", records_replayed, bytes_replayed, replay_throughput);
+    shell_print(sh, "corrupt records: %u, skipped records: %u, dropped segments: %u", records_corrupt, records_skipped, segments_dropped);
+    k_mutex_unlock(&journal_mutex);
+}
+
+void mqtt_journal_reset_stats(void) {
+    k_mutex_lock(&journal_mutex, K_FOREVER);
+    records_journaled = 0;
+    bytes_journaled = 0;
+    records_replayed = 0;
+    bytes_replayed = 0;
+    records_corrupt = 0;
+    records_skipped = 0;
+    segments_dropped = 0;
+    replay_throughput = 0;
+    k_mutex_unlock(&journal_mutex);
+}
+
+int init_mqtt_journal(void) {
+    boot_id = sys_rand32_get();
+
+    k_work_queue_init(&journal_work_q);
+    k_work_queue_start(&journal_work_q,
+                       mqtt_journal_task_stack,
+                       K_THREAD_STACK_SIZEOF(mqtt_journal_task_stack),
+                       mqtt_journal_TASK_PRIORITY,
+                       NULL);
+
+    int ret = fs_mkdir(JOURNAL_DIR);
+    if (ret != 0 && ret != -EEXIST) {
+        LOG_ERR("fs_mkdir %s failed: %d", JOURNAL_DIR, ret);
+        return ret;
+    }
+
+    scan_segments();
+    if (backlog()) {
+        LOG_INF("Journal contains segments %u to %u.", first_segment, last_segment);
+    }
+    journal_available = true;
+
+    return mqtt_connection_state_subscribe(handle_connection_state, NULL);
+}
@@ -0,0 +1,291 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+LOG_MODULE_REGISTER(mqtt_publish);
+
+#include "badge.h"
+
+// Up to CONFIG_MQTT_PUBLISH_WINDOW messages are in flight at the same time: queued for the ExpressLink I/O
+// thread, being sent, or waiting for their PUBACK. ExpressLink only reports the topic index with the
+// PUBACK event, so acknowledgements are matched to the oldest unacknowledged message on that topic.
+// Messages without PUBACK within CONFIG_MQTT_PUBACK_TIMEOUT are sent again (at-least-once delivery).
+
+enum slot_state {
+    SLOT_FREE,
+    SLOT_RESERVED, // being filled by the producer
+    SLOT_QUEUED,  // waiting for the connection or a free ExpressLink request queue entry
+    SLOT_SENDING, // submitted to the ExpressLink I/O thread
+    SLOT_AWAITING_PUBACK,
+};
+
+struct inflight_message {
+    enum slot_state state;
+    uint8_t topic_index;
+    uint8_t qos;
+    uint8_t retries;
+    bool acked; // PUBACK arrived before the send completed
+    uint32_t sequence;
+    int64_t first_sent_at;
+    int64_t sent_at;
+    char prefix[12]; // "AT+SEND12 "
+    char payload[CONFIG_MQTT_PUBLISH_MAX_PAYLOAD];
+    size_t payload_length;
+    struct expresslink_iovec iov[3];
+    struct expresslink_request request;
+};
+
+static struct inflight_message window[CONFIG_MQTT_PUBLISH_WINDOW];
+static uint32_t next_sequence = 0;
+static struct k_spinlock window_lock;
+K_SEM_DEFINE(free_slots, CONFIG_MQTT_PUBLISH_WINDOW, CONFIG_MQTT_PUBLISH_WINDOW);
+
+// counters, see `expresslink publish`
+static uint32_t published = 0;
+static uint32_t acknowledged = 0;
+static uint32_t retransmissions = 0;
+static uint32_t failed = 0;
+static uint32_t min_ack_latency = UINT32_MAX; // milliseconds
+static uint32_t max_ack_latency = 0;
+static uint64_t total_ack_latency = 0;
+
+static void retransmit_work_handler(struct k_work *work);
+K_WORK_DELAYABLE_DEFINE(retransmit_work, retransmit_work_handler);
+
+static void free_slot(struct inflight_message *m) {
+    m->state = SLOT_FREE;
+    k_sem_give(&free_slots);
+    mqtt_queue_kick();
+}
+
+static void record_ack(struct inflight_message *m) {
+    uint32_t latency = (uint32_t)(k_uptime_get() - m->first_sent_at);
+    acknowledged++;
+    min_ack_latency = MIN(min_ack_latency, latency);
+    max_ack_latency = MAX(max_ack_latency, latency);
+    total_ack_latency += latency;
+}
+
+// called from the ExpressLink I/O thread
+static void send_done(struct expresslink_request *request) {
+    struct inflight_message *m = request->user_data;
+    k_spinlock_key_t key = k_spin_lock(&window_lock);
+
+    if (!request->success) {
+        // e.g., not connected (anymore), sent again by the retransmit work
+        if (++m->retries > CONFIG_MQTT_PUBLISH_MAX_RETRIES) {
+            LOG_WRN("Dropping message on topic %u after %u attempts.", m->topic_index, m->retries);
+            failed++;
+            free_slot(m);
+        } else {
+            m->state = SLOT_QUEUED;
+        }
+    } else if (m->qos == 0) {
+        free_slot(m);
+    } else if (m->acked) {
+        record_ack(m);
+        free_slot(m);
+    } else {
+        m->state = SLOT_AWAITING_PUBACK;
+        m->sent_at = k_uptime_get();
+    }
+
+    k_spin_unlock(&window_lock, key);
+}
+
+static void send(struct inflight_message *m) {
+    int64_t now = k_uptime_get();
+    k_spinlock_key_t key = k_spin_lock(&window_lock);
+    if (m->state != SLOT_QUEUED || m->request.pending) {
+        k_spin_unlock(&window_lock, key);
+        return;
+    }
+    m->state = SLOT_SENDING;
+    m->acked = false;
+    if (m->first_sent_at < 0) {
+        m->first_sent_at = now;
+    }
+    k_spin_unlock(&window_lock, key);
+
+    if (expresslink_submit(&m->request) != 0) {
+        // the ExpressLink request queue is full, try again with the next retransmit run
+        key = k_spin_lock(&window_lock);
+        m->state = SLOT_QUEUED;
+        k_spin_unlock(&window_lock, key);
+    }
+}
+
+static void retransmit_work_handler(struct k_work *work) {
+    bool connected = mqtt_connection_is_connected();
+    bool busy = false;
+    int64_t now = k_uptime_get();
+
+    for (size_t i = 0; i < ARRAY_SIZE(window); i++) {
+        struct inflight_message *m = &window[i];
+        k_spinlock_key_t key = k_spin_lock(&window_lock);
+        enum slot_state state = m->state;
+        if (state == SLOT_AWAITING_PUBACK && connected && now - m->sent_at >= CONFIG_MQTT_PUBACK_TIMEOUT) {
+            if (++m->retries > CONFIG_MQTT_PUBLISH_MAX_RETRIES) {
+                LOG_WRN("No PUBACK for message on topic %u after %u attempts, dropping it.", m->topic_index, m->retries);
+                failed++;
+                free_slot(m);
+                state = SLOT_FREE;
+            } else {
+                retransmissions++;
+                m->state = SLOT_QUEUED;
+                state = SLOT_QUEUED;
+            }
+        }
+        k_spin_unlock(&window_lock, key);
+
+        if (state == SLOT_QUEUED && connected) {
+            send(m);
+        }
+        busy |= (state != SLOT_FREE);
+    }
+
+    if (busy) {
+        k_work_schedule(&retransmit_work, K_MSEC(CONFIG_MQTT_PUBACK_TIMEOUT / 4));
+    }
+}
+
+int mqtt_publish(uint8_t topic_index, const char *payload, size_t payload_length, uint8_t qos, k_timeout_t timeout) {
+    if (payload_length > CONFIG_MQTT_PUBLISH_MAX_PAYLOAD) {
+        return -EMSGSIZE;
+    }
+    if (k_sem_take(&free_slots, timeout) != 0) {
+        return -EAGAIN;
+    }
+
+    struct inflight_message *m = NULL;
+    k_spinlock_key_t key = k_spin_lock(&window_lock);
+    for (size_t i = 0; i < ARRAY_SIZE(window); i++) {
+        // the request of a dropped message could still be owned by the I/O thread
+        if (window[i].state == SLOT_FREE && !window[i].request.pending) {
+            m = &window[i];
+            break;
+        }
+    }
+    if (m == NULL) {
+        k_spin_unlock(&window_lock, key);
+        k_sem_give(&free_slots);
+        return -EAGAIN;
+    }
+    m->state = SLOT_RESERVED;
+    k_spin_unlock(&window_lock, key);
+
+    m->topic_index = topic_index;
+    m->qos = qos;
+    m->retries = 0;
+    m->first_sent_at = -1;
+    memcpy(m->payload, payload, payload_length);
+    m->payload_length = payload_length;
+
+    int prefix_length = snprintf(m->prefix, sizeof(m->prefix), "AT+SEND%u ", topic_index);
+    m->iov[0] = (struct expresslink_iovec){m->prefix, prefix_length};
+    m->iov[1] = (struct expresslink_iovec){m->payload, m->payload_length};
+    m->iov[2] = (struct expresslink_iovec){"\n", 1};
+    m->request = (struct expresslink_request){
+        .iov = m->iov,
+        .iovcnt = ARRAY_SIZE(m->iov),
+        .callback = send_done,
+        .user_data = m,
+    };
+
+    key = k_spin_lock(&window_lock);
+    m->state = SLOT_QUEUED;
+    m->sequence = next_sequence++;
+    published++;
+    k_spin_unlock(&window_lock, key);
+
+    if (mqtt_connection_is_connected()) {
+        send(m);
+    }
+    // does not postpone an already scheduled run
+    k_work_schedule(&retransmit_work, K_MSEC(CONFIG_MQTT_PUBACK_TIMEOUT / 4));
+    return 0;
+}
+
+void mqtt_publish_handle_puback(const struct expresslink_event *event, void *user_data) {
+    struct inflight_message *oldest = NULL;
+    k_spinlock_key_t key = k_spin_lock(&window_lock);
+    for (size_t i = 0; i < ARRAY_SIZE(window); i++) {
+        struct inflight_message *m = &window[i];
+        if (m->qos == 0 || m->topic_index != event->parameter || m->acked) {
+            continue;
+        }
+        if (m->state != SLOT_SENDING && m->state != SLOT_AWAITING_PUBACK) {
+            continue;
+        }
+        if (oldest == NULL || (int32_t)(m->sequence - oldest->sequence) < 0) {
+            oldest = m;
+        }
+    }
+
+    if (oldest == NULL) {
+        // e.g., the PUBACK of a message which was retransmitted in the meantime
+        LOG_DBG("Unexpected PUBACK on topic %d.", event->parameter);
+    } else if (oldest->state == SLOT_SENDING) {
+        oldest->acked = true;
+    } else {
+        record_ack(oldest);
+        free_slot(oldest);
+    }
+    k_spin_unlock(&window_lock, key);
+}
+
+// queued messages are sent as soon as the connection is back
+static void handle_connection_state(enum mqtt_connection_state state, int hint, void *user_data) {
+    if (state == MQTT_CONNECTED) {
+        k_work_reschedule(&retransmit_work, K_NO_WAIT);
+    }
+}
+
+size_t mqtt_publish_inflight(void) {
+    k_spinlock_key_t key = k_spin_lock(&window_lock);
+    size_t inflight = 0;
+    for (size_t i = 0; i < ARRAY_SIZE(window); i++) {
+        inflight += (window[i].state != SLOT_FREE);
+    }
+    k_spin_unlock(&window_lock, key);
+    return inflight;
+}
+
+void mqtt_publish_print_stats(const struct shell *sh) {
+    k_spinlock_key_t key = k_spin_lock(&window_lock);
+    size_t inflight = 0;
+    for (size_t i = 0; i < ARRAY_SIZE(window); i++) {
+        inflight += (window[i].state != SLOT_FREE);
+    }
+    uint32_t p = published, a = acknowledged, r = retransmissions, f = failed;
+    uint32_t min = (a > 0) ? min_ack_latency : 0;
+    uint32_t max = max_ack_latency;
+    uint32_t avg = (a > 0) ? (uint32_t)(total_ack_latency / a) : 0;
+    k_spin_unlock(&window_lock, key);
+
+    shell_print(sh, "in flight: %u of %u", inflight, CONFIG_MQTT_PUBLISH_WINDOW);
+    shell_print(sh, "published: %u, acknowledged: %u, retransmitted: %u, failed: %u", p, a, r, f);
+    shell_print(sh, "publish to PUBACK: min %u ms, average %u ms, max %u ms", min, avg, max);
+}
+
+void mqtt_publish_reset_stats(void) {
+    k_spinlock_key_t key = k_spin_lock(&window_lock);
+    published = 0;
+    acknowledged = 0;
+    retransmissions = 0;
+    failed = 0;
+    min_ack_latency = UINT32_MAX;
+    max_ack_latency = 0;
+    total_ack_latency = 0;
+    k_spin_unlock(&window_lock, key);
+}
+
+int init_mqtt_publish(void) {
+    return mqtt_connection_state_subscribe(handle_connection_state, NULL);
+}
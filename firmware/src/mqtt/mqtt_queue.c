@@ -0,0 +1,204 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+LOG_MODULE_REGISTER(mqtt_queue);
+
+#include "badge.h"
+
+// Bounded queue in front of the in-flight window of mqtt_publish(), so producers never wait for the modem.
+// Entries are moved to the window from the system work queue, highest priority first and in order within
+// the same priority. A full queue makes room according to the drop policy of the topic of the new message.
+// The lock is only held to pick an entry, the payload is copied with interrupts enabled.
+
+struct queue_entry {
+    bool used;
+    bool draining; // being copied into the window, not coalesced anymore
+    bool filling;  // the payload is being copied in, not drained, coalesced or evicted yet
+    uint8_t topic_index;
+    uint8_t qos;
+    uint8_t priority;
+    bool coalesce;
+    uint32_t sequence;
+    size_t payload_length;
+    char payload[CONFIG_MQTT_PUBLISH_MAX_PAYLOAD];
+};
+
+static struct queue_entry queue[CONFIG_MQTT_QUEUE_LENGTH];
+static size_t queue_depth = 0;
+static uint32_t next_sequence = 0;
+static struct k_spinlock queue_lock;
+
+// counters, see `expresslink queue`
+static uint32_t enqueued = 0;
+static uint32_t coalesced = 0;
+static uint32_t dropped = 0;  // evicted from the queue
+static uint32_t rejected = 0; // not queued at all
+static size_t high_water_mark = 0;
+
+static void drain_work_handler(struct k_work *work);
+K_WORK_DEFINE(drain_work, drain_work_handler);
+
+static bool is_older(const struct queue_entry *a, const struct queue_entry *b) {
+    return (int32_t)(a->sequence - b->sequence) < 0;
+}
+
+// the lowest priority entry which may be evicted for a message of the given priority, oldest first
+static struct queue_entry *find_victim(uint8_t priority, enum mqtt_drop_policy drop) {
+    struct queue_entry *victim = NULL;
+    for (size_t i = 0; i < ARRAY_SIZE(queue); i++) {
+        struct queue_entry *e = &queue[i];
+        if (!e->used || e->draining || e->filling) {
+            continue;
+        }
+        if (e->priority > priority || (e->priority == priority && drop == MQTT_DROP_NEWEST)) {
+            continue;
+        }
+        if (victim == NULL || e->priority < victim->priority || (e->priority == victim->priority && is_older(e, victim))) {
+            victim = e;
+        }
+    }
+    return victim;
+}
+
+int mqtt_queue_publish(const struct mqtt_topic *topic, uint8_t qos, const char *payload, size_t payload_length) {
+    if (payload_length > CONFIG_MQTT_PUBLISH_MAX_PAYLOAD) {
+        return -EMSGSIZE;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&queue_lock);
+    struct queue_entry *entry = NULL;
+    bool replace = false;
+
+    if (topic->coalesce) {
+        for (size_t i = 0; i < ARRAY_SIZE(queue); i++) {
+            if (queue[i].used && !queue[i].draining && !queue[i].filling && queue[i].topic_index == topic->index) {
+                // keeps its place in the queue
+                entry = &queue[i];
+                replace = true;
+                coalesced++;
+                break;
+            }
+        }
+    }
+
+    if (entry == NULL) {
+        for (size_t i = 0; i < ARRAY_SIZE(queue); i++) {
+            if (!queue[i].used) {
+                entry = &queue[i];
+                queue_depth++;
+                break;
+            }
+        }
+    }
+
+    if (entry == NULL) {
+        entry = find_victim(topic->priority, topic->drop);
+        if (entry == NULL) {
+            rejected++;
+            k_spin_unlock(&queue_lock, key);
+            return -ENOBUFS;
+        }
+        dropped++;
+    }
+
+    if (!replace) {
+        entry->sequence = next_sequence++;
+    }
+    entry->used = true;
+    entry->draining = false;
+    entry->filling = true;
+    entry->topic_index = topic->index;
+    entry->qos = qos;
+    entry->priority = topic->priority;
+    entry->coalesce = topic->coalesce;
+    enqueued++;
+    high_water_mark = MAX(high_water_mark, queue_depth);
+    k_spin_unlock(&queue_lock, key);
+
+    // the entry is reserved, nobody else touches it until it is filled
+    memcpy(entry->payload, payload, payload_length);
+    entry->payload_length = payload_length;
+
+    key = k_spin_lock(&queue_lock);
+    entry->filling = false;
+    k_spin_unlock(&queue_lock, key);
+
+    k_work_submit(&drain_work);
+    return 0;
+}
+
+static void drain_work_handler(struct k_work *work) {
+    while (true) {
+        k_spinlock_key_t key = k_spin_lock(&queue_lock);
+        struct queue_entry *next = NULL;
+        for (size_t i = 0; i < ARRAY_SIZE(queue); i++) {
+            struct queue_entry *e = &queue[i];
+            if (e->used && !e->filling && (next == NULL || e->priority > next->priority || (e->priority == next->priority && is_older(e, next)))) {
+                next = e;
+            }
+        }
+        if (next == NULL) {
+            k_spin_unlock(&queue_lock, key);
+            return;
+        }
+        next->draining = true;
+        k_spin_unlock(&queue_lock, key);
+
+        // copies the payload, the entry cannot be evicted or coalesced while draining
+        int ret = mqtt_publish(next->topic_index, next->payload, next->payload_length, next->qos, K_NO_WAIT);
+
+        key = k_spin_lock(&queue_lock);
+        if (ret == -EAGAIN) {
+            // the window is full, mqtt_queue_kick() resumes draining once a slot is free
+            next->draining = false;
+            k_spin_unlock(&queue_lock, key);
+            return;
+        }
+        if (ret != 0) {
+            LOG_WRN("Dropping message on topic %u: %d", next->topic_index, ret);
+            dropped++;
+        }
+        next->used = false;
+        next->draining = false;
+        queue_depth--;
+        k_spin_unlock(&queue_lock, key);
+    }
+}
+
+void mqtt_queue_kick(void) {
+    k_work_submit(&drain_work);
+}
+
+size_t mqtt_queue_depth(void) {
+    k_spinlock_key_t key = k_spin_lock(&queue_lock);
+    size_t depth = queue_depth;
+    k_spin_unlock(&queue_lock, key);
+    return depth;
+}
+
+void mqtt_queue_print_stats(const struct shell *sh) {
+    k_spinlock_key_t key = k_spin_lock(&queue_lock);
+    size_t depth = queue_depth, hwm = high_water_mark;
+    uint32_t e = enqueued, c = coalesced, d = dropped, r = rejected;
+    k_spin_unlock(&queue_lock, key);
+
+    shell_print(sh, "queued: %u of %u, high-water mark: %u", depth, CONFIG_MQTT_QUEUE_LENGTH, hwm);
+    shell_print(sh, "enqueued: %u, coalesced: %u, dropped: %u, rejected: %u", e, c, d, r);
+}
+
+void mqtt_queue_reset_stats(void) {
+    k_spinlock_key_t key = k_spin_lock(&queue_lock);
+    enqueued = 0;
+    coalesced = 0;
+    dropped = 0;
+    rejected = 0;
+    high_water_mark = queue_depth;
+    k_spin_unlock(&queue_lock, key);
+}
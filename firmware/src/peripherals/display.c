@@ -113,6 +113,32 @@ void delete_picture() {
     }
 }
 
+/**
+ * Write pixels straight to the display, bypassing LVGL.
+ * LVGL only redraws areas it invalidated itself, the pixels stay visible until then.
+ * @param pixels    width * height RGB565 pixels in native byte order, the panel is set up for low byte first
+ */
+int draw_pixels(uint16_t x, uint16_t y, uint16_t width, uint16_t height, const void *pixels) {
+    struct display_capabilities caps;
+    display_get_capabilities(display_dev, &caps);
+    if (caps.current_pixel_format != PIXEL_FORMAT_RGB_565) {
+        return -ENOTSUP;
+    }
+
+    struct display_buffer_descriptor desc = {
+        .buf_size = width * height * 2,
+        .width = width,
+        .height = height,
+        .pitch = width,
+    };
+
+    // must not interleave with an LVGL flush on the same bus
+    k_mutex_lock(&display_handler_mutex, K_FOREVER);
+    int ret = display_write(display_dev, x, y, &desc, pixels);
+    k_mutex_unlock(&display_handler_mutex);
+    return ret;
+}
+
 /**
  * Set the display brightness.
  * @param v    brightness value between 0 (dark) to 100 (bright)
@@ -17,30 +17,85 @@
 LOG_MODULE_REGISTER(expresslink);
 
 #include "badge.h"
+#include "line_assembler.h"
 #include "self_test.h"
 
 K_MUTEX_DEFINE(uart_expresslink_mutex);
+// the thread holding uart_expresslink_mutex, its commands cannot wait for the I/O thread, see send_commandv()
+static k_tid_t uart_owner = NULL;
+static uint32_t uart_lock_count = 0; // the mutex is recursive
 const struct device *uart_expresslink = DEVICE_DT_GET(DT_NODELABEL(uart0));
 
 K_EVENT_DEFINE(uart_expresslink_tx_done);
 
-RING_BUF_DECLARE(receive_ring, 4096);
+// Memory plan of the ExpressLink path, all of it is allocated statically and reported by CMake at build time,
+// see `expresslink memory`. The DMA buffers only stage the received bytes until uart_cb copies them into
+// receive_ring, so they are small. Lines are copied out of the ring as they arrive, up to RESPONSE_LINE_LENGTH,
+// which only has to fill a response buffer, longer lines are streamed. Workshop modules borrow their response and
+// command buffers from a fixed pool instead of the heap.
+#define RECV_BUF_LENGTH CONFIG_EXPRESSLINK_RX_DMA_BUFFER_SIZE
+#define RESPONSE_LINE_LENGTH CONFIG_EXPRESSLINK_RESPONSE_LINE_LENGTH
+#define EXPRESSLINK_MEMORY_TOTAL                                                                       \
+    (CONFIG_EXPRESSLINK_RX_RING_SIZE + 2 * RECV_BUF_LENGTH + RESPONSE_LINE_LENGTH +                  \
+     CONFIG_EXPRESSLINK_BUFFER_COUNT * CONFIG_EXPRESSLINK_BUFFER_SIZE)
+BUILD_ASSERT(EXPRESSLINK_MEMORY_TOTAL <= CONFIG_EXPRESSLINK_MEMORY_BUDGET, "ExpressLink buffers exceed CONFIG_EXPRESSLINK_MEMORY_BUDGET");
+BUILD_ASSERT(RESPONSE_LINE_LENGTH >= CONFIG_EXPRESSLINK_BUFFER_SIZE, "A response line has to fill a pool buffer");
+
+RING_BUF_DECLARE(receive_ring, CONFIG_EXPRESSLINK_RX_RING_SIZE);
+
+// one count per complete line (terminated by '\n') that is currently stored in receive_ring
+K_SEM_DEFINE(receive_line_sem, 0, K_SEM_MAX_LIMIT);
+// signalled whenever new data was stored in receive_ring, used to read lines larger than the ring buffer
+K_SEM_DEFINE(receive_data_sem, 0, 1);
 
 #define UART_RX_ASYNC_TIMEOUT (10000)
-#define RECV_BUF_LENGTH (4096)
-static char *recv_buf0;
-static char *recv_buf1;
+static char recv_buf0[RECV_BUF_LENGTH];
+static char recv_buf1[RECV_BUF_LENGTH];
 static uint8_t active_recv_buf_id = 0;
 
-const size_t response_line_length = RECV_BUF_LENGTH * 2;
-static char *response_line;
-static size_t response_offset = 0;
+const size_t response_line_length = RESPONSE_LINE_LENGTH;
+static char response_line[RESPONSE_LINE_LENGTH];
+
+K_MEM_SLAB_DEFINE_STATIC(buffer_slab, CONFIG_EXPRESSLINK_BUFFER_SIZE, CONFIG_EXPRESSLINK_BUFFER_COUNT, 4);
+static atomic_t buffers_max_used = ATOMIC_INIT(0);
+static atomic_t buffer_alloc_failures = ATOMIC_INIT(0);
+
+// Offsets in the stream of received bytes, to find the lines which lost bytes while receive_ring was full.
+// A line is only known to be damaged once it is read, so the gap is remembered until the reader passed it.
+static uint32_t rx_put_offset = 0; // updated from uart_cb
+static uint32_t rx_get_offset = 0;
+static bool rx_gap = false;
+static uint32_t rx_gap_first = 0; // offset of the first byte received after a gap
+static uint32_t rx_gap_last = 0;
+static struct k_spinlock rx_gap_lock;
+static int readline_error = 0; // why readline() returned NULL
+
+// duty cycling, see expresslink_sleep(): any command wakes the module first
+static atomic_t sleeping = ATOMIC_INIT(0);
+static int64_t sleeping_since = 0;
+static int64_t awake_since = -1; // -1 until woken up from the first sleep
+static struct k_spinlock sleep_lock;
 
 static const struct shell *passthrough_shell = NULL;
 static bool passthrough_local_echo = true;
 
 static struct gpio_callback event_interrupt_cb_data;
 
+// all AT commands are executed by a dedicated I/O thread, callers queue requests and get notified on completion
+#define EXPRESSLINK_REQUEST_QUEUE_LENGTH (8)
+K_MSGQ_DEFINE(expresslink_request_msgq, sizeof(struct expresslink_request *), EXPRESSLINK_REQUEST_QUEUE_LENGTH, 4);
+
+#define expresslink_io_TASK_PRIORITY 9 // above the workshop modules, so responses are handled as soon as they arrive
+K_THREAD_STACK_DEFINE(expresslink_io_task_stack, 2048);
+static struct k_thread expresslink_io_task;
+static k_tid_t expresslink_io_task_id = NULL;
+
+// additional lines of an OKn response, which are read via expresslink_read_response_line() by the requester
+// if it declared so, see expresslink_send_command_multiline()
+static atomic_t pending_response_lines = ATOMIC_INIT(0);
+K_SEM_DEFINE(response_line_consumed_sem, 0, K_SEM_MAX_LIMIT);
+#define PENDING_RESPONSE_LINE_TIMEOUT (2000) // milliseconds
+
 #define passthrough_TASK_PRIORITY 10
 K_THREAD_STACK_DEFINE(passthrough_task_stack, 1024);
 static struct k_thread passthrough_task;
@@ -62,42 +117,214 @@ static const struct gpio_dt_spec expresslink_reset_pin = GPIO_DT_SPEC_GET(DT_ALI
 
 #define EXPRESSLINK_RESET_TIME (2500) // milliseconds
 
+// No command can take more than 120 seconds to complete, according to ExpressLink spec v1.1.2
+// https://docs.aws.amazon.com/iot-expresslink/latest/programmersguide/elpg-commands.html#elpg-responses
+#define COMMAND_MAX_TIMEOUT (120 * 1000) // milliseconds
+
+// additional lines of an OKn response follow the first line immediately
+#define RESPONSE_LINE_TIMEOUT (5000) // milliseconds
+
+// after a timeout or cancellation the module is probed and all output is discarded until it stays quiet
+#define RESYNC_FIRST_LINE_TIMEOUT (2000) // milliseconds
+#define RESYNC_QUIET_TIME (200) // milliseconds
+
+// Realistic response timeouts per AT command, matched by prefix in order (more specific prefixes first).
+// The timeout counters are shown with `expresslink timeouts` to tune the values from field data.
+struct command_descriptor {
+    const char *prefix;
+    uint32_t timeout; // milliseconds
+    uint32_t timeout_count;
+};
+
+static struct command_descriptor command_descriptors[] = {
+    {"AT+EVENT?", 1000},
+    {"AT+CONF?", 2000},
+    {"AT+CONF ", 5000},
+    {"AT+CONNECT!", 2000}, // non-blocking, the result is reported with the CONNECT event
+    {"AT+CONNECT", COMMAND_MAX_TIMEOUT},
+    {"AT+DISCONNECT", 10000},
+    {"AT+SEND", 5000},
+    {"AT+GET", 2000},
+    {"AT+SUBSCRIBE", 5000},
+    {"AT+UNSUBSCRIBE", 5000},
+    {"AT+SHADOW", 5000},
+    {"AT+OTA READ", 5000},
+    {"AT+OTA", 2000},
+    {"AT+DIAG WIFI SCAN", 20000},
+    {"AT+BLE", 5000},
+    {"AT+OTW", 10000},
+    {"AT+FACTORY_RESET", 10000},
+    {"AT+RESET", 10000},
+    {"", COMMAND_MAX_TIMEOUT}, // catch-all, must be last
+};
+
+static bool resync_required = false;
+static atomic_t cancel_requested = ATOMIC_INIT(0);
+
+static struct command_descriptor *lookup_command_descriptor(const char *command) {
+    for (size_t i = 0; i < ARRAY_SIZE(command_descriptors); i++) {
+        if (strncmp(command, command_descriptors[i].prefix, strlen(command_descriptors[i].prefix)) == 0) {
+            return &command_descriptors[i];
+        }
+    }
+    return &command_descriptors[ARRAY_SIZE(command_descriptors) - 1];
+}
+
 bool expresslink_check_event_pending(void) {
     return gpio_pin_get_dt(&expresslink_event_pin) == 1;
 }
 
-bool expresslink_is_event(const char *response, const char *event) {
-    return strncmp(response, event, strlen(event)) == 0;
+// Scatter-gather TX: the segments of a command are chained from the UART_TX_DONE callback,
+// so the payload is never copied into a command buffer. Only the segment descriptors are copied.
+#define TX_MAX_SEGMENTS (2 * CONFIG_SHELL_ARGC_MAX)
+#define TX_TIMEOUT (10000) // milliseconds
+static struct expresslink_iovec tx_segments[TX_MAX_SEGMENTS];
+static size_t tx_segment_count = 0;
+static size_t tx_segment_index = 0;
+static bool tx_busy = false;
+
+// called from thread context to start a transfer, and from uart_cb to chain the next segment
+static int tx_next_segment(void) {
+    while (tx_segment_index < tx_segment_count && tx_segments[tx_segment_index].len == 0) {
+        tx_segment_index++;
+    }
+    if (tx_segment_index >= tx_segment_count) {
+        return -ENODATA;
+    }
+
+    const struct expresslink_iovec *segment = &tx_segments[tx_segment_index++];
+    return uart_tx(uart_expresslink, segment->base, segment->len, SYS_FOREVER_US);
 }
 
-static void blocking_uart_expresslink_tx(const uint8_t *buf, size_t len) {
-    int ret = uart_tx(uart_expresslink, buf, len, SYS_FOREVER_US);
-    if (ret != 0) {
-        LOG_ERR("ExpressLink uart_tx failed: %d", ret);
+// waits until the previous transfer has completed, so its buffers can be reused
+static void uart_expresslink_tx_wait(void) {
+    if (!tx_busy) {
         return;
     }
+    tx_busy = false;
 
-    int events = k_event_wait(&uart_expresslink_tx_done, 0xF, true, K_MSEC(10000));
+    int events = k_event_wait(&uart_expresslink_tx_done, 0x1, false, K_MSEC(TX_TIMEOUT));
     if (events == 0) {
-        LOG_ERR("ExpressLink: uart_tx timeout, last message to send was: %.*s", len, buf);
+        LOG_ERR("ExpressLink: uart_tx timeout, %u of %u segments sent.", tx_segment_index, tx_segment_count);
+        uart_tx_abort(uart_expresslink);
     }
 }
 
+// starts transmitting the segments and returns without waiting for the transfer to complete,
+// the segment buffers must stay valid until uart_expresslink_tx_wait() returns
+static void uart_expresslink_txv_start(const struct expresslink_iovec *iov, size_t iovcnt) {
+    uart_expresslink_tx_wait();
+
+    if (iovcnt > TX_MAX_SEGMENTS) {
+        LOG_ERR("ExpressLink: too many TX segments: %u", iovcnt);
+        return;
+    }
+
+    k_event_clear(&uart_expresslink_tx_done, 0x1);
+    memcpy(tx_segments, iov, iovcnt * sizeof(*iov));
+    tx_segment_count = iovcnt;
+    tx_segment_index = 0;
+
+    for (size_t i = 0; i < iovcnt; i++) {
+        expresslink_stats_add_tx(iov[i].len);
+    }
+
+    int ret = tx_next_segment();
+    if (ret == -ENODATA) {
+        return;
+    } else if (ret != 0) {
+        LOG_ERR("ExpressLink uart_tx failed: %d", ret);
+        return;
+    }
+    tx_busy = true;
+}
+
+static void blocking_uart_expresslink_txv(const struct expresslink_iovec *iov, size_t iovcnt) {
+    uart_expresslink_txv_start(iov, iovcnt);
+    uart_expresslink_tx_wait();
+}
+
+static void blocking_uart_expresslink_tx(const uint8_t *buf, size_t len) {
+    struct expresslink_iovec iov = {buf, len};
+    blocking_uart_expresslink_txv(&iov, 1);
+}
+
+static void receive_ring_reset(void) {
+    k_spinlock_key_t key = k_spin_lock(&rx_gap_lock);
+    ring_buf_reset(&receive_ring);
+    rx_put_offset = 0;
+    rx_get_offset = 0;
+    rx_gap = false;
+    k_spin_unlock(&rx_gap_lock, key);
+    k_sem_reset(&receive_line_sem);
+    k_sem_reset(&receive_data_sem);
+    atomic_set(&pending_response_lines, 0);
+}
+
+// called from uart_cb: bytes were lost right before rx_put_offset
+static void receive_ring_record_gap(void) {
+    k_spinlock_key_t key = k_spin_lock(&rx_gap_lock);
+    if (!rx_gap) {
+        rx_gap = true;
+        rx_gap_first = rx_put_offset;
+    }
+    rx_gap_last = rx_put_offset;
+    k_spin_unlock(&rx_gap_lock, key);
+}
+
+static void receive_ring_put(const uint8_t *data, size_t len) {
+    size_t rb_len = ring_buf_put(&receive_ring, data, len);
+    // dropped bytes are counted instead of logged from the interrupt, see `expresslink stats`
+    expresslink_stats_add_rx(len, len - rb_len);
+    rx_put_offset += rb_len;
+    if (rb_len < len) {
+        receive_ring_record_gap();
+    }
+
+    // only count line endings that actually made it into the ring buffer
+    const uint8_t *end = data + rb_len;
+    const uint8_t *eol = memchr(data, '\n', rb_len);
+    while (eol != NULL) {
+        k_sem_give(&receive_line_sem);
+        eol = memchr(eol + 1, '\n', end - eol - 1);
+    }
+    if (rb_len > 0) {
+        k_sem_give(&receive_data_sem);
+    }
+}
+
+static void uart_lock(void) {
+    k_mutex_lock(&uart_expresslink_mutex, K_FOREVER);
+    uart_owner = k_current_get();
+    uart_lock_count++;
+}
+
+static void uart_unlock(void) {
+    if (--uart_lock_count == 0) {
+        uart_owner = NULL;
+    }
+    k_mutex_unlock(&uart_expresslink_mutex);
+}
+
 static void uart_cb(const struct device *dev, struct uart_event *evt, void *user_data) {
     int ret;
 
     switch (evt->type) {
     case UART_TX_DONE:
-        k_event_set(&uart_expresslink_tx_done, 0x1);
+        ret = tx_next_segment();
+        if (ret != 0) {
+            if (ret != -ENODATA) {
+                LOG_ERR("ExpressLink uart_tx failed: %d", ret);
+            }
+            k_event_set(&uart_expresslink_tx_done, 0x1);
+        }
         break;
     case UART_TX_ABORTED:
         LOG_ERR("UART UART_TX_ABORTED");
+        k_event_set(&uart_expresslink_tx_done, 0x1);
         break;
     case UART_RX_RDY:
-        size_t rb_len = ring_buf_put(&receive_ring, evt->data.rx.buf + evt->data.rx.offset, evt->data.rx.len);
-        if (rb_len < evt->data.rx.len) {
-            LOG_ERR("UART ring: Drop %u bytes", evt->data.rx.len - rb_len);
-        }
+        receive_ring_put(evt->data.rx.buf + evt->data.rx.offset, evt->data.rx.len);
         // LOG_INF("UART UART_RX_RDY: buf:%p offset:%d length:%d copy complete.", evt->data.rx.buf, evt->data.rx.offset, evt->data.rx.len);
         break;
     case UART_RX_BUF_REQUEST:
@@ -125,6 +352,10 @@ static void uart_cb(const struct device *dev, struct uart_event *evt, void *user
         break;
     case UART_RX_STOPPED:
         LOG_ERR("UART UART_RX_STOPPED %d", evt->data.rx_stop.reason);
+        if (evt->data.rx_stop.reason == UART_ERROR_OVERRUN) {
+            // the hardware FIFO overflowed, bytes were lost before they reached receive_ring
+            receive_ring_record_gap();
+        }
         break;
     default:
         LOG_WRN("UART CB unhandled event! %d", evt->type);
@@ -132,68 +363,265 @@ static void uart_cb(const struct device *dev, struct uart_event *evt, void *user
     }
 }
 
-char *readline(const struct device *uart) {
-    response_offset = 0;
+static void receive_ring_consume(size_t len) {
+    ring_buf_get_finish(&receive_ring, len);
+    rx_get_offset += len;
+}
+
+// true if bytes were dropped within the given offsets (inclusive) of the received stream
+static bool receive_ring_gap(uint32_t start, uint32_t end) {
+    k_spinlock_key_t key = k_spin_lock(&rx_gap_lock);
+    bool gap = rx_gap && (int32_t)(start - rx_gap_last) <= 0 && (int32_t)(end - rx_gap_first) >= 0;
+    if (rx_gap && (int32_t)(rx_get_offset - rx_gap_last) > 0) {
+        // everything received after the last gap was read
+        rx_gap = false;
+    }
+    k_spin_unlock(&rx_gap_lock, key);
+    return gap;
+}
 
-    // No command can take more than 120 seconds to complete, according to ExpressLink spec v1.1.2
-    // https://docs.aws.amazon.com/iot-expresslink/latest/programmersguide/elpg-commands.html#elpg-responses
-    int64_t deadline = k_uptime_get() + 120 * 1000;
+// The parser is desynchronized: the line merged parts of different lines, and OKn responses might have lost
+// some of their additional lines. Everything up to the response of the next command is discarded.
+static void receive_overrun_detected(void) {
+    LOG_WRN("UART receive overrun, discarding the response.");
+    expresslink_stats_record_rx_overrun();
+    resync_required = true;
+}
 
-    while (k_uptime_get() < deadline) {
-        if (ring_buf_get(&receive_ring, response_line + response_offset, 1) != 1) {
-            k_msleep(10);
-            continue;
+// returns NULL if no complete line was received before the timeout (in milliseconds), if the command was cancelled,
+// or if the line lost bytes due to a receive overrun, see readline_error
+static char *readline(const struct device *uart, uint32_t timeout) {
+    readline_error = 0;
+
+    // the bytes are copied out of the ring buffer as soon as they arrive, not only once the line ending is in the
+    // ring, so lines longer than the ring buffer are read as well; uart_cb signals receive_data_sem for new data
+    struct line_assembler line;
+    line_assembler_init(&line, response_line, response_line_length);
+    uint32_t line_start = rx_get_offset;
+    int64_t deadline = k_uptime_get() + timeout;
+    while (!line.complete) {
+        if (atomic_cas(&cancel_requested, 1, 0)) {
+            LOG_WRN("UART read cancelled!");
+            receive_ring_reset();
+            resync_required = true;
+            readline_error = -ECANCELED;
+            return NULL;
         }
 
-        if (response_line[response_offset] == '\n') {
-            response_line[response_offset] = 0;
-            if (response_offset > 1 && response_line[response_offset - 1] == '\r') {
-                response_line[response_offset - 1] = 0;
+        uint8_t *span;
+        uint32_t span_length = ring_buf_get_claim(&receive_ring, &span, CONFIG_EXPRESSLINK_RX_RING_SIZE);
+        if (span_length == 0) {
+            int64_t remaining = deadline - k_uptime_get();
+            if (remaining <= 0 || k_sem_take(&receive_data_sem, K_MSEC(remaining)) != 0) {
+                LOG_WRN("UART timeout!");
+                receive_ring_reset();
+                resync_required = true;
+                readline_error = -ETIMEDOUT;
+                return NULL;
             }
-            return response_line;
+            continue;
         }
-        response_offset++;
+        receive_ring_consume(line_assembler_put(&line, span, span_length));
     }
-    LOG_WRN("UART timeout!");
-    ring_buf_reset(&receive_ring);
-    return "";
+    // the line ending was counted by receive_ring_put()
+    k_sem_take(&receive_line_sem, K_NO_WAIT);
+
+    if (receive_ring_gap(line_start, rx_get_offset - 1)) {
+        receive_overrun_detected();
+        readline_error = -EIO;
+        return NULL;
+    }
+    if (line.dropped > 0) {
+        LOG_WRN("Response line longer than %u bytes, %u bytes dropped.", (uint32_t)response_line_length, (uint32_t)line.dropped);
+    }
+    return line_assembler_finish(&line);
 }
 
-bool expresslink_send_command(const char *command, char *response, size_t response_length) {
-    k_mutex_lock(&uart_expresslink_mutex, K_FOREVER);
+static void resynchronize(void) {
+    LOG_WRN("Resynchronizing ExpressLink UART...");
+    expresslink_stats_record_resync();
+    receive_ring_reset();
+    atomic_clear(&cancel_requested);
+
+    // a late response of the timed out command is followed by the response to this probe,
+    // as the module processes commands in order, so discard everything until the module stays quiet
+    blocking_uart_expresslink_tx("AT\n", 3);
+    if (k_sem_take(&receive_line_sem, K_MSEC(RESYNC_FIRST_LINE_TIMEOUT)) != 0) {
+        LOG_WRN("ExpressLink still busy, resynchronizing again with the next command.");
+        receive_ring_reset();
+        return;
+    }
+    while (k_sem_take(&receive_line_sem, K_MSEC(RESYNC_QUIET_TIME)) == 0) {
+        // keep discarding
+    }
+    receive_ring_reset();
+    resync_required = false;
+}
 
-    // WARNING: do not log the full command - it might be too long and crash the logging subsystem!
+void expresslink_cancel(void) {
+    // wakes up a pending readline(), which then discards the response and resynchronizes with the next command
+    atomic_set(&cancel_requested, 1);
+    k_sem_give(&receive_line_sem);
+    k_sem_give(&receive_data_sem);
+}
 
-    size_t command_length = strlen(command);
+static int stream_line(uint32_t timeout, expresslink_response_chunk_cb callback, void *user_data);
 
-    if (command[command_length - 1] != '\n') {
-        LOG_WRN("command missing newline! %s", command + command_length - 5);
+// The response line of a streamed command: the payload behind "OK " is passed on to the requester,
+// any other response (e.g. an error) is kept in response_line, like a line read by readline().
+struct response_stream {
+    expresslink_response_chunk_cb callback;
+    void *user_data;
+    size_t length; // of the status in response_line
+    bool payload;
+};
+
+static int stream_response_chunk(const char *data, size_t len, bool end_of_line, void *user_data) {
+    struct response_stream *s = user_data;
+    if (!s->payload) {
+        size_t n = MIN(len, response_line_length - 1 - s->length);
+        memcpy(response_line + s->length, data, n);
+        s->length += n;
+        response_line[s->length] = 0;
+        if (s->length < 3 || strncmp(response_line, "OK ", 3) != 0) {
+            return 0;
+        }
+        // the prefix might have been split across chunks
+        size_t offset = 3 - (s->length - n);
+        s->length = 3;
+        response_line[s->length] = 0;
+        s->payload = true;
+        data += offset;
+        len -= offset;
     }
+    return s->callback(data, len, end_of_line, s->user_data);
+}
+
+// Like readline(), but the payload of an "OK " response is not stored, so it does not have to fit into response_line.
+static char *read_streamed_response(uint32_t timeout, expresslink_response_chunk_cb callback, void *user_data) {
+    struct response_stream s = {.callback = callback, .user_data = user_data};
+    readline_error = 0;
+    response_line[0] = 0;
+    int ret = stream_line(timeout, stream_response_chunk, &s);
+    if (ret == -ETIMEDOUT || ret == -ECANCELED || ret == -EIO) {
+        readline_error = ret;
+        return NULL;
+    }
+    return response_line;
+}
 
+static bool execute_commandv(const struct expresslink_iovec *iov,
+                             size_t iovcnt,
+                             char *response,
+                             size_t response_length,
+                             uint32_t timeout,
+                             expresslink_response_chunk_cb stream,
+                             void *stream_user_data) {
+    uart_lock();
+
+    // WARNING: do not log the full command - it might be too long and crash the logging subsystem!
+
+    // the beginning of the command is gathered from the segments for logging and the timeout lookup
     const size_t max_log_cmd_length = 128;
+    char command[max_log_cmd_length];
+    size_t command_length = 0;
+    size_t head_length = 0;
+    char last = 0;
+    for (size_t i = 0; i < iovcnt; i++) {
+        if (iov[i].len == 0) {
+            continue;
+        }
+        size_t n = MIN(iov[i].len, sizeof(command) - 1 - head_length);
+        memcpy(command + head_length, iov[i].base, n);
+        head_length += n;
+        command_length += iov[i].len;
+        last = ((const char *)iov[i].base)[iov[i].len - 1];
+    }
+    command[head_length] = 0;
+
+    if (last != '\n') {
+        LOG_WRN("command missing newline! %s", command + MAX(head_length, 5) - 5);
+    }
+
     if (command_length < max_log_cmd_length) {
-        size_t len = (command[command_length - 1] != '\n') ? (command_length) : (command_length - 1);
+        size_t len = (last != '\n') ? (command_length) : (command_length - 1);
         LOG_INF("> %.*s", len, command);
     } else {
-        char log_msg[max_log_cmd_length];
-        snprintf(log_msg, sizeof(log_msg), "%s", command);
-        LOG_INF("> %s [... command too long ...]", log_msg);
+        LOG_INF("> %s [... command too long ...]", command);
     }
 
+    // "workshop" is an argument of its own, also as the last one, e.g. from `expresslink cmd`
     const char intercept_cmd[] = "AT+DIAG WIFI SCAN";
-    const char magic_arg[] = " workshop ";
-    if (strncmp(command, intercept_cmd, strlen(intercept_cmd)) == 0 && strstr(command, magic_arg) != NULL) {
+    const char magic_arg[] = " workshop";
+    const char *magic = strstr(command, magic_arg);
+    if (strncmp(command, intercept_cmd, strlen(intercept_cmd)) == 0 && magic != NULL && strchr(" \r\n", magic[strlen(magic_arg)]) != NULL) {
         if (workshop_wifi_device_location_override(response_line, response_line_length)) {
-            snprintf(response, response_length, "%s", response_line + 3);
+            if (stream != NULL) {
+                stream(response_line + 3, strlen(response_line + 3), true, stream_user_data);
+            } else {
+                snprintf(response, response_length, "%s", response_line + 3);
+            }
             LOG_INF("< %s", response_line);
-            k_mutex_unlock(&uart_expresslink_mutex);
+            uart_unlock();
             return true;
         }
     }
 
-    blocking_uart_expresslink_tx(command, command_length);
+    // the whole command is needed to serve it from the configuration cache
+    if (stream == NULL && command_length < max_log_cmd_length && expresslink_config_cache_lookup(command, response, response_length)) {
+        LOG_INF("< OK (cached)");
+        uart_unlock();
+        return true;
+    }
+
+    if (atomic_get(&sleeping)) {
+        // e.g., a shell command or the statistics report while the module sleeps between publishes
+        expresslink_wake();
+    }
+
+    if (resync_required) {
+        resynchronize();
+    } else if (atomic_cas(&cancel_requested, 1, 0)) {
+        // stale cancellation while no command was pending
+        receive_ring_reset();
+    }
+
+    struct command_descriptor *descriptor = lookup_command_descriptor(command);
+    if (timeout == 0) {
+        timeout = descriptor->timeout;
+    }
+
+    // the response can only arrive after the complete command was received by the module,
+    // so the transfer completes while we are already waiting for the response
+    uint32_t start = k_uptime_get_32();
+    uart_expresslink_txv_start(iov, iovcnt);
+
+    char *r = (stream != NULL) ? read_streamed_response(timeout, stream, stream_user_data) : readline(uart_expresslink, timeout);
+    // the caller owns the segments, the transfer has to complete before returning
+    uart_expresslink_tx_wait();
+    uint32_t latency = k_uptime_get_32() - start;
+    if (r == NULL && readline_error == -EIO) {
+        expresslink_stats_record_command(command, latency, EL_COMMAND_ERROR);
+        if (response != NULL) {
+            snprintf(response, response_length, "%s", "ERR OVERRUN");
+        }
+        uart_unlock();
+        return false;
+    }
+    if (r == NULL) {
+        descriptor->timeout_count++;
+        expresslink_stats_record_command(command, latency, EL_COMMAND_TIMEOUT);
+        LOG_WRN("No response after %u ms: %.*s", timeout, (int)MIN(strcspn(command, "\n"), 32), command);
+        if (response != NULL) {
+            snprintf(response, response_length, "%s", "ERR TIMEOUT");
+        }
+        uart_unlock();
+        return false;
+    }
 
-    char *r = readline(uart_expresslink);
+    if (stream == NULL && command_length < max_log_cmd_length) {
+        expresslink_config_cache_update(command, r);
+    }
 
     const char always_log_response_cmd[] = "AT+CONF? ";
     const size_t max_log_response_length = 62;
@@ -223,6 +651,8 @@ bool expresslink_send_command(const char *command, char *response, size_t respon
         // OK1 Some Message
         // And one additional line
         success = true;
+        k_sem_reset(&response_line_consumed_sem);
+        atomic_set(&pending_response_lines, atoi(r + 2));
         if (response != NULL) {
             snprintf(response, response_length, "%s", r + 2);
         }
@@ -232,38 +662,269 @@ bool expresslink_send_command(const char *command, char *response, size_t respon
             snprintf(response, response_length, "%s", r);
         }
     }
+    expresslink_stats_record_command(command, latency, success ? EL_COMMAND_OK : EL_COMMAND_ERROR);
 
-    k_mutex_unlock(&uart_expresslink_mutex);
+    uart_unlock();
     return success;
 }
 
 int expresslink_read_response_line(char *buffer, size_t buffer_length) {
-    char *r = readline(uart_expresslink);
+    uart_lock();
+    char *r = readline(uart_expresslink, RESPONSE_LINE_TIMEOUT);
+    if (r == NULL) {
+        *buffer = 0;
+        uart_unlock();
+        return readline_error;
+    }
     snprintf(buffer, buffer_length, "%s", r);
+    if (atomic_get(&pending_response_lines) > 0) {
+        atomic_dec(&pending_response_lines);
+        k_sem_give(&response_line_consumed_sem);
+    }
+    uart_unlock();
     return 0;
 }
 
+// Passes one response line to the callback directly from the RX ring, in as many chunks as it takes.
+// Chunks are handed out as soon as they arrive, so the line does not have to fit into the ring buffer.
+// Waits up to timeout (in milliseconds) for the line to start, and up to RESPONSE_LINE_TIMEOUT for each further chunk.
+static int stream_line(uint32_t timeout, expresslink_response_chunk_cb callback, void *user_data) {
+    bool pending_cr = false;
+    int result = 0;
+    uint32_t line_start = rx_get_offset;
+
+    while (true) {
+        if (atomic_cas(&cancel_requested, 1, 0)) {
+            LOG_WRN("UART read cancelled!");
+            receive_ring_reset();
+            resync_required = true;
+            return -ECANCELED;
+        }
+
+        uint8_t *data;
+        size_t len = ring_buf_get_claim(&receive_ring, &data, CONFIG_EXPRESSLINK_RX_RING_SIZE);
+        if (len == 0) {
+            if (k_sem_take(&receive_data_sem, K_MSEC(timeout)) != 0) {
+                LOG_WRN("UART timeout!");
+                receive_ring_reset();
+                resync_required = true;
+                return -ETIMEDOUT;
+            }
+            continue;
+        }
+
+        uint8_t *eol = memchr(data, '\n', len);
+        size_t chunk_length = (eol != NULL) ? (eol - data) : len;
+
+        // a carriage return is only stripped if it ends the line, which might be in the next chunk
+        if (pending_cr && chunk_length > 0 && callback != NULL) {
+            callback("\r", 1, false, user_data);
+        }
+        pending_cr = (chunk_length > 0 && data[chunk_length - 1] == '\r');
+        size_t payload_length = pending_cr ? (chunk_length - 1) : chunk_length;
+
+        if (callback != NULL && (payload_length > 0 || eol != NULL)) {
+            result = callback((const char *)data, payload_length, eol != NULL, user_data);
+            if (result != 0) {
+                // the caller is not interested in the rest of the line
+                callback = NULL;
+            }
+        }
+
+        if (eol != NULL) {
+            receive_ring_consume(chunk_length + 1);
+            // the line ending was counted by receive_ring_put()
+            k_sem_take(&receive_line_sem, K_NO_WAIT);
+            if (receive_ring_gap(line_start, rx_get_offset - 1)) {
+                // the chunks were already passed on, the caller has to drop what it received
+                receive_overrun_detected();
+                return -EIO;
+            }
+            return result;
+        }
+        receive_ring_consume(len);
+        timeout = RESPONSE_LINE_TIMEOUT;
+    }
+}
+
+int expresslink_stream_response_lines(size_t lines, expresslink_response_chunk_cb callback, void *user_data) {
+    uart_lock();
+    int ret = 0;
+    for (size_t i = 0; i < lines; i++) {
+        int r = stream_line(RESPONSE_LINE_TIMEOUT, ret == 0 ? callback : NULL, user_data);
+        if (r == -ETIMEDOUT || r == -ECANCELED || r == -EIO) {
+            ret = r;
+            break;
+        }
+        if (ret == 0) {
+            ret = r;
+        }
+        if (atomic_get(&pending_response_lines) > 0) {
+            atomic_dec(&pending_response_lines);
+            k_sem_give(&response_line_consumed_sem);
+        }
+    }
+    uart_unlock();
+    return ret;
+}
+
+static void discard_pending_response_lines(k_timeout_t timeout) {
+    // give the requester a chance to read the additional lines, as long as it keeps making progress
+    while (atomic_get(&pending_response_lines) > 0) {
+        if (k_sem_take(&response_line_consumed_sem, timeout) != 0) {
+            break;
+        }
+    }
+
+    uart_lock();
+    if (atomic_get(&pending_response_lines) > 0) {
+        LOG_WRN("Discarding %d unread response lines.", (int)atomic_get(&pending_response_lines));
+    }
+    while (atomic_get(&pending_response_lines) > 0) {
+        // lines are discarded straight from the ring, they might not fit into the line buffer
+        if (stream_line(RESPONSE_LINE_TIMEOUT, NULL, NULL) != 0) {
+            break;
+        }
+        atomic_dec(&pending_response_lines);
+    }
+    uart_unlock();
+}
+
+static void expresslink_io_loop(void *dummy0, void *dummy1, void *dummy2) {
+    while (true) {
+        struct expresslink_request *request;
+        k_msgq_get(&expresslink_request_msgq, &request, K_FOREVER);
+
+        const struct expresslink_iovec *iov = request->iov;
+        size_t iovcnt = request->iovcnt;
+        struct expresslink_iovec command_iov;
+        if (iov == NULL) {
+            command_iov = (struct expresslink_iovec){request->command, strlen(request->command)};
+            iov = &command_iov;
+            iovcnt = 1;
+        }
+        bool success = execute_commandv(iov, iovcnt, request->response, request->response_length, request->timeout, request->stream, request->user_data);
+
+        struct k_sem *done = request->done;
+        if (done != NULL) {
+            // synchronous requester: the request lives on its stack and must not be accessed after signalling
+            bool read_response_lines = request->read_response_lines;
+            request->success = success;
+            k_sem_give(done);
+            discard_pending_response_lines(read_response_lines ? K_MSEC(PENDING_RESPONSE_LINE_TIMEOUT) : K_NO_WAIT);
+        } else {
+            request->success = success;
+            request->pending = false;
+            if (request->callback != NULL) {
+                request->callback(request);
+            }
+            // the callback is expected to read all additional lines it is interested in
+            discard_pending_response_lines(K_NO_WAIT);
+        }
+    }
+}
+
+int expresslink_submit(struct expresslink_request *request) {
+    if (request->pending) {
+        return -EBUSY;
+    }
+
+    request->pending = true;
+    request->success = false;
+    request->done = NULL;
+
+    int ret = k_msgq_put(&expresslink_request_msgq, &request, K_NO_WAIT);
+    if (ret != 0) {
+        const char *command = (request->iov != NULL) ? request->iov[0].base : request->command;
+        LOG_WRN("ExpressLink request queue full, dropping: %.*s", (int)MIN(strcspn(command, "\n"), 32), command);
+        request->pending = false;
+    }
+    return ret;
+}
+
+static bool send_commandv(const struct expresslink_iovec *iov,
+                          size_t iovcnt,
+                          char *response,
+                          size_t response_length,
+                          expresslink_response_chunk_cb stream,
+                          void *stream_user_data,
+                          bool read_response_lines) {
+    // the I/O thread itself (e.g. from a completion callback), and threads which already own the UART
+    // (e.g. during an OTW update) cannot wait for the I/O thread and execute the command directly
+    k_tid_t current = k_current_get();
+    if (expresslink_io_task_id == NULL || current == expresslink_io_task_id || uart_owner == current) {
+        bool success = execute_commandv(iov, iovcnt, response, response_length, 0, stream, stream_user_data);
+        if (!read_response_lines) {
+            discard_pending_response_lines(K_NO_WAIT);
+        }
+        return success;
+    }
+
+    struct k_sem done;
+    k_sem_init(&done, 0, 1);
+
+    struct expresslink_request request = {
+        .iov = iov,
+        .iovcnt = iovcnt,
+        .response = response,
+        .response_length = response_length,
+        .stream = stream,
+        .user_data = stream_user_data,
+        .pending = true,
+        .done = &done,
+        .read_response_lines = read_response_lines,
+    };
+    struct expresslink_request *request_ptr = &request;
+
+    k_msgq_put(&expresslink_request_msgq, &request_ptr, K_FOREVER);
+    k_sem_take(&done, K_FOREVER);
+
+    return request.success;
+}
+
+bool expresslink_send_commandv(const struct expresslink_iovec *iov, size_t iovcnt, char *response, size_t response_length) {
+    return send_commandv(iov, iovcnt, response, response_length, NULL, NULL, false);
+}
+
+bool expresslink_send_command(const char *command, char *response, size_t response_length) {
+    struct expresslink_iovec iov = {command, strlen(command)};
+    return send_commandv(&iov, 1, response, response_length, NULL, NULL, false);
+}
+
+bool expresslink_send_command_multiline(const char *command, char *response, size_t response_length) {
+    struct expresslink_iovec iov = {command, strlen(command)};
+    return send_commandv(&iov, 1, response, response_length, NULL, NULL, true);
+}
+
+bool expresslink_send_command_streamed(const char *command, char *response, size_t response_length, expresslink_response_chunk_cb callback, void *user_data) {
+    struct expresslink_iovec iov = {command, strlen(command)};
+    return send_commandv(&iov, 1, response, response_length, callback, user_data, false);
+}
+
 void event_interrupt_cb_handler(const struct device *dev, struct gpio_callback *cb, uint32_t pins) {
     LOG_DBG("EVENT interrupt triggered!");
+    expresslink_event_notify();
 }
 
-static int init_buffers() {
-    recv_buf0 = k_malloc(RECV_BUF_LENGTH);
-    if (recv_buf0 == NULL) {
-        LOG_ERR("k_malloc failed for recv_buf0!");
-        return -1;
+char *expresslink_buffer_alloc(k_timeout_t timeout) {
+    void *buffer;
+    if (k_mem_slab_alloc(&buffer_slab, &buffer, timeout) != 0) {
+        atomic_inc(&buffer_alloc_failures);
+        return NULL;
     }
-    recv_buf1 = k_malloc(RECV_BUF_LENGTH);
-    if (recv_buf1 == NULL) {
-        LOG_ERR("k_malloc failed recv_buf1!");
-        return -1;
+
+    atomic_val_t used = k_mem_slab_num_used_get(&buffer_slab);
+    atomic_val_t max = atomic_get(&buffers_max_used);
+    while (used > max && !atomic_cas(&buffers_max_used, max, used)) {
+        max = atomic_get(&buffers_max_used);
     }
-    response_line = k_malloc(response_line_length);
-    if (response_line == NULL) {
-        LOG_ERR("k_malloc failed response_line!");
-        return -1;
+    return buffer;
+}
+
+void expresslink_buffer_free(char *buffer) {
+    if (buffer != NULL) {
+        k_mem_slab_free(&buffer_slab, (void *)buffer);
     }
-    return 0;
 }
 
 static int init_uart() {
@@ -335,11 +996,6 @@ static int init_event_interrupt() {
 
 int init_expresslink(void) {
     int ret;
-    ret = init_buffers();
-    if (ret != 0) {
-        return ret;
-    }
-
     ret = init_uart();
     if (ret != 0) {
         return ret;
@@ -350,11 +1006,34 @@ int init_expresslink(void) {
         return ret;
     }
 
+    expresslink_io_task_id = k_thread_create(
+        &expresslink_io_task,
+        expresslink_io_task_stack,
+        K_THREAD_STACK_SIZEOF(expresslink_io_task_stack),
+        expresslink_io_loop,
+        NULL,
+        NULL,
+        NULL,
+        expresslink_io_TASK_PRIORITY,
+        0,
+        K_NO_WAIT);
+    k_thread_name_set(&expresslink_io_task, "expresslink_io_task");
+
     expresslink_reset();
     expresslink_wake();
 
     expresslink_send_command("AT+EVENT?\n", NULL, 0); // read in the STARTUP event to get rid of EVENT LED
 
+    ret = init_expresslink_events();
+    if (ret != 0) {
+        return ret;
+    }
+
+    ret = init_expresslink_stats();
+    if (ret != 0) {
+        return ret;
+    }
+
     ret = init_event_interrupt();
     if (ret != 0) {
         return ret;
@@ -410,7 +1089,7 @@ int expresslink_over_the_wire_update(const char *path, const char *expected_vers
     lv_label_set_text(message_label, "ExpressLink firmware\nupdate in progress...");
     display_handler_async();
 
-    k_mutex_lock(&uart_expresslink_mutex, K_FOREVER);
+    uart_lock();
 
     LOG_INF("Current ExpressLink information before update:");
     expresslink_send_command("AT+CONF? About\n", NULL, 0);
@@ -418,27 +1097,34 @@ int expresslink_over_the_wire_update(const char *path, const char *expected_vers
     expresslink_send_command("AT+CONF? TechSpec\n", NULL, 0);
 
     size_t block_size = 2048;
-    size_t buf_size = 128;
-    uint8_t *buf = k_malloc(buf_size);
+    // double buffered: the next chunk is read from the file while the previous one is being transmitted,
+    // static as the transfer outlives a chunk, and only one update runs at a time while holding the UART
+    static uint8_t buf[2][128];
+    size_t tx_buf_id = 0;
 
-    snprintf(buf, buf_size, "AT+OTW %u,%u\n", dirent.size, block_size);
-    expresslink_send_command(buf, NULL, 0);
+    char command[32];
+    snprintf(command, sizeof(command), "AT+OTW %u,%u\n", dirent.size, block_size);
+    expresslink_send_command(command, NULL, 0);
 
     size_t count = 0;
     while (true) {
-        size_t read = fs_read(&file, buf, buf_size);
+        tx_buf_id ^= 1;
+        uint8_t *tx_buf = buf[tx_buf_id];
+        size_t read = fs_read(&file, tx_buf, sizeof(buf[0]));
         if (read == 0) {
             // end of file reached
             break;
         }
         count += read;
 
-        blocking_uart_expresslink_tx(buf, read);
+        struct expresslink_iovec iov = {tx_buf, read};
+        uart_expresslink_txv_start(&iov, 1);
 
         if (count % block_size == 0) {
-            char *r = readline(uart_expresslink);
-            if (strncmp(r, "OK", 2) != 0) {
-                LOG_ERR("ExpressLink firmeware update failed - unexpected response: %s", r);
+            uart_expresslink_tx_wait();
+            char *r = readline(uart_expresslink, 10000);
+            if (r == NULL || strncmp(r, "OK", 2) != 0) {
+                LOG_ERR("ExpressLink firmeware update failed - unexpected response: %s", (r != NULL) ? r : "(none)");
                 ret = -1;
                 goto cleanup;
             }
@@ -466,12 +1152,13 @@ int expresslink_over_the_wire_update(const char *path, const char *expected_vers
             }
         }
     }
+    uart_expresslink_tx_wait();
     k_msleep(500);
 
-    char *r = readline(uart_expresslink);
+    char *r = readline(uart_expresslink, COMMAND_MAX_TIMEOUT);
     const char *completion_msg = "OK COMPLETE";
-    if (strncmp(r, completion_msg, strlen(completion_msg)) != 0) {
-        LOG_ERR("ExpressLink firmeware update failed - unexpected response: %s", r);
+    if (r == NULL || strncmp(r, completion_msg, strlen(completion_msg)) != 0) {
+        LOG_ERR("ExpressLink firmeware update failed - unexpected response: %s", (r != NULL) ? r : "(none)");
         ret = -1;
         goto cleanup;
     }
@@ -500,15 +1187,26 @@ cleanup:
     display_handler();
 
     fs_close(&file);
-    k_mutex_unlock(&uart_expresslink_mutex);
+    uart_unlock();
     return ret;
 }
 
+static void record_wake(void) {
+    k_spinlock_key_t key = k_spin_lock(&sleep_lock);
+    if (atomic_cas(&sleeping, 1, 0)) {
+        int64_t now = k_uptime_get();
+        expresslink_stats_record_wake((uint32_t)(now - sleeping_since));
+        awake_since = now;
+    }
+    k_spin_unlock(&sleep_lock, key);
+}
+
 void expresslink_reset() {
     gpio_pin_set_dt(&expresslink_reset_pin, 0); // active LOW
     k_msleep(50);
-    ring_buf_reset(&receive_ring);
+    receive_ring_reset();
     gpio_pin_set_dt(&expresslink_reset_pin, 1);
+    record_wake();
     k_msleep(EXPRESSLINK_RESET_TIME); // give it time to boot up
 }
 
@@ -516,6 +1214,56 @@ void expresslink_wake() {
     gpio_pin_set_dt(&expresslink_wake_pin, 0); // active LOW
     k_msleep(50);
     gpio_pin_set_dt(&expresslink_wake_pin, 1);
+    record_wake();
+}
+
+bool expresslink_sleep(uint8_t mode, uint32_t duration) {
+    char cmd[32];
+    snprintf(cmd, sizeof(cmd), "AT+SLEEP%u %u\n", mode, duration);
+
+    // no other command may be sent between AT+SLEEP and marking the module as sleeping
+    uart_lock();
+    bool success = expresslink_send_command(cmd, NULL, 0);
+    if (success) {
+        k_spinlock_key_t key = k_spin_lock(&sleep_lock);
+        int64_t now = k_uptime_get();
+        if (awake_since >= 0) {
+            expresslink_stats_record_sleep((uint32_t)(now - awake_since));
+        }
+        sleeping_since = now;
+        atomic_set(&sleeping, 1);
+        k_spin_unlock(&sleep_lock, key);
+    }
+    uart_unlock();
+    return success;
+}
+
+bool expresslink_is_sleeping(void) {
+    return atomic_get(&sleeping) != 0;
+}
+
+struct certificate_export {
+    const struct shell *sh;
+    struct fs_file_t *file;
+};
+
+static int write_certificate_chunk(const char *data, size_t len, bool end_of_line, void *user_data) {
+    struct certificate_export *export = user_data;
+
+    shell_fprintf(export->sh, SHELL_VT100_COLOR_DEFAULT, "%.*s%s", (int)len, data, end_of_line ? "\n" : "");
+    int ret = fs_write(export->file, data, len);
+    if (ret < 0) {
+        LOG_WRN("fs_write failed: %d", ret);
+        return ret;
+    }
+    if (end_of_line) {
+        ret = fs_write(export->file, "\r\n", 2); // be nice to Windows users
+        if (ret < 0) {
+            LOG_WRN("fs_write failed: %d", ret);
+            return ret;
+        }
+    }
+    return 0;
 }
 
 int expresslink_export_certificate(const struct shell *sh, size_t argc, char **argv, bool force_write) {
@@ -547,24 +1295,16 @@ int expresslink_export_certificate(const struct shell *sh, size_t argc, char **a
         return -1;
     }
 
-    const size_t expresslink_response_length = 80; // fits at least PEM-formatted certificate line
-    char expresslink_response[expresslink_response_length];
-    bool success = expresslink_send_command("AT+CONF? Certificate pem\n", expresslink_response, expresslink_response_length);
+    char expresslink_response[16];
+    bool success = expresslink_send_command_multiline("AT+CONF? Certificate pem\n", expresslink_response, sizeof(expresslink_response));
     if (success && isdigit((int)expresslink_response[0])) {
+        struct certificate_export export = {.sh = sh, .file = &file};
         size_t additional_lines = atoi(expresslink_response);
-        for (size_t i = 0; i < additional_lines; i++) {
-            expresslink_read_response_line(expresslink_response, expresslink_response_length);
-            shell_print(sh, "%s", expresslink_response);
-            ret = fs_write(&file, expresslink_response, strlen(expresslink_response));
-            if (ret < 0) {
-                LOG_WRN("fs_write failed: %d", ret);
-                return -1;
-            }
-            ret = fs_write(&file, "\r\n", 2); // be nice to Windows users
-            if (ret < 0) {
-                LOG_WRN("fs_write failed: %d", ret);
-                return -1;
-            }
+        ret = expresslink_stream_response_lines(additional_lines, write_certificate_chunk, &export);
+        if (ret != 0) {
+            LOG_WRN("Certificate export failed: %d", ret);
+            fs_close(&file);
+            return -1;
         }
     }
 
@@ -576,88 +1316,190 @@ int expresslink_export_certificate(const struct shell *sh, size_t argc, char **a
     return 0;
 }
 
-static int cmd_cmd(const struct shell *sh, size_t argc, char **argv) {
-    k_mutex_lock(&uart_expresslink_mutex, K_FOREVER);
+static int print_response_chunk(const char *data, size_t len, bool end_of_line, void *user_data) {
+    const struct shell *sh = user_data;
+    shell_fprintf(sh, SHELL_VT100_COLOR_DEFAULT, "%.*s%s", (int)len, data, end_of_line ? "\n" : "");
+    return 0;
+}
 
-    // expresslink cmd AT+DIAG WIFI SCAN
-    if (argc >= 5 && strcmp(argv[1], "AT+DIAG") == 0 && strcmp(argv[2], "WIFI") == 0 && strcmp(argv[3], "SCAN") == 0 && strcmp(argv[4], "workshop") == 0) {
-        if (workshop_wifi_device_location_override(response_line, RECV_BUF_LENGTH)) {
-            shell_print(sh, "%s", response_line);
-            k_mutex_unlock(&uart_expresslink_mutex);
-            return 0;
-        }
+// the first response line of `expresslink cmd`
+struct shell_response {
+    const struct shell *sh;
+    bool payload; // the payload of an "OK " response is being printed
+};
+
+static int print_response_payload(const char *data, size_t len, bool end_of_line, void *user_data) {
+    struct shell_response *r = user_data;
+    if (!r->payload) {
+        shell_fprintf(r->sh, SHELL_VT100_COLOR_DEFAULT, "OK ");
+        r->payload = true;
     }
+    return print_response_chunk(data, len, end_of_line, (void *)r->sh);
+}
 
+static int cmd_cmd(const struct shell *sh, size_t argc, char **argv) {
     // skip argv[0] as it just contains the "cmd" command name
-    for (size_t i = 1; i < argc; i++) {
-        blocking_uart_expresslink_tx(argv[i], strlen(argv[i]));
+    struct expresslink_iovec iov[TX_MAX_SEGMENTS];
+    size_t iovcnt = 0;
+    for (size_t i = 1; i < argc && iovcnt + 2 <= ARRAY_SIZE(iov); i++) {
+        iov[iovcnt++] = (struct expresslink_iovec){argv[i], strlen(argv[i])};
 
         bool eol_or_space = (i + 1 < argc);
-        blocking_uart_expresslink_tx(eol_or_space ? " " : "\n", 1);
+        iov[iovcnt++] = (struct expresslink_iovec){eol_or_space ? " " : "\n", 1};
     }
-    char *response = readline(uart_expresslink);
-    shell_print(sh, "%s", response);
 
-    if (strncmp(response, "OK", 2) == 0 && isdigit((int)response[2])) {
-        size_t additional_lines = atoi(response + 2);
-        for (size_t i = 0; i < additional_lines; i++) {
-            char *response = readline(uart_expresslink);
-            shell_print(sh, "%s", response);
-        }
+    // executed like any other command: the module is woken up, resynchronized after a timeout and the command is
+    // counted in the statistics; the payload of an "OK " response is printed while it arrives
+    char response[128];
+    struct shell_response r = {.sh = sh};
+    bool success = send_commandv(iov, iovcnt, response, sizeof(response), print_response_payload, &r, true);
+
+    // raw commands might change the configuration behind the cache's back
+    if (strcmp(argv[1], "AT+CONF") == 0 || strcmp(argv[1], "AT+FACTORY_RESET") == 0 || strncmp(argv[1], "AT+OTW", 6) == 0) {
+        uart_lock();
+        expresslink_config_cache_invalidate();
+        uart_unlock();
     }
 
-    k_mutex_unlock(&uart_expresslink_mutex);
+    if (r.payload) {
+        return 0;
+    }
+    if (!success) {
+        shell_print(sh, "%s", response);
+        return (strcmp(response, "ERR TIMEOUT") == 0) ? -ETIMEDOUT : 0;
+    }
+    // "OK" or "OK2 ..." without the prefix
+    shell_print(sh, "OK%s", response);
+    if (isdigit((int)response[0])) {
+        expresslink_stream_response_lines(atoi(response), print_response_chunk, (void *)sh);
+    }
     return 0;
 }
 
+// the exit command is matched across chunks, as the shell hands over the input in small pieces
+static const char passthrough_exit_cmd[] = "AT+EXIT";
+static size_t passthrough_exit_state = 0;
+
+// shell input is copied into alternating buffers, so the next chunk can be received while the previous one is transmitted
+#define PASSTHROUGH_TX_BUF_LENGTH (64)
+static uint8_t passthrough_tx_buf[2][PASSTHROUGH_TX_BUF_LENGTH];
+static uint8_t passthrough_tx_buf_id = 0;
+
+static atomic_t passthrough_running = ATOMIC_INIT(0);
+static int64_t passthrough_started_at = 0;
+static uint32_t passthrough_bytes_rx = 0;
+static uint32_t passthrough_bytes_tx = 0;
+
+static void passthrough_exit(const struct shell *sh) {
+    shell_set_bypass(sh, NULL);
+
+    atomic_clear(&passthrough_running);
+    k_sem_give(&receive_data_sem);
+    if (k_thread_join(&passthrough_task, K_MSEC(1000)) != 0) {
+        k_thread_abort(&passthrough_task);
+    }
+    uart_expresslink_tx_wait();
+    receive_ring_reset();
+    passthrough_shell = NULL;
+
+    uint32_t duration = MAX(1, (uint32_t)(k_uptime_get() - passthrough_started_at));
+    shell_print(sh, "\n\nExiting Passthrough mode. Normal shell functionality restored.");
+    shell_print(sh, "Received %u bytes (%u bytes/s), sent %u bytes (%u bytes/s) in %u.%03u s.",
+                passthrough_bytes_rx,
+                (uint32_t)((uint64_t)passthrough_bytes_rx * 1000 / duration),
+                passthrough_bytes_tx,
+                (uint32_t)((uint64_t)passthrough_bytes_tx * 1000 / duration),
+                duration / 1000,
+                duration % 1000);
+    uart_unlock();
+}
+
+// writes straight to the shell transport, unlike shell_fprintf() "%.*s" this does not stop at a NUL byte of binary data
+static void passthrough_write(const struct shell *sh, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        size_t written = 0;
+        if (sh->iface->api->write(sh->iface, p, len, &written) != 0) {
+            return;
+        }
+        if (written == 0) {
+            // the transport's TX buffer is full
+            k_msleep(1);
+        }
+        p += written;
+        len -= written;
+    }
+}
+
+static void passthrough_echo(const struct shell *sh, const uint8_t *data, size_t len) {
+    // echo in spans, only carriage returns need to be expanded
+    while (len > 0) {
+        const uint8_t *cr = memchr(data, '\r', len);
+        size_t span = (cr != NULL) ? (cr - data) : len;
+        passthrough_write(sh, data, span);
+        if (cr == NULL) {
+            break;
+        }
+        passthrough_write(sh, "\r\n", 2);
+        data += span + 1;
+        len -= span + 1;
+    }
+}
+
 static void bypass_cb(const struct shell *sh, uint8_t *data, size_t len) {
     if (passthrough_local_echo) {
-        for (size_t i = 0; i < len; i++) {
-            uint8_t d = data[i];
-            if (d == '\r') {
-                shell_fprintf(sh, SHELL_VT100_COLOR_DEFAULT, "\r\n");
-            } else {
-                shell_fprintf(sh, SHELL_VT100_COLOR_DEFAULT, "%c", d);
-            }
-        }
+        passthrough_echo(sh, data, len);
     }
 
-    const char *exit_cmd = "AT+EXIT";
-    static uint8_t exit_command_state = 0;
+    const size_t exit_cmd_length = sizeof(passthrough_exit_cmd) - 1;
     for (size_t i = 0; i < len; i++) {
-        if (exit_command_state == strlen(exit_cmd) && (data[i] == '\r' || data[i] == '\n')) {
-            shell_set_bypass(sh, NULL);
-            k_thread_abort(&passthrough_task);
-            ring_buf_reset(&receive_ring);
-            passthrough_shell = NULL;
-            shell_print(sh, "\n\nExiting Passthrough mode. Normal shell functionality restored.");
-            k_mutex_unlock(&uart_expresslink_mutex);
+        if (passthrough_exit_state == exit_cmd_length && (data[i] == '\r' || data[i] == '\n')) {
+            passthrough_exit(sh);
             return;
-        } else if (data[i] == exit_cmd[exit_command_state]) {
-            exit_command_state++;
+        } else if (passthrough_exit_state < exit_cmd_length && data[i] == passthrough_exit_cmd[passthrough_exit_state]) {
+            passthrough_exit_state++;
         } else {
-            exit_command_state = 0;
+            // "AT+EXIT" has no repeating prefix, so a mismatch can only restart the match at the current character
+            passthrough_exit_state = (data[i] == passthrough_exit_cmd[0]) ? 1 : 0;
         }
     }
 
-    // send data to ExpressLink
-    blocking_uart_expresslink_tx(data, len);
+    // send data to ExpressLink, without waiting for the transfer to complete
+    while (len > 0) {
+        size_t n = MIN(len, PASSTHROUGH_TX_BUF_LENGTH);
+        // the previous chunk might still be transmitted from the other buffer,
+        // uart_expresslink_txv_start() waits for it to complete before starting the next transfer
+        uint8_t *buf = passthrough_tx_buf[passthrough_tx_buf_id];
+        passthrough_tx_buf_id ^= 1;
+        memcpy(buf, data, n);
+
+        struct expresslink_iovec iov = {buf, n};
+        uart_expresslink_txv_start(&iov, 1);
+        passthrough_bytes_tx += n;
+        data += n;
+        len -= n;
+    }
 }
 
 void passthrough_rx_loop(void *context, void *dummy1, void *dummy2) {
-    while (true) {
-        char c;
-        if (ring_buf_get(&receive_ring, &c, 1) != 1) {
-            k_msleep(1);
+    while (atomic_get(&passthrough_running)) {
+        uint8_t *data;
+        size_t len = ring_buf_get_claim(&receive_ring, &data, CONFIG_EXPRESSLINK_RX_RING_SIZE);
+        if (len == 0) {
+            // woken up by uart_cb for every received chunk
+            k_sem_take(&receive_data_sem, K_FOREVER);
             continue;
         }
-        shell_fprintf(passthrough_shell, SHELL_VT100_COLOR_DEFAULT, "%c", c);
+
+        // forward the whole contiguous span in a single transport write
+        passthrough_write(passthrough_shell, data, len);
+        receive_ring_consume(len);
+        passthrough_bytes_rx += len;
     }
-    LOG_WRN("passthrough rx loop ended.");
 }
 
 static int cmd_passthrough(const struct shell *sh, size_t argc, char **argv) {
-    k_mutex_lock(&uart_expresslink_mutex, K_FOREVER);
+    uart_lock();
 
     shell_print(sh, "Entering UART Passthrough mode for ExpressLink! Type `AT+EXIT<Enter>` to restore normal shell functionality.");
     if (argc == 2 && shell_check_arg_falsy(argv[1])) {
@@ -668,6 +1510,12 @@ static int cmd_passthrough(const struct shell *sh, size_t argc, char **argv) {
         shell_print(sh, "Local input will be echoed.");
     }
 
+    passthrough_exit_state = 0;
+    passthrough_bytes_rx = 0;
+    passthrough_bytes_tx = 0;
+    passthrough_started_at = k_uptime_get();
+    atomic_set(&passthrough_running, 1);
+
     passthrough_shell = sh;
     shell_set_bypass(sh, bypass_cb);
 
@@ -758,6 +1606,106 @@ static int cmd_update(const struct shell *sh, size_t argc, char **argv) {
     return 0;
 }
 
+static int cmd_cancel(const struct shell *sh, size_t argc, char **argv) {
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    expresslink_cancel();
+
+    shell_print(sh, "ExpressLink command cancelled.");
+    return 0;
+}
+
+static int cmd_timeouts(const struct shell *sh, size_t argc, char **argv) {
+    bool reset = (argc == 2 && strcmp(argv[1], "reset") == 0);
+
+    shell_print(sh, "%-20s %10s %10s", "command", "timeout", "count");
+    for (size_t i = 0; i < ARRAY_SIZE(command_descriptors); i++) {
+        struct command_descriptor *d = &command_descriptors[i];
+        shell_print(sh, "%-20s %8u ms %10u", d->prefix[0] ? d->prefix : "(other)", d->timeout, d->timeout_count);
+        if (reset) {
+            d->timeout_count = 0;
+        }
+    }
+    return 0;
+}
+
+static int cmd_stats(const struct shell *sh, size_t argc, char **argv) {
+    expresslink_stats_print(sh);
+
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        expresslink_stats_reset();
+        shell_print(sh, "ExpressLink statistics reset.");
+    }
+    return 0;
+}
+
+static int cmd_config_cache(const struct shell *sh, size_t argc, char **argv) {
+    uart_lock();
+    expresslink_config_cache_print(sh);
+    if (argc == 2 && strcmp(argv[1], "clear") == 0) {
+        expresslink_config_cache_invalidate();
+    }
+    uart_unlock();
+    return 0;
+}
+
+static int cmd_connection(const struct shell *sh, size_t argc, char **argv) {
+    mqtt_connection_print_status(sh);
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        mqtt_connection_reset_stats();
+        shell_print(sh, "Connection statistics reset.");
+    }
+    return 0;
+}
+
+static int cmd_publish(const struct shell *sh, size_t argc, char **argv) {
+    mqtt_publish_print_stats(sh);
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        mqtt_publish_reset_stats();
+        shell_print(sh, "Publish statistics reset.");
+    }
+    return 0;
+}
+
+static int cmd_queue(const struct shell *sh, size_t argc, char **argv) {
+    mqtt_queue_print_stats(sh);
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        mqtt_queue_reset_stats();
+        shell_print(sh, "Queue statistics reset.");
+    }
+    return 0;
+}
+
+static int cmd_journal(const struct shell *sh, size_t argc, char **argv) {
+    mqtt_journal_print_stats(sh);
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        mqtt_journal_reset_stats();
+        shell_print(sh, "Journal statistics reset.");
+    }
+    return 0;
+}
+
+static int cmd_memory(const struct shell *sh, size_t argc, char **argv) {
+    shell_print(sh, "receive ring: %u bytes, DMA buffers: 2 x %u bytes, response line: %u bytes",
+                CONFIG_EXPRESSLINK_RX_RING_SIZE,
+                RECV_BUF_LENGTH,
+                RESPONSE_LINE_LENGTH);
+    shell_print(sh, "buffer pool: %u x %u bytes, in use: %u, max in use: %u, failed allocations: %u",
+                CONFIG_EXPRESSLINK_BUFFER_COUNT,
+                CONFIG_EXPRESSLINK_BUFFER_SIZE,
+                k_mem_slab_num_used_get(&buffer_slab),
+                (uint32_t)atomic_get(&buffers_max_used),
+                (uint32_t)atomic_get(&buffer_alloc_failures));
+    shell_print(sh, "total: %u bytes (budget: %u bytes)", EXPRESSLINK_MEMORY_TOTAL, CONFIG_EXPRESSLINK_MEMORY_BUDGET);
+    if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+        atomic_set(&buffers_max_used, k_mem_slab_num_used_get(&buffer_slab));
+        atomic_clear(&buffer_alloc_failures);
+        shell_print(sh, "Buffer pool statistics reset.");
+    }
+    return 0;
+}
+
 static int cmd_export_certificate(const struct shell *sh, size_t argc, char **argv) {
     return expresslink_export_certificate(sh, argc, argv, true);
 }
@@ -770,6 +1718,15 @@ SHELL_STATIC_SUBCMD_SET_CREATE(sub_expresslink,
 	SHELL_CMD_ARG(debug, NULL, "Set ExpressLink debug logging (0/1 or false/true)", cmd_debug, 2, 0),
 	SHELL_CMD_ARG(info, NULL, "Get ExpressLink module info", cmd_get_info, 1, 0),
 	SHELL_CMD_ARG(update, NULL, "Over-The-Wire update of ExpressLink firmware file, e.g., `v2.4.4.bin`", cmd_update, 2, 0),
+	SHELL_CMD_ARG(cancel, NULL, "Cancel the ExpressLink command that is waiting for a response", cmd_cancel, 1, 0),
+	SHELL_CMD_ARG(timeouts, NULL, "Show response timeouts and timeout counts per AT command (pass `reset` to clear the counts)", cmd_timeouts, 1, 1),
+	SHELL_CMD_ARG(stats, NULL, "Show ExpressLink command latencies, error counts and UART throughput (pass `reset` to clear them)", cmd_stats, 1, 1),
+	SHELL_CMD_ARG(config_cache, NULL, "Show the cached ExpressLink configuration (pass `clear` to clear the cache)", cmd_config_cache, 1, 1),
+	SHELL_CMD_ARG(connection, NULL, "Show the shared MQTT connection state, connect attempts and times (pass `reset` to clear the counters)", cmd_connection, 1, 1),
+	SHELL_CMD_ARG(publish, NULL, "Show in-flight messages, PUBACK latency and retransmissions (pass `reset` to clear the counters)", cmd_publish, 1, 1),
+	SHELL_CMD_ARG(queue, NULL, "Show the outbound publish queue depth, high-water mark and drops (pass `reset` to clear the counters)", cmd_queue, 1, 1),
+	SHELL_CMD_ARG(journal, NULL, "Show the offline journal segments, journaled and replayed messages (pass `reset` to clear the counters)", cmd_journal, 1, 1),
+	SHELL_CMD_ARG(memory, NULL, "Show the ExpressLink memory plan and buffer pool usage (pass `reset` to clear the high-water mark)", cmd_memory, 1, 1),
 	SHELL_CMD_ARG(export_certificate, NULL, "Export the certificate as PEM file to the USB mass storage device", cmd_export_certificate, 1, 0),
     SHELL_CMD_ARG(passthrough, NULL, "Enters a UART-passthrough mode with the ExpressLink module (local echo on by default, pass any argument to disable).", cmd_passthrough, 1, 1),
 	SHELL_SUBCMD_SET_END /* Array terminated. */
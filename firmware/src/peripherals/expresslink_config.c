@@ -0,0 +1,190 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+LOG_MODULE_REGISTER(expresslink_config);
+
+#include "badge.h"
+
+// The ExpressLink module persists its configuration across resets, so the values written or read once
+// are served from this cache, and writes of unchanged values are skipped.
+// Only called by the ExpressLink driver while it holds the UART mutex.
+
+#define MAX_CACHED_KEYS (16)
+#define MAX_KEY_LENGTH (24)
+#define MAX_VALUE_LENGTH (160)
+
+struct config_entry {
+    char key[MAX_KEY_LENGTH];
+    char value[MAX_VALUE_LENGTH];
+};
+
+static struct config_entry entries[MAX_CACHED_KEYS];
+static size_t entry_count = 0;
+static size_t next_eviction = 0;
+static uint32_t cache_hits = 0;
+static uint32_t cache_misses = 0;
+
+// configuration keys which only change when written by the host (or by a factory reset or firmware update)
+static const char *const cacheable_keys[] = {
+    "About",
+    "Version",
+    "TechSpec",
+    "ThingName",
+    "Endpoint",
+    "EnableShadow",
+    "Topic",
+    "QoS",
+    "BLEPeripheral",
+    "BLEGATT",
+};
+
+static const char conf_write_cmd[] = "AT+CONF ";
+static const char conf_read_cmd[] = "AT+CONF? ";
+
+static bool is_cacheable_key(const char *key, size_t key_length) {
+    if (key_length == 0 || key_length >= MAX_KEY_LENGTH) {
+        return false;
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(cacheable_keys); i++) {
+        size_t prefix_length = strlen(cacheable_keys[i]);
+        if (key_length >= prefix_length && strncmp(key, cacheable_keys[i], prefix_length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static struct config_entry *find_entry(const char *key, size_t key_length) {
+    for (size_t i = 0; i < entry_count; i++) {
+        if (strncmp(entries[i].key, key, key_length) == 0 && entries[i].key[key_length] == 0) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+static void store_entry(const char *key, size_t key_length, const char *value, size_t value_length) {
+    struct config_entry *entry = find_entry(key, key_length);
+    if (value_length >= MAX_VALUE_LENGTH) {
+        // too long to cache, forget any previous value
+        if (entry != NULL) {
+            *entry = entries[--entry_count];
+        }
+        return;
+    }
+
+    if (entry == NULL) {
+        if (entry_count < MAX_CACHED_KEYS) {
+            entry = &entries[entry_count++];
+        } else {
+            entry = &entries[next_eviction];
+            next_eviction = (next_eviction + 1) % MAX_CACHED_KEYS;
+        }
+        memcpy(entry->key, key, key_length);
+        entry->key[key_length] = 0;
+    }
+    memcpy(entry->value, value, value_length);
+    entry->value[value_length] = 0;
+}
+
+// splits "AT+CONF Topic1=hello/badge\n" or "AT+CONF? ThingName\n" into key and value
+static bool parse_conf_command(const char *command, bool *write, const char **key, size_t *key_length, const char **value, size_t *value_length) {
+    if (strncmp(command, conf_read_cmd, strlen(conf_read_cmd)) == 0) {
+        *write = false;
+        *key = command + strlen(conf_read_cmd);
+        *key_length = strcspn(*key, "\r\n");
+        // multi-word queries, such as "Certificate pem", are not cached
+        return memchr(*key, ' ', *key_length) == NULL && is_cacheable_key(*key, *key_length);
+    } else if (strncmp(command, conf_write_cmd, strlen(conf_write_cmd)) == 0) {
+        *write = true;
+        *key = command + strlen(conf_write_cmd);
+        *key_length = strcspn(*key, "=\r\n");
+        if ((*key)[*key_length] != '=') {
+            return false;
+        }
+        *value = *key + *key_length + 1;
+        *value_length = strcspn(*value, "\r\n");
+        return is_cacheable_key(*key, *key_length);
+    }
+    return false;
+}
+
+bool expresslink_config_cache_lookup(const char *command, char *response, size_t response_length) {
+    bool write;
+    const char *key;
+    size_t key_length;
+    const char *value;
+    size_t value_length;
+    if (!parse_conf_command(command, &write, &key, &key_length, &value, &value_length)) {
+        return false;
+    }
+
+    struct config_entry *entry = find_entry(key, key_length);
+    if (entry == NULL || (write && (strlen(entry->value) != value_length || strncmp(entry->value, value, value_length) != 0))) {
+        cache_misses++;
+        return false;
+    }
+
+    cache_hits++;
+    if (response != NULL) {
+        snprintf(response, response_length, "%s", write ? "" : entry->value);
+    }
+    return true;
+}
+
+void expresslink_config_cache_update(const char *command, const char *response_line) {
+    const char otw_cmd[] = "AT+OTW";
+    const char factory_reset_cmd[] = "AT+FACTORY_RESET";
+    if (strncmp(command, otw_cmd, strlen(otw_cmd)) == 0 || strncmp(command, factory_reset_cmd, strlen(factory_reset_cmd)) == 0) {
+        expresslink_config_cache_invalidate();
+        return;
+    }
+
+    bool write;
+    const char *key;
+    size_t key_length;
+    const char *value;
+    size_t value_length;
+    if (!parse_conf_command(command, &write, &key, &key_length, &value, &value_length)) {
+        return;
+    }
+
+    if (strncmp(response_line, "OK", 2) != 0 || isdigit((int)response_line[2])) {
+        // failed, or a multi-line value
+        struct config_entry *entry = find_entry(key, key_length);
+        if (entry != NULL) {
+            *entry = entries[--entry_count];
+        }
+        return;
+    }
+
+    if (write) {
+        store_entry(key, key_length, value, value_length);
+    } else {
+        const char *v = (response_line[2] == ' ') ? (response_line + 3) : "";
+        store_entry(key, key_length, v, strlen(v));
+    }
+}
+
+void expresslink_config_cache_invalidate(void) {
+    if (entry_count > 0) {
+        LOG_INF("ExpressLink configuration cache cleared.");
+    }
+    entry_count = 0;
+    next_eviction = 0;
+}
+
+void expresslink_config_cache_print(const struct shell *sh) {
+    for (size_t i = 0; i < entry_count; i++) {
+        shell_print(sh, "%s=%s", entries[i].key, entries[i].value);
+    }
+    shell_print(sh, "%u cached keys, %u hits, %u misses", entry_count, cache_hits, cache_misses);
+}
@@ -0,0 +1,185 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(expresslink_events);
+
+#include "badge.h"
+
+#define MAX_EVENT_SUBSCRIPTIONS (24)
+
+struct event_subscription {
+    enum expresslink_event_id id;
+    expresslink_event_cb callback;
+    void *user_data;
+};
+
+static struct event_subscription subscriptions[MAX_EVENT_SUBSCRIPTIONS];
+static size_t subscription_count = 0;
+
+// only held while the subscriptions are changed or copied, never while AT+EVENT? or a callback runs
+K_MUTEX_DEFINE(subscriptions_mutex);
+
+// unsubscribing waits for the dispatch in progress, so the callback is no longer running afterwards
+K_CONDVAR_DEFINE(dispatch_done);
+static bool dispatching = false;
+static uint32_t dispatch_count = 0;
+static k_tid_t expresslink_events_task_id = NULL;
+
+// given by the EVENT pin interrupt
+K_SEM_DEFINE(event_pending_sem, 0, 1);
+
+// fallback in case an EVENT pin edge was missed, e.g., while nobody was subscribed
+#define EVENT_PIN_POLL_INTERVAL (1000) // milliseconds
+
+#define expresslink_events_TASK_PRIORITY 9
+K_THREAD_STACK_DEFINE(expresslink_events_task_stack, 4096);
+static struct k_thread expresslink_events_task;
+
+int expresslink_event_subscribe(enum expresslink_event_id id, expresslink_event_cb callback, void *user_data) {
+    k_mutex_lock(&subscriptions_mutex, K_FOREVER);
+    if (subscription_count == MAX_EVENT_SUBSCRIPTIONS) {
+        k_mutex_unlock(&subscriptions_mutex);
+        LOG_ERR("too many event subscriptions!");
+        return -ENOMEM;
+    }
+
+    subscriptions[subscription_count].id = id;
+    subscriptions[subscription_count].callback = callback;
+    subscriptions[subscription_count].user_data = user_data;
+    subscription_count++;
+    k_mutex_unlock(&subscriptions_mutex);
+
+    // events might already be pending, e.g., STARTUP after a reset
+    expresslink_event_notify();
+    return 0;
+}
+
+void expresslink_event_unsubscribe(expresslink_event_cb callback) {
+    k_mutex_lock(&subscriptions_mutex, K_FOREVER);
+    size_t i = 0;
+    while (i < subscription_count) {
+        if (subscriptions[i].callback == callback) {
+            subscription_count--;
+            subscriptions[i] = subscriptions[subscription_count];
+        } else {
+            i++;
+        }
+    }
+
+    // a callback unsubscribing itself cannot wait for its own dispatch, it is skipped for the rest of it
+    uint32_t current_dispatch = dispatch_count;
+    while (dispatching && dispatch_count == current_dispatch && k_current_get() != expresslink_events_task_id) {
+        k_condvar_wait(&dispatch_done, &subscriptions_mutex, K_FOREVER);
+    }
+    k_mutex_unlock(&subscriptions_mutex);
+}
+
+void expresslink_event_notify(void) {
+    k_sem_give(&event_pending_sem);
+}
+
+static bool parse_event(const char *response, struct expresslink_event *event) {
+    // "6 0 CONNECT" - the "OK " prefix was already removed
+    char *end;
+    long id = strtol(response, &end, 10);
+    if (end == response || id <= 0) {
+        return false;
+    }
+    event->id = (enum expresslink_event_id)id;
+    event->parameter = (int)strtol(end, NULL, 10);
+    return true;
+}
+
+static bool has_subscribers(void) {
+    k_mutex_lock(&subscriptions_mutex, K_FOREVER);
+    bool subscribed = subscription_count > 0;
+    k_mutex_unlock(&subscriptions_mutex);
+    return subscribed;
+}
+
+static bool is_subscribed(const struct event_subscription *s) {
+    k_mutex_lock(&subscriptions_mutex, K_FOREVER);
+    bool subscribed = false;
+    for (size_t i = 0; i < subscription_count && !subscribed; i++) {
+        subscribed = subscriptions[i].callback == s->callback && subscriptions[i].user_data == s->user_data;
+    }
+    k_mutex_unlock(&subscriptions_mutex);
+    return subscribed;
+}
+
+static void dispatch_event(const struct expresslink_event *event, const char *response) {
+    // the callbacks are called with a copy of the matching subscriptions, they may send AT commands and (un)subscribe
+    struct event_subscription matching[MAX_EVENT_SUBSCRIPTIONS];
+    size_t count = 0;
+    k_mutex_lock(&subscriptions_mutex, K_FOREVER);
+    for (size_t i = 0; i < subscription_count; i++) {
+        if (subscriptions[i].id == event->id || subscriptions[i].id == EL_EVENT_ANY) {
+            matching[count++] = subscriptions[i];
+        }
+    }
+    dispatching = true;
+    k_mutex_unlock(&subscriptions_mutex);
+
+    for (size_t i = 0; i < count; i++) {
+        // an earlier callback might have unsubscribed it
+        if (is_subscribed(&matching[i])) {
+            matching[i].callback(event, matching[i].user_data);
+        }
+    }
+
+    k_mutex_lock(&subscriptions_mutex, K_FOREVER);
+    dispatching = false;
+    dispatch_count++;
+    k_condvar_broadcast(&dispatch_done);
+    k_mutex_unlock(&subscriptions_mutex);
+
+    if (count == 0) {
+        LOG_INF("Ignoring unhandled ExpressLink event: %s", response);
+    }
+}
+
+static void expresslink_events_loop(void *dummy0, void *dummy1, void *dummy2) {
+    char response[64];
+
+    while (true) {
+        k_sem_take(&event_pending_sem, K_MSEC(EVENT_PIN_POLL_INTERVAL));
+
+        // without subscribers the events stay pending, e.g., for the self test to observe the EVENT pin
+        // drain all pending events in one burst, the EVENT pin stays asserted as long as the event queue is not empty
+        while (has_subscribers() && expresslink_check_event_pending()) {
+            bool success = expresslink_send_command("AT+EVENT?\n", response, sizeof(response));
+            if (!success || response[0] == 0) {
+                break;
+            }
+
+            struct expresslink_event event;
+            if (!parse_event(response, &event)) {
+                LOG_WRN("Invalid ExpressLink event: %s", response);
+                continue;
+            }
+            dispatch_event(&event, response);
+        }
+    }
+}
+
+int init_expresslink_events(void) {
+    expresslink_events_task_id = k_thread_create(
+        &expresslink_events_task,
+        expresslink_events_task_stack,
+        K_THREAD_STACK_SIZEOF(expresslink_events_task_stack),
+        expresslink_events_loop,
+        NULL,
+        NULL,
+        NULL,
+        expresslink_events_TASK_PRIORITY,
+        0,
+        K_NO_WAIT);
+    k_thread_name_set(&expresslink_events_task, "expresslink_events_task");
+    return 0;
+}
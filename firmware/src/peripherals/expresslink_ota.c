@@ -0,0 +1,306 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(expresslink_ota);
+
+#include "badge.h"
+#include "hex.h"
+
+// Host OTA download engine: reads the image the module received with AT+OTA SEEK and AT+OTA READ.
+//
+// Response of AT+OTA READ, see the ExpressLink Programmer's Guide: "OK <count> <data> <checksum>"
+// - count: number of bytes read, in hex, 0 at the end of the image
+// - data: 2 hex digits per byte
+// - checksum: 4 hex digits, the 16-bit sum of the data bytes
+//
+// Every block is verified, a response without a checksum is damaged like one with a wrong checksum.
+//
+// Blocks are as large as the response buffer allows. A block with a bad checksum, a malformed or an error
+// response is read again from its offset, with half the block size; the block size grows back after a few
+// good blocks. Only verified bytes are passed to the sink, in order and decoded in place.
+//
+// With prefetching, the next AT+OTA READ is submitted to the ExpressLink I/O thread before the sink is called,
+// so the module sends a block while the previous one is consumed.
+
+// "<count> " and " <checksum>" around the data, plus the string terminator
+#define READ_RESPONSE_OVERHEAD (sizeof("ffffffff  ffff"))
+#define MIN_BLOCK_SIZE (64)
+#define GOOD_BLOCKS_TO_GROW (4)
+#define POSITION_UNKNOWN SIZE_MAX
+
+void expresslink_ota_begin(struct expresslink_ota_download *d, char *buffer, size_t buffer_length, expresslink_ota_sink_cb sink, void *user_data) {
+    memset(d, 0, sizeof(*d));
+    d->buffer = buffer;
+    d->buffer_length = buffer_length;
+    d->sink = sink;
+    d->user_data = user_data;
+    // multiples of MIN_BLOCK_SIZE keep halved blocks even, e.g. whole RGB565 pixels
+    d->max_block_size = (buffer_length - READ_RESPONSE_OVERHEAD) / 2 / MIN_BLOCK_SIZE * MIN_BLOCK_SIZE;
+    d->block_size = d->max_block_size;
+    d->position = POSITION_UNKNOWN;
+    d->started_at = k_uptime_get();
+}
+
+static bool seek(struct expresslink_ota_download *d, size_t offset) {
+    if (d->position == offset) {
+        // AT+OTA READ continues where the previous block ended
+        return true;
+    }
+
+    char cmd[32];
+    snprintf(cmd, sizeof(cmd), "AT+OTA SEEK %u\n", (uint32_t)offset);
+    if (!expresslink_send_command(cmd, NULL, 0)) {
+        d->position = POSITION_UNKNOWN;
+        return false;
+    }
+    d->position = offset;
+    return true;
+}
+
+// decodes the data in place, returns the number of bytes, 0 at the end of the image, or -EBADMSG
+static int parse_block(struct expresslink_ota_download *d, size_t requested) {
+    char *p = d->buffer;
+    char *end;
+    unsigned long count = strtoul(p, &end, 16);
+    if (end != p && count == 0) {
+        return 0;
+    }
+    if (end == p || *end != ' ' || count > requested) {
+        return -EBADMSG;
+    }
+
+    const char *hex = end + 1;
+    if (strlen(hex) != count * 2 + 5 || hex[count * 2] != ' ') {
+        return -EBADMSG;
+    }
+
+    // the checksum stays behind the decoded data
+    const char *checksum_hex = hex + count * 2 + 1;
+    uint8_t *data = (uint8_t *)d->buffer;
+    if (hex_decode(hex, count * 2, data, count) != (int)count) {
+        return -EBADMSG;
+    }
+
+    uint16_t sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        sum += data[i];
+    }
+
+    unsigned long checksum = strtoul(checksum_hex, &end, 16);
+    if (end != checksum_hex + 4 || *end != 0) {
+        return -EBADMSG;
+    }
+    if (checksum != sum) {
+        LOG_WRN("Checksum mismatch: %04lx, expected %04x", checksum, sum);
+        d->checksum_errors++;
+        return -EBADMSG;
+    }
+    return (int)count;
+}
+
+static void block_read(struct expresslink_ota_download *d, size_t offset, int count) {
+    d->position = offset + count;
+    if (count > 0 && ++d->good_blocks >= GOOD_BLOCKS_TO_GROW && d->block_size < d->max_block_size) {
+        d->block_size = MIN(d->block_size * 2, d->max_block_size);
+        d->good_blocks = 0;
+    }
+}
+
+// returns the number of bytes read, 0 at the end of the image
+static int read_block(struct expresslink_ota_download *d, size_t offset, size_t size, uint32_t first_attempt) {
+    for (uint32_t attempt = first_attempt; attempt <= CONFIG_EXPRESSLINK_OTA_MAX_RETRIES; attempt++) {
+        if (attempt > 0) {
+            d->retries++;
+            d->good_blocks = 0;
+            size = MAX(MIN(size / 2, d->block_size / 2), MIN(size, MIN_BLOCK_SIZE));
+            d->block_size = MAX(d->block_size / 2, MIN_BLOCK_SIZE);
+            // the module's read position is unknown after a damaged response
+            d->position = POSITION_UNKNOWN;
+        }
+
+        if (!seek(d, offset)) {
+            continue;
+        }
+
+        char cmd[32];
+        snprintf(cmd, sizeof(cmd), "AT+OTA READ %u\n", (uint32_t)size);
+        int64_t start = k_uptime_get();
+        bool success = expresslink_send_command(cmd, d->buffer, d->buffer_length);
+        d->io_time += k_uptime_get() - start;
+        if (!success) {
+            LOG_WRN("AT+OTA READ at %u failed: %s", (uint32_t)offset, d->buffer);
+            continue;
+        }
+
+        int count = parse_block(d, size);
+        if (count < 0) {
+            LOG_WRN("Block at %u damaged, reading it again...", (uint32_t)offset);
+            continue;
+        }
+
+        block_read(d, offset, count);
+        return count;
+    }
+    return -EIO;
+}
+
+static int consume(struct expresslink_ota_download *d, size_t offset, int count) {
+    int64_t start = k_uptime_get();
+    d->bytes += count;
+    d->blocks++;
+    int ret = d->sink(offset, (const uint8_t *)d->buffer, count, d->user_data);
+    d->sink_time += k_uptime_get() - start;
+    return ret;
+}
+
+void expresslink_ota_enable_prefetch(struct expresslink_ota_download *d) {
+    // each half holds one block, e.g. 960 bytes of a 4 KiB buffer
+    d->buffer_length /= 2;
+    d->prefetch_buffer = d->buffer + d->buffer_length;
+    d->max_block_size = (d->buffer_length - READ_RESPONSE_OVERHEAD) / 2 / MIN_BLOCK_SIZE * MIN_BLOCK_SIZE;
+    d->block_size = d->max_block_size;
+    k_sem_init(&d->prefetch_done, 0, 1);
+}
+
+// called from the ExpressLink I/O thread
+static void prefetch_done(struct expresslink_request *request) {
+    struct expresslink_ota_download *d = request->user_data;
+    d->io_time += k_uptime_get() - d->prefetch_submitted;
+    k_sem_give(&d->prefetch_done);
+}
+
+// the I/O thread reads the block into the prefetch buffer, the module reads on from its current position
+static bool submit_prefetch(struct expresslink_ota_download *d, size_t offset, size_t size) {
+    if (!seek(d, offset)) {
+        return false;
+    }
+
+    snprintf(d->prefetch_command, sizeof(d->prefetch_command), "AT+OTA READ %u\n", (uint32_t)size);
+    d->prefetch = (struct expresslink_request){
+        .command = d->prefetch_command,
+        .response = d->prefetch_buffer,
+        .response_length = d->buffer_length,
+        .callback = prefetch_done,
+        .user_data = d,
+    };
+    d->prefetch_submitted = k_uptime_get();
+    return expresslink_submit(&d->prefetch) == 0;
+}
+
+// swaps the buffers, the prefetched block becomes the current one
+static bool wait_prefetch(struct expresslink_ota_download *d) {
+    int64_t start = k_uptime_get();
+    k_sem_take(&d->prefetch_done, K_FOREVER);
+    d->wait_time += k_uptime_get() - start;
+
+    char *buffer = d->buffer;
+    d->buffer = d->prefetch_buffer;
+    d->prefetch_buffer = buffer;
+    return d->prefetch.success;
+}
+
+// While the sink consumes a block, the I/O thread already reads the next one.
+// A block that fails is read again synchronously, prefetching resumes with the block after it.
+static int read_prefetching(struct expresslink_ota_download *d, size_t offset, size_t length) {
+    size_t size = MIN(length, d->block_size);
+    bool in_flight = submit_prefetch(d, offset, size);
+
+    while (length > 0) {
+        int count;
+        if (!in_flight) {
+            // not submitted, e.g. the request queue is full
+            count = read_block(d, offset, size, 0);
+        } else if (wait_prefetch(d) && (count = parse_block(d, size)) >= 0) {
+            block_read(d, offset, count);
+        } else {
+            LOG_WRN("Block at %u damaged, reading it again...", (uint32_t)offset);
+            count = read_block(d, offset, size, 1);
+        }
+        in_flight = false;
+        if (count < 0) {
+            return count;
+        }
+        if (count == 0) {
+            return -ENODATA;
+        }
+
+        if (length > (size_t)count) {
+            size = MIN(length - count, d->block_size);
+            in_flight = submit_prefetch(d, offset + count, size);
+        }
+
+        int ret = consume(d, offset, count);
+        if (ret != 0) {
+            if (in_flight) {
+                wait_prefetch(d);
+                d->position = POSITION_UNKNOWN;
+            }
+            return ret;
+        }
+        offset += count;
+        length -= count;
+    }
+    return 0;
+}
+
+int expresslink_ota_read(struct expresslink_ota_download *d, size_t offset, size_t length) {
+    if (d->prefetch_buffer != NULL) {
+        int ret = read_prefetching(d, offset, length);
+        if (ret == -EIO) {
+            LOG_ERR("Reading the OTA image failed after %u attempts.", CONFIG_EXPRESSLINK_OTA_MAX_RETRIES + 1);
+        } else if (ret == -ENODATA) {
+            LOG_WRN("OTA image ended before %u.", (uint32_t)(offset + length));
+        }
+        return ret;
+    }
+
+    while (length > 0) {
+        int count = read_block(d, offset, MIN(length, d->block_size), 0);
+        if (count < 0) {
+            LOG_ERR("Reading the OTA image at %u failed after %u attempts.", (uint32_t)offset, CONFIG_EXPRESSLINK_OTA_MAX_RETRIES + 1);
+            return count;
+        }
+        if (count == 0) {
+            LOG_WRN("OTA image ended at %u, %u bytes missing.", (uint32_t)offset, (uint32_t)length);
+            return -ENODATA;
+        }
+
+        int ret = consume(d, offset, count);
+        if (ret != 0) {
+            return ret;
+        }
+        offset += count;
+        length -= count;
+    }
+    return 0;
+}
+
+uint32_t expresslink_ota_bytes_per_second(const struct expresslink_ota_download *d) {
+    int64_t elapsed = k_uptime_get() - d->started_at;
+    return elapsed > 0 ? (uint32_t)(d->bytes * 1000 / elapsed) : 0;
+}
+
+void expresslink_ota_log_stats(const struct expresslink_ota_download *d) {
+    int64_t elapsed = MAX(k_uptime_get() - d->started_at, 1);
+    LOG_INF("%u bytes in %lld ms (%u bytes/s), %u blocks, %u read again (%u checksum errors), block size %u of %u bytes",
+            (uint32_t)d->bytes,
+            elapsed,
+            expresslink_ota_bytes_per_second(d),
+            d->blocks,
+            d->retries,
+            d->checksum_errors,
+            (uint32_t)d->block_size,
+            (uint32_t)d->max_block_size);
+    // with prefetching, both stages are busy at the same time
+    LOG_INF("I/O busy %u%%, sink busy %u%%, waited %lld ms for blocks%s",
+            (uint32_t)(d->io_time * 100 / elapsed),
+            (uint32_t)(d->sink_time * 100 / elapsed),
+            d->wait_time,
+            d->prefetch_buffer != NULL ? " (prefetching)" : "");
+}
@@ -0,0 +1,305 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+LOG_MODULE_REGISTER(expresslink_stats);
+
+#include "badge.h"
+
+#define MAX_VERBS (24)
+#define MAX_VERB_LENGTH (20)
+
+// bucket i counts latencies below 2^i milliseconds, the last bucket covers everything up to the 120 s command timeout
+#define LATENCY_BUCKETS (18)
+
+struct verb_stats {
+    char verb[MAX_VERB_LENGTH];
+    uint32_t count;
+    uint32_t errors;
+    uint32_t timeouts;
+    uint32_t max_latency; // milliseconds
+    uint32_t latency_histogram[LATENCY_BUCKETS];
+};
+
+static struct verb_stats verbs[MAX_VERBS];
+static size_t verb_count = 0;
+static uint32_t untracked_commands = 0;
+
+// updated from uart_cb
+static atomic_t bytes_tx = ATOMIC_INIT(0);
+static atomic_t bytes_rx = ATOMIC_INIT(0);
+static atomic_t bytes_dropped = ATOMIC_INIT(0);
+static atomic_t rx_overruns = ATOMIC_INIT(0); // responses lost due to dropped bytes
+static atomic_t resyncs = ATOMIC_INIT(0);
+
+static struct k_spinlock stats_lock;
+static int64_t stats_since = 0;
+
+// duty cycling, milliseconds
+static uint32_t sleep_cycles = 0;
+static uint64_t total_asleep = 0;
+static uint64_t total_awake = 0; // between waking up and the next sleep
+static uint32_t awake_intervals = 0;
+static uint32_t last_awake = 0;
+static uint32_t max_awake = 0;
+
+#if CONFIG_EXPRESSLINK_STATS_PUBLISH_INTERVAL > 0
+static void publish_stats_work_handler(struct k_work *work);
+K_WORK_DELAYABLE_DEFINE(publish_stats_work, publish_stats_work_handler);
+
+static char publish_topic_cmd[128];
+static char publish_cmd[512];
+static struct expresslink_request publish_topic_request = {.command = publish_topic_cmd};
+static struct expresslink_request publish_request = {.command = publish_cmd};
+#endif
+
+// "AT+SEND1 {...}" -> "AT+SEND", "AT+CONF? Version" -> "AT+CONF?"
+static size_t command_verb_length(const char *command) {
+    size_t len = 0;
+    while (len < MAX_VERB_LENGTH - 1 && command[len] != 0 && command[len] != ' ' && command[len] != '\n' && command[len] != '\r' && !isdigit((int)command[len])) {
+        len++;
+    }
+    return len;
+}
+
+static struct verb_stats *lookup_verb(const char *command) {
+    size_t len = command_verb_length(command);
+    for (size_t i = 0; i < verb_count; i++) {
+        if (strncmp(verbs[i].verb, command, len) == 0 && verbs[i].verb[len] == 0) {
+            return &verbs[i];
+        }
+    }
+    if (verb_count == MAX_VERBS) {
+        return NULL;
+    }
+
+    struct verb_stats *stats = &verbs[verb_count++];
+    memset(stats, 0, sizeof(*stats));
+    memcpy(stats->verb, command, len);
+    stats->verb[len] = 0;
+    return stats;
+}
+
+void expresslink_stats_record_command(const char *command, uint32_t latency, enum expresslink_command_result result) {
+    k_spinlock_key_t key = k_spin_lock(&stats_lock);
+
+    struct verb_stats *stats = lookup_verb(command);
+    if (stats == NULL) {
+        untracked_commands++;
+        k_spin_unlock(&stats_lock, key);
+        return;
+    }
+
+    stats->count++;
+    if (result == EL_COMMAND_ERROR) {
+        stats->errors++;
+    } else if (result == EL_COMMAND_TIMEOUT) {
+        // the latency of a timeout is just the configured timeout
+        stats->timeouts++;
+        k_spin_unlock(&stats_lock, key);
+        return;
+    }
+
+    stats->max_latency = MAX(stats->max_latency, latency);
+    size_t bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && latency >= (1U << bucket)) {
+        bucket++;
+    }
+    stats->latency_histogram[bucket]++;
+
+    k_spin_unlock(&stats_lock, key);
+}
+
+void expresslink_stats_add_tx(size_t bytes) {
+    atomic_add(&bytes_tx, bytes);
+}
+
+void expresslink_stats_add_rx(size_t bytes, size_t dropped) {
+    atomic_add(&bytes_rx, bytes);
+    if (dropped > 0) {
+        atomic_add(&bytes_dropped, dropped);
+    }
+}
+
+void expresslink_stats_record_rx_overrun(void) {
+    atomic_inc(&rx_overruns);
+}
+
+void expresslink_stats_record_resync(void) {
+    atomic_inc(&resyncs);
+}
+
+void expresslink_stats_record_sleep(uint32_t awake) {
+    k_spinlock_key_t key = k_spin_lock(&stats_lock);
+    awake_intervals++;
+    total_awake += awake;
+    last_awake = awake;
+    max_awake = MAX(max_awake, awake);
+    k_spin_unlock(&stats_lock, key);
+}
+
+void expresslink_stats_record_wake(uint32_t asleep) {
+    k_spinlock_key_t key = k_spin_lock(&stats_lock);
+    sleep_cycles++;
+    total_asleep += asleep;
+    k_spin_unlock(&stats_lock, key);
+}
+
+// returns the upper bound of the bucket containing the given percentile
+static uint32_t latency_percentile(const struct verb_stats *stats, uint32_t percentile) {
+    uint32_t samples = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        samples += stats->latency_histogram[i];
+    }
+    if (samples == 0) {
+        return 0;
+    }
+
+    uint32_t rank = (samples * percentile + 99) / 100;
+    uint32_t seen = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += stats->latency_histogram[i];
+        if (seen >= rank) {
+            return MIN(1U << i, stats->max_latency);
+        }
+    }
+    return stats->max_latency;
+}
+
+void expresslink_stats_reset(void) {
+    k_spinlock_key_t key = k_spin_lock(&stats_lock);
+    verb_count = 0;
+    untracked_commands = 0;
+    atomic_clear(&bytes_tx);
+    atomic_clear(&bytes_rx);
+    atomic_clear(&bytes_dropped);
+    atomic_clear(&rx_overruns);
+    atomic_clear(&resyncs);
+    sleep_cycles = 0;
+    total_asleep = 0;
+    total_awake = 0;
+    awake_intervals = 0;
+    last_awake = 0;
+    max_awake = 0;
+    stats_since = k_uptime_get();
+    k_spin_unlock(&stats_lock, key);
+}
+
+void expresslink_stats_print(const struct shell *sh) {
+    // copy the counters, so we do not print while holding the spinlock
+    static struct verb_stats snapshot[MAX_VERBS];
+    k_spinlock_key_t key = k_spin_lock(&stats_lock);
+    size_t count = verb_count;
+    memcpy(snapshot, verbs, count * sizeof(verbs[0]));
+    uint32_t untracked = untracked_commands;
+    int64_t since = stats_since;
+    uint32_t cycles = sleep_cycles, intervals = awake_intervals, last = last_awake, max = max_awake;
+    uint64_t asleep = total_asleep, awake = total_awake;
+    k_spin_unlock(&stats_lock, key);
+
+    shell_print(sh, "%-20s %7s %6s %6s %8s %8s %8s", "command", "count", "errors", "tmo", "p50 ms", "p95 ms", "max ms");
+    for (size_t i = 0; i < count; i++) {
+        const struct verb_stats *s = &snapshot[i];
+        shell_print(sh, "%-20s %7u %6u %6u %8u %8u %8u",
+                    s->verb,
+                    s->count,
+                    s->errors,
+                    s->timeouts,
+                    latency_percentile(s, 50),
+                    latency_percentile(s, 95),
+                    s->max_latency);
+    }
+    if (untracked > 0) {
+        shell_print(sh, "%u commands not tracked (too many different commands)", untracked);
+    }
+
+    uint32_t seconds = (uint32_t)((k_uptime_get() - since) / 1000);
+    shell_print(sh, "");
+    shell_print(sh, "UART TX: %u bytes, RX: %u bytes, RX dropped: %u bytes (during the last %u s)",
+                (uint32_t)atomic_get(&bytes_tx),
+                (uint32_t)atomic_get(&bytes_rx),
+                (uint32_t)atomic_get(&bytes_dropped),
+                seconds);
+    shell_print(sh, "Responses lost to RX overruns: %u, resynchronizations: %u",
+                (uint32_t)atomic_get(&rx_overruns),
+                (uint32_t)atomic_get(&resyncs));
+    if (cycles > 0) {
+        shell_print(sh, "Sleep cycles: %u, asleep: %u s, awake between sleeps: %u s (%u%%)",
+                    cycles,
+                    (uint32_t)(asleep / 1000),
+                    (uint32_t)(awake / 1000),
+                    (uint32_t)(awake * 100 / MAX(asleep + awake, 1)));
+        shell_print(sh, "Awake per interval: last %u ms, average %u ms, max %u ms",
+                    last,
+                    intervals > 0 ? (uint32_t)(awake / intervals) : 0,
+                    max);
+    }
+}
+
+#if CONFIG_EXPRESSLINK_STATS_PUBLISH_INTERVAL > 0
+static void publish_stats_work_handler(struct k_work *work) {
+    k_work_schedule(&publish_stats_work, K_SECONDS(CONFIG_EXPRESSLINK_STATS_PUBLISH_INTERVAL));
+
+    if (publish_topic_request.pending || publish_request.pending) {
+        // the previous report is still queued, e.g., while the module is busy
+        return;
+    }
+
+    // totals first, then as many commands as fit into a single message
+    k_spinlock_key_t key = k_spin_lock(&stats_lock);
+    int len = snprintf(publish_cmd,
+                       sizeof(publish_cmd),
+                       "AT+SEND%d {\"uptime\":%lld,\"tx\":%u,\"rx\":%u,\"dropped\":%u,\"overruns\":%u,\"resyncs\":%u,\"sleeps\":%u,\"awake\":%u,\"commands\":{",
+                       CONFIG_EXPRESSLINK_STATS_TOPIC_INDEX,
+                       k_uptime_get() / 1000,
+                       (uint32_t)atomic_get(&bytes_tx),
+                       (uint32_t)atomic_get(&bytes_rx),
+                       (uint32_t)atomic_get(&bytes_dropped),
+                       (uint32_t)atomic_get(&rx_overruns),
+                       (uint32_t)atomic_get(&resyncs),
+                       sleep_cycles,
+                       last_awake);
+    for (size_t i = 0; i < verb_count && len < sizeof(publish_cmd); i++) {
+        const struct verb_stats *s = &verbs[i];
+        int n = snprintf(publish_cmd + len,
+                         sizeof(publish_cmd) - len,
+                         "%s\"%s\":[%u,%u,%u,%u,%u,%u]",
+                         i == 0 ? "" : ",",
+                         s->verb,
+                         s->count,
+                         s->errors,
+                         s->timeouts,
+                         latency_percentile(s, 50),
+                         latency_percentile(s, 95),
+                         s->max_latency);
+        if (len + n + 4 > sizeof(publish_cmd)) {
+            // skip the remaining verbs, but keep the JSON document valid
+            break;
+        }
+        len += n;
+    }
+    k_spin_unlock(&stats_lock, key);
+    snprintf(publish_cmd + len, sizeof(publish_cmd) - len, "}}\n");
+
+    // the topic is (re-)configured every time, as the workshop modules configure their own topics
+    snprintf(publish_topic_cmd, sizeof(publish_topic_cmd), "AT+CONF Topic%d=%s\n", CONFIG_EXPRESSLINK_STATS_TOPIC_INDEX, CONFIG_EXPRESSLINK_STATS_TOPIC);
+    expresslink_submit(&publish_topic_request);
+    expresslink_submit(&publish_request);
+}
+#endif
+
+int init_expresslink_stats(void) {
+    stats_since = k_uptime_get();
+
+#if CONFIG_EXPRESSLINK_STATS_PUBLISH_INTERVAL > 0
+    k_work_schedule(&publish_stats_work, K_SECONDS(CONFIG_EXPRESSLINK_STATS_PUBLISH_INTERVAL));
+#endif
+    return 0;
+}
@@ -6,6 +6,7 @@
 #include <sys/types.h>
 
 #include "badge.h"
+#include "hex.h"
 
 #include <zephyr/device.h>
 #include <zephyr/drivers/flash.h>
@@ -162,10 +163,10 @@ int inject_sidewalk_mfg_payload(const struct shell *sh, size_t argc, char **argv
 
         if (
             strlen(payload) < sizeof(SIDEWALK_MFG_HEADER) * 2 ||
-            (char)HEX_TO_BYTE(payload[0], payload[1]) != SIDEWALK_MFG_HEADER[0] ||
-            (char)HEX_TO_BYTE(payload[2], payload[3]) != SIDEWALK_MFG_HEADER[1] ||
-            (char)HEX_TO_BYTE(payload[4], payload[5]) != SIDEWALK_MFG_HEADER[2] ||
-            (char)HEX_TO_BYTE(payload[6], payload[7]) != SIDEWALK_MFG_HEADER[3]) {
+            hex_decode_byte(payload[0], payload[1]) != SIDEWALK_MFG_HEADER[0] ||
+            hex_decode_byte(payload[2], payload[3]) != SIDEWALK_MFG_HEADER[1] ||
+            hex_decode_byte(payload[4], payload[5]) != SIDEWALK_MFG_HEADER[2] ||
+            hex_decode_byte(payload[6], payload[7]) != SIDEWALK_MFG_HEADER[3]) {
             LOG_ERR("invalid file header, expected %s", SIDEWALK_MFG_HEADER);
             return -1;
         }
@@ -182,6 +183,14 @@ int inject_sidewalk_mfg_payload(const struct shell *sh, size_t argc, char **argv
         return -1;
     }
 
+    // decoded in place, the shell arguments are writable
+    size_t payload_len = strlen(payload);
+    int length = hex_decode(payload, payload_len, (uint8_t *)payload, payload_len);
+    if (length < 0) {
+        LOG_ERR("invalid hex payload: %d", length);
+        return length;
+    }
+
     ret = fs_open(&file, SIDEWALK_MFG_FILEPATH, FS_O_CREATE | FS_O_WRITE);
     if (ret != 0) {
         return ret;
@@ -192,16 +201,14 @@ int inject_sidewalk_mfg_payload(const struct shell *sh, size_t argc, char **argv
         return ret;
     }
 
-    size_t written = 0;
-
-    size_t payload_len = strlen(payload);
-    for (size_t i = 0; i < payload_len; i += 2) {
-        uint8_t b = HEX_TO_BYTE(payload[i], payload[i + 1]);
-        written += fs_write(&file, &b, 1);
-    }
+    ssize_t written = fs_write(&file, payload, length);
 
     fs_close(&file);
 
+    if (written < 0) {
+        return written;
+    }
+
     shell_print(sh, "Written %u bytes to %s.", written, SIDEWALK_MFG_FILEPATH);
 
     return 0;
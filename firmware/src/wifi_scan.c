@@ -0,0 +1,175 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+// Kept free of Zephyr APIs, so tools/wifi_scan can build it on the host.
+//
+// A crowded scan result is several KiB of JSON, which arrives while the UART is busy with it, so it can neither be
+// published nor buffered in full. Only the fields of the access points are kept, 7 bytes each instead of about 45.
+// The tokenizer is just good enough for the flat objects of the scan result, it does not validate the JSON.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hex.h"
+#include "wifi_scan.h"
+
+enum {
+    KEY_OTHER,
+    KEY_MAC_ADDRESS,
+    KEY_RSS,
+};
+
+void wifi_scan_parser_init(struct wifi_scan_parser *p, struct wifi_access_point *access_points, size_t max_access_points) {
+    memset(p, 0, sizeof(*p));
+    p->access_points = access_points;
+    p->max_access_points = max_access_points;
+}
+
+// "ab:cd:ef:12:34:56"
+static bool parse_mac(const char *s, size_t length, uint8_t *mac) {
+    if (length != 17) {
+        return false;
+    }
+    for (size_t i = 0; i < 6; i++) {
+        int byte = hex_decode_byte(s[i * 3], s[i * 3 + 1]);
+        if (byte < 0 || (i < 5 && s[i * 3 + 2] != ':')) {
+            return false;
+        }
+        mac[i] = (uint8_t)byte;
+    }
+    return true;
+}
+
+static void store_value(struct wifi_scan_parser *p) {
+    p->token[p->token_length] = 0;
+    if (p->key == KEY_MAC_ADDRESS) {
+        p->has_mac = parse_mac(p->token, p->token_length, p->current.mac);
+    } else if (p->key == KEY_RSS && p->token_length > 0) {
+        int rss = atoi(p->token);
+        p->current.rss = (int8_t)(rss < -128 ? -128 : (rss > 127 ? 127 : rss));
+        p->has_rss = true;
+    }
+    p->value = false;
+}
+
+static void store_key(struct wifi_scan_parser *p) {
+    p->token[p->token_length] = 0;
+    if (strcmp(p->token, "MacAddress") == 0) {
+        p->key = KEY_MAC_ADDRESS;
+    } else if (strcmp(p->token, "Rss") == 0) {
+        p->key = KEY_RSS;
+    } else {
+        p->key = KEY_OTHER;
+    }
+}
+
+// the strongest access points are kept, they are the most useful for the position estimate
+static void store_access_point(struct wifi_scan_parser *p) {
+    p->found++;
+    if (p->count < p->max_access_points) {
+        p->access_points[p->count++] = p->current;
+        return;
+    }
+    size_t weakest = 0;
+    for (size_t i = 1; i < p->count; i++) {
+        if (p->access_points[i].rss < p->access_points[weakest].rss) {
+            weakest = i;
+        }
+    }
+    if (p->count > 0 && p->current.rss > p->access_points[weakest].rss) {
+        p->access_points[weakest] = p->current;
+    }
+}
+
+static void append_token(struct wifi_scan_parser *p, char c) {
+    // longer tokens are of no interest, they are cut off
+    if (p->token_length < sizeof(p->token) - 1) {
+        p->token[p->token_length++] = c;
+    }
+}
+
+void wifi_scan_parser_put(struct wifi_scan_parser *p, const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+
+        if (p->in_string) {
+            if (p->escape) {
+                p->escape = false;
+                append_token(p, c);
+            } else if (c == '\\') {
+                p->escape = true;
+            } else if (c == '"') {
+                p->in_string = false;
+                if (p->value) {
+                    store_value(p);
+                } else {
+                    store_key(p);
+                }
+            } else {
+                append_token(p, c);
+            }
+            continue;
+        }
+
+        if (p->in_number) {
+            if (c >= '0' && c <= '9') {
+                append_token(p, c);
+                continue;
+            }
+            p->in_number = false;
+            store_value(p);
+        }
+
+        switch (c) {
+        case '"':
+            p->in_string = true;
+            p->token_length = 0;
+            break;
+        case ':':
+            p->value = true;
+            break;
+        case '{':
+            p->has_mac = false;
+            p->has_rss = false;
+            p->value = false;
+            break;
+        case '}':
+            if (p->has_mac && p->has_rss) {
+                store_access_point(p);
+            }
+            p->has_mac = false;
+            p->has_rss = false;
+            p->value = false;
+            break;
+        case ',':
+        case '[':
+            p->value = false;
+            break;
+        default:
+            if (p->value && (c == '-' || (c >= '0' && c <= '9'))) {
+                p->in_number = true;
+                p->token_length = 0;
+                append_token(p, c);
+            }
+            break;
+        }
+    }
+}
+
+size_t wifi_access_point_to_json(const struct wifi_access_point *ap, char *out, size_t out_length) {
+    int length = snprintf(out,
+                          out_length,
+                          "{\"MacAddress\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"Rss\":%d}",
+                          ap->mac[0],
+                          ap->mac[1],
+                          ap->mac[2],
+                          ap->mac[3],
+                          ap->mac[4],
+                          ap->mac[5],
+                          ap->rss);
+    if (length < 0) {
+        return 0;
+    }
+    return ((size_t)length < out_length) ? (size_t)length : out_length - 1;
+}
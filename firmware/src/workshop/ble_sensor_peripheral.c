@@ -13,9 +13,14 @@ LOG_MODULE_REGISTER(ble_sensor_peripheral);
 
 #include "badge.h"
 
+static void handle_ble_connection_lost(const struct expresslink_event *event, void *user_data) {
+    expresslink_send_command("AT+BLE ADVERTISE\n", NULL, 0);
+}
+
 void ble_sensor_peripheral(void *context, void *dummy1, void *dummy2) {
     char cmd[128];
-    char expresslink_response[128];
+
+    expresslink_event_subscribe(EL_EVENT_BLE_CONNECTION_LOST, handle_ble_connection_lost, NULL);
 
     expresslink_reset();
 
@@ -38,6 +43,7 @@ void ble_sensor_peripheral(void *context, void *dummy1, void *dummy2) {
     while (true) {
         if (shutdown_request_received()) {
             LOG_INF("Shutting down 'BLE Sensor Peripheral' module.");
+            expresslink_event_unsubscribe(handle_ble_connection_lost);
             expresslink_reset();
             display_handler();
             return;
@@ -45,14 +51,6 @@ void ble_sensor_peripheral(void *context, void *dummy1, void *dummy2) {
 
         display_handler();
 
-        if (expresslink_check_event_pending()) {
-            expresslink_send_command("AT+EVENT?\n", expresslink_response, sizeof(expresslink_response));
-            LOG_INF("%s", expresslink_response);
-            if (expresslink_is_event(expresslink_response, EL_EVENT_BLE_CONNECTION_LOST)) {
-                expresslink_send_command("AT+BLE ADVERTISE\n", NULL, 0);
-            }
-        }
-
         if (k_uptime_get() > last_update_time + 5000) {
             sht3xd_sample v;
             read_sht31_sample(&v);
@@ -65,5 +63,7 @@ void ble_sensor_peripheral(void *context, void *dummy1, void *dummy2) {
 
             last_update_time = k_uptime_get();
         }
+
+        k_msleep(10);
     }
 }
@@ -16,8 +16,29 @@ LOG_MODULE_REGISTER(device_location);
 #include "badge.h"
 
 #include "core_json.h"
-
-static char *expresslink_response = NULL;
+#include "wifi_scan.h"
+
+// The access points are collected while the scan result is streamed from the ExpressLink driver, and published once
+// the UART is free again, so a crowded scan does not need a buffer for the whole result. The strongest
+// MAX_ACCESS_POINTS of a scan are sent, more than a position estimate needs.
+#define MAX_ACCESS_POINTS 64 // 7 bytes each
+static struct wifi_access_point access_points[MAX_ACCESS_POINTS];
+static struct wifi_scan_parser scan_parser;
+
+// The request is sent to the reserved Device Location topic as a single message if it fits, like the workshop
+// always did. Only larger requests are sent in fragments, FragmentReassemblyLambda then forwards them.
+#define MAX_REQUEST_LENGTH 2048
+static char request_payload[MAX_REQUEST_LENGTH];
+static struct mqtt_fragment_writer request_writer;
+
+// Position estimates are received on the event dispatcher thread and shown by the module thread,
+// they are handed over as copies, so neither thread touches a buffer the other one is using.
+struct location_message {
+    char text[512];
+};
+K_MSGQ_DEFINE(location_msgq, sizeof(struct location_message), 1, 4);
+static struct location_message received; // event thread only
+#define MAX_BACKLOG_MESSAGES 4 // fetched after an OVERRUN event of the module
 
 static lv_obj_t *label_dl_title = NULL;
 #define LABEL_DL_TITLE_X 0
@@ -139,25 +160,6 @@ static bool device_location_extract_coords(const char *response, const char *que
     return coords_found;
 }
 
-static size_t device_location_count_networks(const char *scan_result) {
-    const char token[] = "MacAddress";
-    size_t token_len = strlen(token);
-    size_t count = 0;
-    size_t i = 0;
-
-    size_t length = strlen(scan_result) - token_len;
-    while (i < length) {
-        if (strncmp(&scan_result[i], token, token_len) == 0) {
-            count++;
-            i += token_len;
-        } else {
-            i += 1;
-        }
-    }
-
-    return count;
-}
-
 static void update_ui_display(const char *response) {
     // enough space for: '-' + 3 digits + '.' + 16 decimal digits + null-byte
     char coords_latitude[25], coords_longitude[25];
@@ -207,32 +209,215 @@ static void cleanup_ui_display() {
     }
 }
 
-void device_location(void *context, void *dummy1, void *dummy2) {
-    size_t cmd_length = 4096;
-    char *cmd = k_malloc(cmd_length);
-    if (cmd == NULL) {
-        LOG_ERR("k_malloc for cmd failed!");
-        return;
+// the topics contain the thing name, they are filled in before acquiring the connection
+static char request_topic[128];
+static char accepted_topic[128];
+static char rejected_topic[128];
+static char fragment_accepted_topic[128];
+static char fragment_rejected_topic[128];
+
+// FragmentReassemblyLambda replies to fragmented requests on its own topics, as only the device itself may publish
+// to the reserved ones. They are subscribed to once a request was fragmented, so the module also works without it.
+#define FRAGMENT_ACCEPTED_TOPIC_INDEX 5
+#define FRAGMENT_REJECTED_TOPIC_INDEX 6
+static volatile bool fragment_replies_subscribed = false;
+
+static const struct mqtt_topic topics[] = {
+    {1, request_topic, false},
+    {2, accepted_topic, true},
+    {3, rejected_topic, true},
+    {4, MQTT_FRAGMENT_TOPIC, false},
+    {FRAGMENT_ACCEPTED_TOPIC_INDEX, fragment_accepted_topic, false},
+    {FRAGMENT_REJECTED_TOPIC_INDEX, fragment_rejected_topic, false},
+};
+
+static void prepare_topics(void) {
+    char thing_name[64];
+    expresslink_send_command("AT+CONF? ThingName\n", thing_name, sizeof(thing_name));
+
+    snprintf(request_topic, sizeof(request_topic), "$aws/device_location/%s/get_position_estimate", thing_name);
+    snprintf(accepted_topic, sizeof(accepted_topic), "%s/accepted", request_topic);
+    snprintf(rejected_topic, sizeof(rejected_topic), "%s/rejected", request_topic);
+    snprintf(fragment_accepted_topic, sizeof(fragment_accepted_topic), "demo_badge/%s/location/accepted", thing_name);
+    snprintf(fragment_rejected_topic, sizeof(fragment_rejected_topic), "demo_badge/%s/location/rejected", thing_name);
+}
+
+static bool send_subscription(const char *command, uint8_t index) {
+    char cmd[24];
+    snprintf(cmd, sizeof(cmd), "%s%u\n", command, index);
+    return expresslink_send_command(cmd, NULL, 0);
+}
+
+static void subscribe_fragment_replies(void) {
+    if (!fragment_replies_subscribed) {
+        fragment_replies_subscribed = send_subscription("AT+SUBSCRIBE", FRAGMENT_ACCEPTED_TOPIC_INDEX) &&
+                                      send_subscription("AT+SUBSCRIBE", FRAGMENT_REJECTED_TOPIC_INDEX);
+    }
+}
+
+static void unsubscribe_fragment_replies(void) {
+    if (fragment_replies_subscribed) {
+        send_subscription("AT+UNSUBSCRIBE", FRAGMENT_ACCEPTED_TOPIC_INDEX);
+        send_subscription("AT+UNSUBSCRIBE", FRAGMENT_REJECTED_TOPIC_INDEX);
+        fragment_replies_subscribed = false;
     }
+}
+
+// only the latest position estimate is shown, an older one is dropped if the module thread did not render it yet
+static void hand_over_location(void) {
+    while (k_msgq_put(&location_msgq, &received, K_NO_WAIT) != 0) {
+        k_msgq_purge(&location_msgq);
+    }
+}
+
+// returns false if there was no message
+static bool fetch_location_response(void) {
+    bool success = expresslink_send_command_multiline("AT+GET\n", received.text, sizeof(received.text));
+    if (success && isdigit((int)received.text[0])) {
+        LOG_INF("Received MQTT message: %s", received.text);
+        size_t additional_lines = atoi(received.text);
+        for (size_t i = 0; i < additional_lines; i++) {
+            if (expresslink_read_response_line(received.text, sizeof(received.text)) == -EIO) {
+                LOG_WRN("Location response lost to a UART receive overrun.");
+                return true;
+            }
+            LOG_INF("%s", received.text);
+        }
+        if (additional_lines > 0) {
+            hand_over_location();
+        }
+        return true;
+    }
+    if (!success || received.text[0] != 0) {
+        LOG_WRN("AT+GET failed! %d %s", success, received.text);
+    }
+    return false;
+}
 
-    size_t expresslink_response_length = 4096; // many WiFi networks might produce a large scan response
-    expresslink_response = k_malloc(expresslink_response_length);
-    if (expresslink_response == NULL) {
-        LOG_ERR("k_malloc for expresslink_response failed!");
-        return;
+static void handle_message(const struct expresslink_event *event, void *user_data) {
+    fetch_location_response();
+}
+
+// the MSG events of the messages buffered by the module might have been lost
+static size_t fetch_backlog(void *user_data) {
+    size_t count = 0;
+    while (count < MAX_BACKLOG_MESSAGES && fetch_location_response()) {
+        count++;
     }
+    return count;
+}
+
+// the subscriptions of a new session are made again once they are needed
+static void handle_connected(void *user_data) {
+    fragment_replies_subscribed = false;
+}
+
+static const struct mqtt_profile profile = {
+    .name = WORKSHOP_MODULE_DEVICE_LOCATION,
+    .topics = topics,
+    .topic_count = ARRAY_SIZE(topics),
+    .qos = 1, // a lost fragment loses the whole scan
+    .connected = handle_connected,
+    .overrun = fetch_backlog,
+};
+
+static void handle_suback(const struct expresslink_event *event, void *user_data) {
+    // do nothing
+}
+
+// called from the ExpressLink I/O thread, while the module thread waits for the scan to complete
+static int collect_access_points(const char *data, size_t len, bool end_of_line, void *user_data) {
+    wifi_scan_parser_put(&scan_parser, data, len);
+    return 0;
+}
+
+static bool scan_access_points(void) {
+    char status[64];
+    wifi_scan_parser_init(&scan_parser, access_points, ARRAY_SIZE(access_points));
+    if (!expresslink_send_command_streamed("AT+DIAG WIFI SCAN workshop MacAddress Rss\n", status, sizeof(status), collect_access_points, NULL)) {
+        LOG_WRN("WiFi scan failed: %s", status);
+        return false;
+    }
+    return true;
+}
+
+typedef int (*request_write_cb)(const void *data, size_t len, void *user_data);
+
+// {"WiFiAccessPoints":[{"MacAddress":"ab:cd:ef:12:34:56","Rss":-50}, ...]}
+static int write_request(request_write_cb write, void *user_data) {
+    const char head[] = "{\"WiFiAccessPoints\":[";
+    char json[WIFI_ACCESS_POINT_JSON_LENGTH + 1];
+
+    int ret = write(head, sizeof(head) - 1, user_data);
+    for (size_t i = 0; ret == 0 && i < scan_parser.count; i++) {
+        size_t length = wifi_access_point_to_json(&access_points[i], json, sizeof(json));
+        ret = (i > 0) ? write(",", 1, user_data) : 0;
+        if (ret == 0) {
+            ret = write(json, length, user_data);
+        }
+    }
+    return (ret == 0) ? write("]}", 2, user_data) : ret;
+}
+
+static int write_to_payload(const void *data, size_t len, void *user_data) {
+    size_t *length = user_data;
+    if (*length + len > sizeof(request_payload)) {
+        return -EMSGSIZE;
+    }
+    memcpy(request_payload + *length, data, len);
+    *length += len;
+    return 0;
+}
+
+static int write_to_fragments(const void *data, size_t len, void *user_data) {
+    return mqtt_fragment_write(user_data, data, len);
+}
+
+static int publish_access_points(void) {
+    size_t length = 0;
+    int ret = write_request(write_to_payload, &length);
+    if (ret == 0) {
+        struct expresslink_iovec iov[] = {
+            {"AT+SEND1 ", sizeof("AT+SEND1 ") - 1},
+            {request_payload, length},
+            {"\n", 1},
+        };
+        return expresslink_send_commandv(iov, ARRAY_SIZE(iov), NULL, 0) ? 0 : -EIO;
+    }
+    if (ret != -EMSGSIZE) {
+        return ret;
+    }
+
+    LOG_INF("Scan result larger than %u bytes, sending it in fragments.", MAX_REQUEST_LENGTH);
+    subscribe_fragment_replies();
+    ret = mqtt_fragment_begin(&request_writer, 4, profile.qos, request_topic, false);
+    if (ret != 0) {
+        return ret;
+    }
+    // errors are kept by the writer and returned by mqtt_fragment_end()
+    write_request(write_to_fragments, &request_writer);
+    return mqtt_fragment_end(&request_writer);
+}
+
+void device_location(void *context, void *dummy1, void *dummy2) {
+    static struct location_message location; // rendered by the module thread
 
     init_ui_display();
+    k_msgq_purge(&location_msgq);
+
+    expresslink_event_subscribe(EL_EVENT_MSG, handle_message, NULL);
+    expresslink_event_subscribe(EL_EVENT_SUBACK, handle_suback, NULL);
 
-    expresslink_reset();
+    prepare_topics();
+    mqtt_connection_acquire(&profile);
 
     while (true) {
         if (shutdown_request_received()) {
             LOG_INF("Shutting down 'Device Location' module.");
-            expresslink_reset();
-
-            k_free(expresslink_response);
-            expresslink_response = NULL;
+            expresslink_event_unsubscribe(handle_message);
+            expresslink_event_unsubscribe(handle_suback);
+            unsubscribe_fragment_replies();
+            mqtt_connection_release(&profile);
 
             cleanup_ui_display();
             return;
@@ -240,53 +425,8 @@ void device_location(void *context, void *dummy1, void *dummy2) {
 
         display_handler();
 
-        if (expresslink_check_event_pending()) {
-            expresslink_send_command("AT+EVENT?\n", expresslink_response, expresslink_response_length);
-            if (expresslink_is_event(expresslink_response, EL_EVENT_STARTUP)) {
-                expresslink_send_command("AT+CONNECT!\n", NULL, 0);
-            } else if (expresslink_is_event(expresslink_response, EL_EVENT_CONLOST)) {
-                LOG_INF("CONLOST EVENT received! Reconnecting ...");
-                expresslink_send_command("AT+CONNECT!\n", NULL, 0);
-            } else if (expresslink_is_event(expresslink_response, EL_EVENT_CONNECT)) {
-                int parameter = atoi(expresslink_response + 2);
-                if (parameter == 0) {
-                    LOG_INF("Successfully connected to AWS IoT Core!");
-
-                    char thing_name[64];
-                    expresslink_send_command("AT+CONF? ThingName\n", thing_name, sizeof(thing_name));
-
-                    snprintf(cmd, cmd_length, "AT+CONF Topic1=$aws/device_location/%s/get_position_estimate\n", thing_name);
-                    expresslink_send_command(cmd, expresslink_response, expresslink_response_length);
-                    snprintf(cmd, cmd_length, "AT+CONF Topic2=$aws/device_location/%s/get_position_estimate/accepted\n", thing_name);
-                    expresslink_send_command(cmd, expresslink_response, expresslink_response_length);
-                    snprintf(cmd, cmd_length, "AT+CONF Topic3=$aws/device_location/%s/get_position_estimate/rejected\n", thing_name);
-                    expresslink_send_command(cmd, expresslink_response, expresslink_response_length);
-
-                    expresslink_send_command("AT+SUBSCRIBE2\n", NULL, 0);
-                    expresslink_send_command("AT+SUBSCRIBE3\n", NULL, 0);
-                } else {
-                    LOG_INF("Connection attempt failed! Reconnecting...");
-                    k_msleep(3000);
-                    expresslink_send_command("AT+CONNECT!\n", NULL, 0);
-                }
-            } else if (expresslink_is_event(expresslink_response, EL_EVENT_MSG)) {
-                bool success = expresslink_send_command("AT+GET\n", expresslink_response, expresslink_response_length);
-                if (success && isdigit((int)expresslink_response[0])) {
-                    LOG_INF("Received MQTT message: %s", expresslink_response);
-                    size_t additional_lines = atoi(expresslink_response);
-                    for (size_t i = 0; i < additional_lines; i++) {
-                        expresslink_read_response_line(expresslink_response, expresslink_response_length);
-                        LOG_INF("%s", expresslink_response);
-                        update_ui_display(expresslink_response);
-                    }
-                } else {
-                    LOG_WRN("AT+GET failed! %d %s", success, expresslink_response);
-                }
-            } else if (expresslink_is_event(expresslink_response, EL_EVENT_SUBACK)) {
-                // do nothing
-            } else {
-                LOG_INF("Ignoring unhandled ExpressLink event: %s", expresslink_response);
-            }
+        if (k_msgq_get(&location_msgq, &location, K_NO_WAIT) == 0) {
+            update_ui_display(location.text);
         }
 
         if (button1_pressed || button2_pressed || button3_pressed || button4_pressed) {
@@ -295,27 +435,23 @@ void device_location(void *context, void *dummy1, void *dummy2) {
             lv_label_set_text_fmt(label_dl_coords_long, "%s %s", LABEL_DL_COORDS_LONG_TEXT, "-");
             display_handler();
 
-            expresslink_send_command("AT+DIAG WIFI SCAN workshop MacAddress Rss\n", expresslink_response, expresslink_response_length);
+            // WARNING: do not log the scan result - it might be too large and crash the logging subsystem
+            bool scanned = scan_access_points();
 
-            // WARNING: do not log response output - it might be too large and crash the logging subsystem
-
-            size_t num_networks = device_location_count_networks(expresslink_response);
-            lv_label_set_text_fmt(label_dl_net_v, "%d", num_networks);
+            lv_label_set_text_fmt(label_dl_net_v, "%d", scan_parser.found);
             display_handler();
 
-            // truncate too many scan results
-            // {"WiFiAccessPoints":[{"MacAddress":"ab:cd:ef:12:34:56","Rss":-50}]}
-            const size_t max_len = 2048;
-            size_t len = strlen(expresslink_response);
-            if (len > max_len) {
-                char *pos = strstr(expresslink_response + max_len - 50, "},{");
-                strcpy(pos, "}]}");
+            LOG_INF("Found %d WiFi networks.", scan_parser.found);
+            if (scan_parser.found > scan_parser.count) {
+                LOG_INF("Sending the %d strongest ones.", scan_parser.count);
             }
 
-            snprintf(cmd, cmd_length, "AT+SEND1 %s\n", expresslink_response);
-            LOG_INF("Found %d WiFi networks.", num_networks);
-
-            expresslink_send_command(cmd, NULL, 0);
+            if (scanned) {
+                int ret = publish_access_points();
+                if (ret != 0) {
+                    LOG_WRN("Sending the scan result failed: %d", ret);
+                }
+            }
 
             k_msleep(50); // lazy debounce
             button1_pressed = false;
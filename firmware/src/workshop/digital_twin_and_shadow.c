@@ -18,9 +18,8 @@ LOG_MODULE_REGISTER(digital_twin_and_shadow);
 bool user_led_blinking = false;
 bool send_sensor_data = false;
 
-static const size_t expresslink_response_length = 4096;
+static const size_t expresslink_response_length = EXPRESSLINK_BUFFER_SIZE;
 static char *expresslink_response = NULL;
-static bool expresslink_connected = false;
 
 #define display_state_length (128)
 static char display_state[display_state_length];
@@ -233,53 +232,67 @@ void handle_shadow_doc(char *doc) {
     }
 }
 
-void handle_expresslink_event() {
-    expresslink_send_command("AT+EVENT?\n", expresslink_response, expresslink_response_length);
-    if (expresslink_is_event(expresslink_response, EL_EVENT_STARTUP)) {
-        expresslink_send_command("AT+CONNECT!\n", NULL, 0);
-    } else if (expresslink_is_event(expresslink_response, EL_EVENT_CONLOST)) {
-        expresslink_connected = false;
-        LOG_INF("CONLOST EVENT received! Reconnecting...");
-        expresslink_send_command("AT+CONNECT!\n", NULL, 0);
-    } else if (expresslink_is_event(expresslink_response, EL_EVENT_CONNECT)) {
-        int parameter = atoi(expresslink_response + 2);
-        if (parameter == 0) {
-            LOG_INF("Successfully connected to AWS IoT Core!");
-            expresslink_send_command("AT+CONF Topic1=demo_badge/sensors\n", NULL, 0);
-            expresslink_send_command("AT+CONF EnableShadow=1\n", NULL, 0);
-            expresslink_send_command("AT+SHADOW INIT\n", NULL, 0);
-            expresslink_connected = true;
-        } else {
-            LOG_INF("Connection attempt failed! Reconnecting...");
-            k_msleep(3000);
-            expresslink_send_command("AT+CONNECT!\n", NULL, 0);
-        }
-    } else if (expresslink_is_event(expresslink_response, EL_EVENT_SHADOW_DOC)) {
+static const struct mqtt_topic topics[] = {
+    {1, "demo_badge/sensors", false, .drop = MQTT_DROP_OLDEST},
+};
+
+static void handle_connected(void *user_data) {
+    expresslink_send_command("AT+SHADOW INIT\n", NULL, 0);
+}
+
+static const struct mqtt_profile profile = {
+    .name = WORKSHOP_MODULE_DIGITAL_TWIN_AND_SHADOW,
+    .topics = topics,
+    .topic_count = ARRAY_SIZE(topics),
+    .shadow = true,
+    .qos = 1,
+    .connected = handle_connected,
+};
+
+static void handle_shadow_event(const struct expresslink_event *event, void *user_data) {
+    switch (event->id) {
+    case EL_EVENT_SHADOW_DOC:
         expresslink_send_command("AT+SHADOW GET DOC\n", expresslink_response, expresslink_response_length);
         handle_shadow_doc(expresslink_response);
-    } else if (expresslink_is_event(expresslink_response, EL_EVENT_SHADOW_DELTA)) {
+        break;
+    case EL_EVENT_SHADOW_DELTA:
         expresslink_send_command("AT+SHADOW GET DELTA\n", expresslink_response, expresslink_response_length);
         handle_shadow_doc(expresslink_response);
-    } else if (expresslink_is_event(expresslink_response, EL_EVENT_SHADOW_UPDATE)) {
+        break;
+    case EL_EVENT_SHADOW_UPDATE:
         expresslink_send_command("AT+SHADOW GET UPDATE\n", expresslink_response, expresslink_response_length);
         // shadow update accepted, no further processing needed
-    } else if (expresslink_is_event(expresslink_response, EL_EVENT_SHADOW_SUBACK)) {
+        break;
+    case EL_EVENT_SHADOW_SUBACK:
         expresslink_send_command("AT+SHADOW DOC\n", NULL, 0);
-    } else if (expresslink_is_event(expresslink_response, EL_EVENT_SHADOW_INIT)) {
+        break;
+    case EL_EVENT_SHADOW_INIT:
         expresslink_send_command("AT+SHADOW SUBSCRIBE\n", NULL, 0);
         expresslink_send_command("AT+SHADOW UPDATE {\"state\":{\"reported\":{\"button_1\":0,\"button_2\":0,\"button_3\":0,\"button_4\":0}}}\n", NULL, 0);
-    } else if (expresslink_is_event(expresslink_response, EL_EVENT_SHADOW_INIT_FAILED)) {
+        break;
+    case EL_EVENT_SHADOW_INIT_FAILED:
         LOG_WRN("shadow init failed!");
-    } else {
-        LOG_INF("Ignoring unhandled ExpressLink event: %s", expresslink_response);
+        break;
+    default:
+        break;
     }
 }
 
-void report_data() {
-    if (!expresslink_connected) {
-        return;
-    }
+static void subscribe_expresslink_events() {
+    expresslink_event_subscribe(EL_EVENT_SHADOW_DOC, handle_shadow_event, NULL);
+    expresslink_event_subscribe(EL_EVENT_SHADOW_DELTA, handle_shadow_event, NULL);
+    expresslink_event_subscribe(EL_EVENT_SHADOW_UPDATE, handle_shadow_event, NULL);
+    expresslink_event_subscribe(EL_EVENT_SHADOW_SUBACK, handle_shadow_event, NULL);
+    expresslink_event_subscribe(EL_EVENT_SHADOW_INIT, handle_shadow_event, NULL);
+    expresslink_event_subscribe(EL_EVENT_SHADOW_INIT_FAILED, handle_shadow_event, NULL);
+}
+
+static void unsubscribe_expresslink_events() {
+    expresslink_event_unsubscribe(handle_shadow_event);
+}
 
+// reports are queued while not connected, the oldest ones are dropped if the queue is full
+void report_data() {
     sht3xd_sample sht3xd_v;
     read_sht31_sample(&sht3xd_v);
 
@@ -289,9 +302,9 @@ void report_data() {
     int16_t light_v = read_ambient_light();
 
     char json[256];
-    snprintf(json,
+    int len = snprintf(json,
              sizeof(json),
-             "AT+SEND1 {\"temperature\":%.1f,\"humidity\":%.1f,\"light\":%d,\"acceleration_x\":%.1f,\"acceleration_y\":%.1f,\"acceleration_z\":%.1f,\"angular_velocity_x\":%.3f,\"angular_velocity_y\":%.3f,\"angular_velocity_z\":%.3f}\n",
+             "{\"temperature\":%.1f,\"humidity\":%.1f,\"light\":%d,\"acceleration_x\":%.1f,\"acceleration_y\":%.1f,\"acceleration_z\":%.1f,\"angular_velocity_x\":%.3f,\"angular_velocity_y\":%.3f,\"angular_velocity_z\":%.3f}",
              sht3xd_v.temperature,
              sht3xd_v.humidity,
              light_v,
@@ -301,7 +314,7 @@ void report_data() {
              lsm6dsl_v.angular_velocity_x,
              lsm6dsl_v.angular_velocity_y,
              lsm6dsl_v.angular_velocity_z);
-    expresslink_send_command(json, NULL, 0);
+    mqtt_journal_publish(&topics[0], 1, json, MIN(len, sizeof(json) - 1));
 }
 
 static void init_ui_display() {
@@ -316,15 +329,16 @@ static void cleanup_ui_display() {
 }
 
 void digital_twin_and_shadow(void *context, void *dummy1, void *dummy2) {
-    expresslink_response = k_malloc(expresslink_response_length);
+    expresslink_response = expresslink_buffer_alloc(K_SECONDS(1));
     if (expresslink_response == NULL) {
-        LOG_ERR("k_malloc failed!");
+        LOG_ERR("no buffer for expresslink_response available!");
         return;
     }
 
     init_ui_display();
 
-    expresslink_reset();
+    subscribe_expresslink_events();
+    mqtt_connection_acquire(&profile);
 
     int64_t last_update_time = k_uptime_get();
     int64_t last_user_led_blink_time = k_uptime_get();
@@ -332,9 +346,10 @@ void digital_twin_and_shadow(void *context, void *dummy1, void *dummy2) {
     while (true) {
         if (shutdown_request_received()) {
             LOG_INF("Shutting down 'Digital Twin and Shadow' module.");
-            expresslink_reset();
+            unsubscribe_expresslink_events();
+            mqtt_connection_release(&profile);
 
-            k_free(expresslink_response);
+            expresslink_buffer_free(expresslink_response);
             expresslink_response = NULL;
 
             cleanup_ui_display();
@@ -350,10 +365,6 @@ void digital_twin_and_shadow(void *context, void *dummy1, void *dummy2) {
 
         display_handler();
 
-        if (expresslink_check_event_pending()) {
-            handle_expresslink_event();
-        }
-
         if (send_sensor_data && k_uptime_get() > last_update_time + 100) {
             last_update_time = k_uptime_get();
             report_data();
@@ -9,11 +9,13 @@
 #include <zephyr/fs/fs.h>
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
 LOG_MODULE_REGISTER(image_transfer);
 
 #include <lvgl.h>
 
 #include "badge.h"
+#include "image_codec.h"
 
 #define IMAGE_HEIGHT (240U)
 #define IMAGE_WIDTH (240U)
@@ -22,7 +24,10 @@ LOG_MODULE_REGISTER(image_transfer);
 #define ROW_SIZE (IMAGE_WIDTH * 2U) // one full row of pixels, allows for line-by-line rendering
 #define BLOCK_SIZE (ROW_SIZE * ROWS_TO_BUFFER)
 
+#define PROGRESS_INTERVAL_MS (250U)
+
 #define TRANSFERRED_IMAGE_PATH USB_PATH("transferred_image.bin")
+#define BENCHMARK_IMAGE_PATH USB_PATH("image_benchmark.bin")
 
 static lv_obj_t *preload = NULL;
 static lv_obj_t *picture = NULL;
@@ -30,60 +35,93 @@ static lv_obj_t *progress_label = NULL;
 
 // data payload is hex encoded = 2 hex digits for one payload byte
 // max size: 'OK ' + length + data[BLOCK_SIZE*2] + checksum
-static const size_t expresslink_response_length = 64 + BLOCK_SIZE * 2;
+BUILD_ASSERT(64 + BLOCK_SIZE * 2 <= EXPRESSLINK_BUFFER_SIZE, "AT+OTA READ response does not fit into a pool buffer");
 static char *expresslink_response = NULL;
 
-size_t render_row(size_t y) {
-    char cmd[48];
-
-    snprintf(cmd, sizeof(cmd), "AT+OTA SEEK %u\n", (uint32_t)(y * ROW_SIZE));
-    expresslink_send_command(cmd, expresslink_response, expresslink_response_length);
+// set by the OTA event handler, the download itself runs on the module thread
+static volatile bool ota_in_progress = false;
+static volatile bool ota_proposed = false;
+static volatile bool ota_arrived = false;
 
-    snprintf(cmd, sizeof(cmd), "AT+OTA READ %u\n", BLOCK_SIZE);
-    expresslink_send_command(cmd, expresslink_response, expresslink_response_length);
+static struct expresslink_ota_download download;
 
-    // find the space character that separates bytes-count prefix from data
-    char *start = strchr(expresslink_response, ' ') + 1;
-    // ignore 4-hex-digit checksum at the end of the line
+// the pixels are either uncompressed at the start of the OTA image, or encoded behind the header of a compressed image
+static bool compressed = false;
+static size_t pixels_offset = 0;
+static size_t pixels_length = IMG_DATA_SIZE;
+static struct image_decoder decoder;
+static uint8_t decoded_rows[BLOCK_SIZE] __aligned(4);
 
+// stays open for the whole transfer, blocks are converted into the row buffer and written with one call
+struct image_file {
     struct fs_file_t file;
-    fs_file_t_init(&file);
-    int ret = fs_open(&file, TRANSFERRED_IMAGE_PATH, FS_O_WRITE);
-    if (ret != 0) {
-        LOG_ERR("fs_open failed: %d", ret);
+    bool open;
+    int error; // of the first failed write while rendering, the file is not written after it
+    uint32_t writes;
+    int64_t write_time; // milliseconds spent in fs_write()
+    uint16_t rows[IMAGE_WIDTH * ROWS_TO_BUFFER] __aligned(4);
+};
+static struct image_file image_file;
+
+// the progress label is updated at a low rate, not for every block: LVGL renders the whole label area each time
+static atomic_t progress_due;
+
+static void progress_timer_cb(struct k_timer *timer) {
+    atomic_set(&progress_due, 1);
+}
+K_TIMER_DEFINE(progress_timer, progress_timer_cb, NULL);
+
+// pixel data in RGB565 bits across two bytes: RRRRRGGG GGGBBBBB, sent high byte first;
+// LVGL image files and the display take native uint16_t pixels, i.e. low byte first
+static void convert_pixels(uint16_t *out, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len / 2; i++) {
+        out[i] = (data[i * 2] << 8) + data[i * 2 + 1];
     }
-    ret = fs_seek(&file, sizeof(lv_img_header_t) + y * ROW_SIZE, FS_SEEK_SET); // lv_img_header_t = 4-byte file header for LVGL
-    if (ret != 0) {
-        LOG_ERR("fs_seek failed: %d", ret);
+}
+
+static int write_converted(struct image_file *f, const uint16_t *pixels, size_t len) {
+    int64_t start = k_uptime_get();
+    int ret = fs_write(&f->file, pixels, len);
+    f->write_time += k_uptime_get() - start;
+    f->writes++;
+    if (ret != len) {
+        LOG_ERR("fs_write failed %d", ret);
+        return ret < 0 ? ret : -EIO;
     }
+    return 0;
+}
 
-    // we retrieved one row of pixel data, one row is IMAGE_WIDTH pixels,
-    // each pixel is 16 bit or 2 bytes, over serial, they come in as hex-encoded,
-    // 2 bytes = 4 hex digits = 4 characters to read,
-    // decode two hex digits to one byte, then repeat for a second byte === one pixel with 16 bit
-    // pixel data in RGB565 bits across two bytes: RRRRRGGG GGGBBBBB
-    for (size_t r = 0; r < ROWS_TO_BUFFER; r++) {
-        LOG_INF("rendering row %d...", y + r);
-        for (size_t x = 0; x < IMAGE_WIDTH; x++) {
-            size_t i = r * ROW_SIZE * 2 + x * 4;
-            uint16_t v = (HEX_TO_BYTE(start[i], start[i + 1]) << 8) + (HEX_TO_BYTE(start[i + 2], start[i + 3]));
-
-            ret = fs_write(&file, (void *)&v, sizeof(v));
-            if (ret != 2) {
-                LOG_ERR("fs_write failed %d", ret);
-            }
-        }
+static int write_pixels(size_t offset, const uint8_t *data, size_t len, void *user_data) {
+    struct image_file *f = user_data;
+
+    if (len % 2 != 0) {
+        LOG_ERR("odd number of bytes at %u", (uint32_t)offset);
+        return -EINVAL;
     }
 
-    ret = fs_close(&file);
+    int ret = fs_seek(&f->file, sizeof(lv_img_header_t) + offset, FS_SEEK_SET); // lv_img_header_t = 4-byte file header for LVGL
     if (ret != 0) {
-        LOG_ERR("fs_close failed: %d", ret);
+        LOG_ERR("fs_seek failed: %d", ret);
+        return ret;
     }
 
-    return ROWS_TO_BUFFER;
+    while (len > 0) {
+        size_t n = MIN(len, sizeof(f->rows));
+        convert_pixels(f->rows, data, n);
+        ret = write_converted(f, f->rows, n);
+        if (ret != 0) {
+            return ret;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
 }
 
 void update_progress(size_t rows_buffered, float render_progress) {
+    if (!atomic_cas(&progress_due, 1, 0)) {
+        return;
+    }
     float p = ((float)rows_buffered) / ((float)IMAGE_HEIGHT) * 100.0;
     char msg[128];
     snprintf(msg, sizeof(msg), "buffering: %d %%\nrendering: %3.0f %%", (int)p, render_progress);
@@ -91,24 +129,140 @@ void update_progress(size_t rows_buffered, float render_progress) {
     display_handler();
 }
 
-void fetch_image(void) {
+// converted pixels of up to ROWS_TO_BUFFER rows, the panel is set up for low byte first (ram-param in the devicetree)
+static uint16_t display_rows[IMAGE_WIDTH * ROWS_TO_BUFFER] __aligned(4);
+
+// the image file is written from the same rows if it is open, a failed write does not stop the rendering
+static int draw_rows(size_t offset, const uint8_t *data, size_t len, void *user_data) {
+    struct image_file *f = user_data;
+    // placed like show_picture() does
+    uint16_t image_x = (lv_disp_get_hor_res(NULL) - IMAGE_WIDTH) / 2;
+
+    if (len % 2 != 0) {
+        LOG_ERR("odd number of bytes at %u", (uint32_t)offset);
+        return -EINVAL;
+    }
+
+    bool store = f->open && f->error == 0;
+    if (store) {
+        f->error = fs_seek(&f->file, sizeof(lv_img_header_t) + offset, FS_SEEK_SET);
+    }
+
+    // blocks are not aligned to rows, split ones start or end in the middle of a row
+    while (len > 0) {
+        size_t column = offset % ROW_SIZE;
+        size_t n = column == 0 && len >= ROW_SIZE ? MIN(len / ROW_SIZE * ROW_SIZE, sizeof(display_rows)) : MIN(len, ROW_SIZE - column);
+        uint16_t width = column == 0 && len >= ROW_SIZE ? IMAGE_WIDTH : n / 2;
+
+        convert_pixels(display_rows, data, n);
+        int ret = draw_pixels(image_x + column / 2, offset / ROW_SIZE, width, n / 2 / width, display_rows);
+        if (ret != 0) {
+            LOG_ERR("draw_pixels failed: %d", ret);
+            return ret;
+        }
+        if (store && f->error == 0) {
+            f->error = write_converted(f, display_rows, n);
+        }
+        offset += n;
+        data += n;
+        len -= n;
+    }
+
+    size_t rows = offset / ROW_SIZE;
+    update_progress(rows, (float)rows / IMAGE_HEIGHT * 100.0);
+    return 0;
+}
+
+// uncompressed images only
+int store_rows(struct expresslink_ota_download *download, size_t y) {
+    // ROWS_TO_BUFFER rows of IMAGE_WIDTH pixels, each pixel is 16 bit or 2 bytes,
+    // verified and decoded from hex by the OTA download
+    LOG_INF("storing rows %d to %d...", y, y + ROWS_TO_BUFFER - 1);
+    download->user_data = &image_file;
+    return expresslink_ota_read(download, y * ROW_SIZE, BLOCK_SIZE);
+}
+
+static int decode_pixels(size_t offset, const uint8_t *data, size_t len, void *user_data) {
+    return image_decoder_write(user_data, data, len);
+}
+
+// the pixels of the image are passed to sink in order, compressed images are decoded on the way
+static void set_pixel_sink(expresslink_ota_sink_cb sink, void *user_data) {
+    if (compressed) {
+        image_decoder_init(&decoder, IMAGE_WIDTH * IMAGE_HEIGHT, decoded_rows, sizeof(decoded_rows), sink, user_data);
+        download.sink = decode_pixels;
+        download.user_data = &decoder;
+    } else {
+        download.sink = sink;
+        download.user_data = user_data;
+    }
+}
+
+static int finish_pixels(void) {
+    return compressed ? image_decoder_finish(&decoder) : 0;
+}
+
+static int copy_header(size_t offset, const uint8_t *data, size_t len, void *user_data) {
+    memcpy((uint8_t *)user_data + offset, data, len);
+    return 0;
+}
+
+// compressed images start with a header, anything else is taken as uncompressed RGB565 pixels
+static int read_image_format(void) {
+    uint8_t data[IMAGE_HEADER_SIZE];
+    download.sink = copy_header;
+    download.user_data = data;
+    int ret = expresslink_ota_read(&download, 0, sizeof(data));
+    if (ret != 0) {
+        return ret;
+    }
+
+    struct image_header header;
+    ret = image_header_parse(data, sizeof(data), &header);
+    compressed = ret == 0;
+    if (ret == -ENOMSG) {
+        pixels_offset = 0;
+        pixels_length = IMG_DATA_SIZE;
+        return 0;
+    }
+    if (ret != 0) {
+        LOG_ERR("invalid image header: %d", ret);
+        return ret;
+    }
+    if (header.width != IMAGE_WIDTH || header.height != IMAGE_HEIGHT) {
+        LOG_ERR("unsupported image size %ux%u", header.width, header.height);
+        return -ENOTSUP;
+    }
+
+    pixels_offset = IMAGE_HEADER_SIZE;
+    pixels_length = header.length;
+    LOG_INF("Compressed image: %u bytes instead of %u%s", header.length, (uint32_t)IMG_DATA_SIZE, header.flags & IMAGE_FLAG_LOSSY ? ", lossy" : "");
+    return 0;
+}
+
+static int open_image_file(struct image_file *f, const char *path) {
     int ret;
 
-    struct fs_file_t file;
-    fs_file_t_init(&file);
-    ret = fs_open(&file, TRANSFERRED_IMAGE_PATH, FS_O_CREATE | FS_O_WRITE);
+    fs_file_t_init(&f->file);
+    f->error = 0;
+    f->writes = 0;
+    f->write_time = 0;
+    ret = fs_open(&f->file, path, FS_O_CREATE | FS_O_WRITE);
     if (ret != 0) {
         LOG_ERR("fs_open failed: %d", ret);
+        return ret;
     }
-    ret = fs_truncate(&file, 0);
+    f->open = true;
+
+    ret = fs_truncate(&f->file, 0);
     if (ret != 0) {
         LOG_ERR("fs_truncate to 0 failed: %d", ret);
     }
-    ret = fs_truncate(&file, sizeof(lv_img_header_t) + IMG_DATA_SIZE);
+    ret = fs_truncate(&f->file, sizeof(lv_img_header_t) + IMG_DATA_SIZE);
     if (ret != 0) {
         LOG_ERR("fs_truncate to IMG_DATA_SIZE failed: %d", ret);
     }
-    ret = fs_seek(&file, 0, FS_SEEK_SET);
+    ret = fs_seek(&f->file, 0, FS_SEEK_SET);
     if (ret != 0) {
         LOG_ERR("fs_seek to 0 failed: %d", ret);
     }
@@ -117,18 +271,56 @@ void fetch_image(void) {
     header.cf = LV_IMG_CF_TRUE_COLOR;
     header.h = IMAGE_HEIGHT;
     header.w = IMAGE_WIDTH;
-    ret = fs_write(&file, &header, sizeof(header));
+    ret = fs_write(&f->file, &header, sizeof(header));
     if (ret != sizeof(header)) {
         LOG_ERR("fs_write of lv_img_header_t header failed: %d", ret);
+        return ret < 0 ? ret : -EIO;
     }
 
-    ret = fs_close(&file);
+    // LVGL reads the file while it is being written
+    return fs_sync(&f->file);
+}
+
+static void close_image_file(struct image_file *f) {
+    if (!f->open) {
+        return;
+    }
+    f->open = false;
+
+    int ret = fs_close(&f->file);
     if (ret != 0) {
         LOG_ERR("fs_close failed: %d", ret);
     }
+}
 
-    picture = show_picture(TRANSFERRED_IMAGE_PATH);
+// AT+OTA FLUSH discards a failed image, so the next job starts from scratch
+static void finish_image(bool success) {
+    k_timer_stop(&progress_timer);
+    close_image_file(&image_file);
+    expresslink_send_command(success ? "AT+OTA CLOSE\n" : "AT+OTA FLUSH\n", NULL, 0);
+    ota_in_progress = false;
+    if (success) {
+        LOG_INF("AWS IoT Job completed!");
+    }
+}
 
+static void fail_image(int ret) {
+    LOG_ERR("Image download failed: %d", ret);
+    lv_label_set_text(progress_label, "Image download failed!");
+    display_handler();
+    finish_image(false);
+}
+
+static void show_complete(void) {
+    expresslink_ota_log_stats(&download);
+    char msg[64];
+    snprintf(msg, sizeof(msg), "Image complete!\n%u bytes/s%s", expresslink_ota_bytes_per_second(&download), compressed ? " compressed" : "");
+    lv_label_set_text(progress_label, msg);
+    display_handler();
+}
+
+// uncompressed images are stored interlaced, the rows spread across the picture early on
+static int store_interlaced(void) {
     size_t rows_buffered = 0;
 
     const uint8_t row_bundle_0[] = {0, 16, 32, 48, 64, 80, 96, 112, 128, 144, 160, 176, 192, 208, 224};
@@ -138,24 +330,195 @@ void fetch_image(void) {
     const uint8_t *rows[] = {row_bundle_0, row_bundle_1, row_bundle_2, row_bundle_3};
     const size_t rows_lengths[] = {sizeof(row_bundle_0), sizeof(row_bundle_1), sizeof(row_bundle_2), sizeof(row_bundle_3)};
 
+    download.sink = write_pixels;
     for (size_t i = 0; i < sizeof(*rows); i++) {
         for (size_t j = 0; j < rows_lengths[i]; j++) {
-            rows_buffered += render_row(rows[i][j]);
+            int ret = store_rows(&download, rows[i][j]);
+            if (ret != 0) {
+                return ret;
+            }
+            rows_buffered += ROWS_TO_BUFFER;
             float render_progress = (float)j / rows_lengths[i] * 100.0;
             update_progress(rows_buffered, render_progress);
         }
 
+        fs_sync(&image_file.file);
         k_msleep(50);
         lv_obj_invalidate(picture); // similar to lv_img_set_src(picture, TRANSFERRED_IMAGE_PATH); // calling to too often leads to memory fragmentation and eventually render errors doe to OOM issues in LVGL
         display_handler();
     }
+    return 0;
+}
 
-    lv_label_set_text(progress_label, "Image complete!");
-    display_handler();
+// compressed images can only be decoded from the start, the picture is refreshed after every quarter
+static int store_sequential(void) {
+    size_t end = pixels_offset + pixels_length;
+    size_t refreshed = 0;
+
+    set_pixel_sink(write_pixels, &image_file);
+    for (size_t offset = pixels_offset; offset < end; offset += BLOCK_SIZE) {
+        size_t length = MIN(BLOCK_SIZE, end - offset);
+        int ret = expresslink_ota_read(&download, offset, length);
+        if (ret != 0) {
+            return ret;
+        }
+        update_progress(decoder.offset / ROW_SIZE, (float)(offset + length - pixels_offset) / pixels_length * 100.0);
+
+        size_t quarter = (offset + length - pixels_offset) * 4 / pixels_length;
+        if (quarter > refreshed || offset + length == end) {
+            refreshed = quarter;
+            if (offset + length == end) {
+                ret = finish_pixels();
+                if (ret != 0) {
+                    return ret;
+                }
+            }
+            fs_sync(&image_file.file);
+            lv_obj_invalidate(picture); // see store_interlaced()
+            display_handler();
+        }
+    }
+    return 0;
+}
 
-    expresslink_send_command("AT+OTA CLOSE\n", NULL, 0);
-    LOG_INF("AWS IoT Job completed!");
+// renders the image through the image file, LVGL reads and decodes the whole file again after every refresh
+static void fetch_image_via_file(void) {
+    int ret = open_image_file(&image_file, TRANSFERRED_IMAGE_PATH);
+    if (ret != 0) {
+        fail_image(ret);
+        return;
+    }
+    picture = show_picture(TRANSFERRED_IMAGE_PATH);
+
+    expresslink_ota_begin(&download, expresslink_response, EXPRESSLINK_BUFFER_SIZE, NULL, NULL);
+    ret = read_image_format();
+    if (ret == 0) {
+        ret = compressed ? store_sequential() : store_interlaced();
+    }
+    if (ret != 0) {
+        fail_image(ret);
+        return;
+    }
+
+    show_complete();
+    LOG_INF("Image downloaded and rendered, %u writes in %lld ms", image_file.writes, image_file.write_time);
+    finish_image(true);
+}
+
+// renders the rows straight to the display as they arrive, the image file is written from the same blocks
+static void fetch_image_direct(void) {
+    display_handler(); // LVGL must not repaint the area of the deleted spinner over the first rows later on
+
+    if (IS_ENABLED(CONFIG_IMAGE_TRANSFER_PERSIST)) {
+        int ret = open_image_file(&image_file, TRANSFERRED_IMAGE_PATH);
+        if (ret != 0) {
+            image_file.error = ret;
+        }
+    }
+
+    // the next block is read by the ExpressLink I/O thread while the current one is drawn
+    expresslink_ota_begin(&download, expresslink_response, EXPRESSLINK_BUFFER_SIZE, NULL, NULL);
+    expresslink_ota_enable_prefetch(&download);
+    int ret = read_image_format();
+    if (ret == 0) {
+        set_pixel_sink(draw_rows, &image_file);
+        ret = expresslink_ota_read(&download, pixels_offset, pixels_length);
+    }
+    if (ret == 0) {
+        ret = finish_pixels();
+    }
+    if (ret != 0) {
+        fail_image(ret);
+        return;
+    }
+
+    show_complete();
     LOG_INF("Image downloaded and rendered!");
+
+    if (image_file.open && image_file.error != 0) {
+        LOG_ERR("Storing the image failed: %d", image_file.error);
+        close_image_file(&image_file);
+        fs_unlink(TRANSFERRED_IMAGE_PATH);
+    } else if (image_file.open) {
+        LOG_INF("Image stored: %s, %u writes in %lld ms", TRANSFERRED_IMAGE_PATH, image_file.writes, image_file.write_time);
+    }
+    finish_image(true);
+}
+
+void fetch_image(void) {
+    k_timer_start(&progress_timer, K_NO_WAIT, K_MSEC(PROGRESS_INTERVAL_MS));
+    if (IS_ENABLED(CONFIG_IMAGE_TRANSFER_DIRECT_RENDER)) {
+        fetch_image_direct();
+    } else {
+        fetch_image_via_file();
+    }
+}
+
+// how the image file used to be written: opened for every row bundle, one fs_write() per pixel
+static int write_rows_per_pixel(size_t y, const uint8_t *data, uint32_t *writes) {
+    struct fs_file_t file;
+    fs_file_t_init(&file);
+    int ret = fs_open(&file, BENCHMARK_IMAGE_PATH, FS_O_WRITE);
+    if (ret != 0) {
+        return ret;
+    }
+    ret = fs_seek(&file, sizeof(lv_img_header_t) + y * ROW_SIZE, FS_SEEK_SET);
+    for (size_t i = 0; ret == 0 && i < BLOCK_SIZE; i += 2) {
+        uint16_t v = (data[i] << 8) + data[i + 1];
+        (*writes)++;
+        if (fs_write(&file, (void *)&v, sizeof(v)) != sizeof(v)) {
+            ret = -EIO;
+        }
+    }
+    fs_close(&file);
+    return ret;
+}
+
+// Writes a synthetic image to the USB mass storage volume, the way the image file used to be written and row-batched.
+int image_transfer_benchmark(const struct shell *sh) {
+    static struct image_file f;
+    static uint8_t block[BLOCK_SIZE];
+
+    for (size_t i = 0; i < sizeof(block); i++) {
+        block[i] = i * 7;
+    }
+
+    int ret = open_image_file(&f, BENCHMARK_IMAGE_PATH);
+    close_image_file(&f);
+    if (ret != 0) {
+        shell_error(sh, "Creating %s failed: %d", BENCHMARK_IMAGE_PATH, ret);
+        return ret;
+    }
+
+    uint32_t writes = 0;
+    int64_t start = k_uptime_get();
+    for (size_t y = 0; ret == 0 && y < IMAGE_HEIGHT; y += ROWS_TO_BUFFER) {
+        ret = write_rows_per_pixel(y, block, &writes);
+    }
+    int64_t per_pixel_time = k_uptime_get() - start;
+    if (ret != 0) {
+        shell_error(sh, "Writing per pixel failed: %d", ret);
+        fs_unlink(BENCHMARK_IMAGE_PATH);
+        return ret;
+    }
+
+    start = k_uptime_get();
+    ret = open_image_file(&f, BENCHMARK_IMAGE_PATH);
+    for (size_t y = 0; ret == 0 && y < IMAGE_HEIGHT; y += ROWS_TO_BUFFER) {
+        ret = write_pixels(y * ROW_SIZE, block, BLOCK_SIZE, &f);
+    }
+    close_image_file(&f);
+    int64_t batched_time = k_uptime_get() - start;
+    fs_unlink(BENCHMARK_IMAGE_PATH);
+    if (ret != 0) {
+        shell_error(sh, "Writing row-batched failed: %d", ret);
+        return ret;
+    }
+
+    shell_print(sh, "Image of %ux%u pixels (%u bytes):", IMAGE_WIDTH, IMAGE_HEIGHT, (uint32_t)IMG_DATA_SIZE);
+    shell_print(sh, "  per pixel:   %6u writes, %5lld ms", writes, per_pixel_time);
+    shell_print(sh, "  row-batched: %6u writes, %5lld ms (%lld ms in fs_write)", f.writes, batched_time, f.write_time);
+    return 0;
 }
 
 static void init_ui_display() {
@@ -171,6 +534,7 @@ static void init_ui_display() {
 static void cleanup_ui_display() {
     delete_picture();
     picture = NULL;
+    lv_obj_invalidate(lv_scr_act()); // drawn past LVGL by fetch_image_direct()
     if (preload) {
         lv_obj_del(preload);
         preload = NULL;
@@ -182,25 +546,59 @@ static void cleanup_ui_display() {
     display_handler();
 }
 
+static void handle_connected(void *user_data) {
+    LOG_INF("Waiting for OTA jobs...");
+}
+
+// OTA jobs are delivered by ExpressLink itself, no topics are needed
+static const struct mqtt_profile profile = {
+    .name = WORKSHOP_MODULE_IMAGE_TRANSFER,
+    .connected = handle_connected,
+};
+
+static void handle_ota(const struct expresslink_event *event, void *user_data) {
+    if (event->parameter == 2 && !ota_in_progress) {
+        LOG_INF("New Host OTA image proposed!");
+        expresslink_send_command("AT+OTA ACCEPT\n", NULL, 0);
+        ota_in_progress = true;
+        ota_proposed = true;
+    } else if (event->parameter == 5) {
+        LOG_INF("Host OTA image arrived!");
+        ota_arrived = true;
+    }
+}
+
 void image_transfer(void *context, void *dummy1, void *dummy2) {
-    expresslink_response = k_malloc(expresslink_response_length);
+    expresslink_response = expresslink_buffer_alloc(K_SECONDS(1));
     if (expresslink_response == NULL) {
-        LOG_ERR("k_malloc for expresslink_response failed!");
+        LOG_ERR("no buffer for expresslink_response available!");
         return;
     }
 
     init_ui_display();
 
-    expresslink_reset();
+    ota_in_progress = false;
+    ota_proposed = false;
+    ota_arrived = false;
+    expresslink_event_subscribe(EL_EVENT_OTA, handle_ota, NULL);
 
-    bool ota_in_progress = false;
+    mqtt_connection_acquire(&profile);
 
     while (true) {
         if (shutdown_request_received()) {
             LOG_INF("Shutting down 'Image Transfer' module.");
 
-            expresslink_reset();
-            k_free(expresslink_response);
+            expresslink_event_unsubscribe(handle_ota);
+
+            k_timer_stop(&progress_timer);
+            close_image_file(&image_file);
+            if (ota_in_progress) {
+                // discard the partially received image, so the next job starts from scratch
+                expresslink_send_command("AT+OTA FLUSH\n", NULL, 0);
+            }
+            mqtt_connection_release(&profile);
+
+            expresslink_buffer_free(expresslink_response);
             expresslink_response = NULL;
 
             cleanup_ui_display();
@@ -209,55 +607,30 @@ void image_transfer(void *context, void *dummy1, void *dummy2) {
 
         display_handler();
 
-        if (!expresslink_check_event_pending()) {
-            k_msleep(10);
-            continue;
+        if (ota_proposed) {
+            ota_proposed = false;
+
+            lv_label_set_text(progress_label, "Downloading image...");
+
+            // clean up any previous image
+            delete_picture();
+            picture = NULL;
+            lv_obj_invalidate(lv_scr_act());
+
+            preload = lv_spinner_create(lv_scr_act(), 1000, 60);
+            lv_obj_set_size(preload, 150, 150);
+            lv_obj_center(preload);
         }
 
-        expresslink_send_command("AT+EVENT?\n", expresslink_response, expresslink_response_length);
-        if (expresslink_is_event(expresslink_response, EL_EVENT_STARTUP)) {
-            expresslink_send_command("AT+CONNECT!\n", NULL, 0);
-        } else if (expresslink_is_event(expresslink_response, EL_EVENT_CONLOST)) {
-            LOG_INF("CONLOST EVENT received! Reconnecting ...");
-            expresslink_send_command("AT+CONNECT!\n", NULL, 0);
-        } else if (expresslink_is_event(expresslink_response, EL_EVENT_CONNECT)) {
-            int parameter = atoi(expresslink_response + 2);
-            if (parameter == 0) {
-                LOG_INF("Successfully connected to AWS IoT Core!");
-                LOG_INF("Waiting for OTA jobs...");
-            } else {
-                LOG_INF("Connection attempt failed! Reconnecting...");
-                k_msleep(3000);
-                expresslink_send_command("AT+CONNECT!\n", NULL, 0);
-            }
-        } else if (expresslink_is_event(expresslink_response, EL_EVENT_OTA)) {
-            int parameter = atoi(expresslink_response + 2);
-            if (parameter == 2 && !ota_in_progress) {
-                LOG_INF("New Host OTA image proposed!");
-                expresslink_send_command("AT+OTA ACCEPT\n", NULL, 0);
-
-                ota_in_progress = true;
-
-                lv_label_set_text(progress_label, "Downloading image...");
-
-                // clean up any previous image
-                delete_picture();
-                picture = NULL;
-
-                preload = lv_spinner_create(lv_scr_act(), 1000, 60);
-                lv_obj_set_size(preload, 150, 150);
-                lv_obj_center(preload);
-            } else if (parameter == 5) {
-                LOG_INF("Host OTA image arrived!");
-                if (preload) {
-                    lv_obj_del(preload);
-                    preload = NULL;
-                }
-                fetch_image();
-                ota_in_progress = false;
+        if (ota_arrived) {
+            ota_arrived = false;
+            if (preload) {
+                lv_obj_del(preload);
+                preload = NULL;
             }
-        } else {
-            LOG_INF("Ignoring unhandled ExpressLink event: %s", expresslink_response);
+            fetch_image();
         }
+
+        k_msleep(10);
     }
 }
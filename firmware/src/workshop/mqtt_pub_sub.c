@@ -15,12 +15,39 @@ LOG_MODULE_REGISTER(mqtt_pub_sub);
 
 #include "badge.h"
 
-static const size_t expresslink_response_length = 512;
-static char *expresslink_response = NULL;
+static char expresslink_response[128]; // the topic line of AT+GET, event thread only
+#define MAX_BACKLOG_MESSAGES 16 // fetched after an OVERRUN event of the module
+
+// Messages are received on the ExpressLink event thread and rendered on the module thread,
+// they are handed over as copies, so neither thread touches a buffer the other one is using.
+#define MESSAGE_DISPLAY_LENGTH 512
+struct c2d_message {
+    uint16_t count;
+    char text[MESSAGE_DISPLAY_LENGTH]; // the part of the message that is shown on the display
+};
+K_MSGQ_DEFINE(c2d_msgq, sizeof(struct c2d_message), 2, 4);
+static struct c2d_message received; // event thread only
+static size_t message_length = 0;
 
 static uint16_t d2c_count = 0;
 static uint16_t c2d_count = 0;
 
+static const struct mqtt_topic topics[] = {
+    {1, "hello/badge", false, .priority = 1, .drop = MQTT_DROP_NEWEST},
+    {2, "hello/cloud", true},
+    {3, "hello/world", true},
+};
+
+// button messages are queued, so the UI stays responsive while the modem is busy,
+// presses beyond the queue length are rejected instead of replacing earlier ones
+static void publish_button(uint8_t button) {
+    char payload[50];
+    int len = snprintf(payload, sizeof(payload), "{\"event_type\":\"button_pressed\",\"value\":%d}", button);
+    if (mqtt_queue_publish(&topics[0], 0, payload, len) != 0) {
+        LOG_WRN("Publish queue full, button %d not sent.", button);
+    }
+}
+
 static lv_obj_t *label_title = NULL;
 #define LABEL_TITLE_X 0
 #define LABEL_TITLE_Y 20
@@ -105,9 +132,9 @@ static void update_d2c(uint8_t button, uint16_t cnt) {
     display_handler();
 }
 
-static void update_c2d(char *msg, uint16_t cnt) {
-    lv_label_set_text_fmt(label_c2d_cnt, "%d", cnt);
-    lv_textarea_set_text(ta_c2d_msg, expresslink_response);
+static void update_c2d(const struct c2d_message *message) {
+    lv_label_set_text_fmt(label_c2d_cnt, "%d", message->count);
+    lv_textarea_set_text(ta_c2d_msg, message->text);
     display_handler();
 }
 
@@ -143,24 +170,99 @@ static void cleanup_ui_display() {
     display_handler();
 }
 
-void mqtt_pub_sub(void *context, void *dummy1, void *dummy2) {
-    expresslink_response = k_malloc(expresslink_response_length);
-    if (expresslink_response == NULL) {
-        LOG_ERR("k_malloc for expresslink_response failed!");
-        return;
+static void handle_connected(void *user_data) {
+    expresslink_send_command("AT+SEND1 {\"event_type\":\"connected\",\"value\":\"Fiat Lux! Welcome!\"}\n", NULL, 0);
+    LOG_INF("MQTT connection established and sent a Welcome message to the cloud!");
+}
+
+// the message is streamed from the ExpressLink driver, only the part that fits on the display is kept
+static int store_message_chunk(const char *data, size_t len, bool end_of_line, void *user_data) {
+    if (message_length < sizeof(received.text) - 1) {
+        size_t n = MIN(len, sizeof(received.text) - 1 - message_length);
+        memcpy(received.text + message_length, data, n);
+        received.text[message_length + n] = 0;
+    }
+    message_length += len;
+    return 0;
+}
+
+// the most recent messages are shown, the oldest one is dropped if the module thread did not render it yet
+static void hand_over_message(void) {
+    while (k_msgq_put(&c2d_msgq, &received, K_NO_WAIT) != 0) {
+        static struct c2d_message dropped; // not on the stack of the event thread
+        k_msgq_get(&c2d_msgq, &dropped, K_NO_WAIT);
+    }
+}
+
+// returns false if there was no message
+static bool fetch_message(void) {
+    bool success = expresslink_send_command_multiline("AT+GET\n", expresslink_response, sizeof(expresslink_response));
+    if (success && isdigit((int)expresslink_response[0])) {
+        LOG_INF("Received MQTT message on topic %s", expresslink_response);
+        size_t additional_lines = atoi(expresslink_response);
+        message_length = 0;
+        received.text[0] = 0;
+        if (expresslink_stream_response_lines(additional_lines, store_message_chunk, NULL) == -EIO) {
+            LOG_WRN("MQTT message lost to a UART receive overrun.");
+            return true;
+        }
+        LOG_INF("%s", received.text);
+        if (message_length > sizeof(received.text) - 1) {
+            LOG_INF("Message truncated for display (%u bytes).", message_length);
+        }
+
+        // the display is updated from the module thread
+        c2d_count++;
+        received.count = c2d_count;
+        hand_over_message();
+        return true;
     }
+    return false;
+}
+
+static void handle_message(const struct expresslink_event *event, void *user_data) {
+    fetch_message();
+}
+
+// the MSG events of the messages buffered by the module might have been lost
+static size_t fetch_backlog(void *user_data) {
+    size_t count = 0;
+    while (count < MAX_BACKLOG_MESSAGES && fetch_message()) {
+        count++;
+    }
+    return count;
+}
+
+static const struct mqtt_profile profile = {
+    .name = WORKSHOP_MODULE_MQTT_PUB_SUB,
+    .topics = topics,
+    .topic_count = ARRAY_SIZE(topics),
+    .connected = handle_connected,
+    .overrun = fetch_backlog,
+};
+
+static void handle_ignored(const struct expresslink_event *event, void *user_data) {
+    // do nothing
+}
+
+void mqtt_pub_sub(void *context, void *dummy1, void *dummy2) {
+    static struct c2d_message message; // rendered by the module thread
 
     init_ui_display();
+    k_msgq_purge(&c2d_msgq);
+
+    expresslink_event_subscribe(EL_EVENT_MSG, handle_message, NULL);
+    expresslink_event_subscribe(EL_EVENT_SUBACK, handle_ignored, NULL);
+    expresslink_event_subscribe(EL_EVENT_OTA, handle_ignored, NULL);
 
-    expresslink_reset();
+    mqtt_connection_acquire(&profile);
 
     while (true) {
         if (shutdown_request_received()) {
             LOG_INF("Shutting down 'MQTT Publish/Subscribe' module.");
-            expresslink_reset();
-
-            k_free(expresslink_response);
-            expresslink_response = NULL;
+            expresslink_event_unsubscribe(handle_message);
+            expresslink_event_unsubscribe(handle_ignored);
+            mqtt_connection_release(&profile);
 
             cleanup_ui_display();
             return;
@@ -168,55 +270,12 @@ void mqtt_pub_sub(void *context, void *dummy1, void *dummy2) {
 
         display_handler();
 
-        if (expresslink_check_event_pending()) {
-            expresslink_send_command("AT+EVENT?\n", expresslink_response, expresslink_response_length);
-            if (expresslink_is_event(expresslink_response, EL_EVENT_STARTUP)) {
-                expresslink_send_command("AT+CONNECT!\n", NULL, 0);
-            } else if (expresslink_is_event(expresslink_response, EL_EVENT_CONLOST)) {
-                LOG_INF("CONLOST EVENT received! Reconnecting ...");
-                expresslink_send_command("AT+CONNECT!\n", NULL, 0);
-            } else if (expresslink_is_event(expresslink_response, EL_EVENT_CONNECT)) {
-                int parameter = atoi(expresslink_response + 2);
-                if (parameter == 0) {
-                    LOG_INF("Successfully connected to AWS IoT Core!");
-                    expresslink_send_command("AT+CONF Topic1=hello/badge\n", NULL, 0);
-                    expresslink_send_command("AT+CONF Topic2=hello/cloud\n", NULL, 0);
-                    expresslink_send_command("AT+CONF Topic3=hello/world\n", NULL, 0);
-                    expresslink_send_command("AT+SUBSCRIBE2\n", NULL, 0);
-                    expresslink_send_command("AT+SUBSCRIBE3\n", NULL, 0);
-                    expresslink_send_command("AT+SEND1 {\"event_type\":\"connected\",\"value\":\"Fiat Lux! Welcome!\"}\n", NULL, 0);
-                    LOG_INF("MQTT connection established and sent a Welcome message to the cloud!");
-                } else {
-                    LOG_INF("Connection attempt failed! Reconnecting...");
-                    k_msleep(3000);
-                    expresslink_send_command("AT+CONNECT!\n", NULL, 0);
-                }
-            } else if (expresslink_is_event(expresslink_response, EL_EVENT_MSG)) {
-                bool success = expresslink_send_command("AT+GET\n", expresslink_response, expresslink_response_length);
-                if (success && isdigit((int)expresslink_response[0])) {
-
-                    c2d_count++;
-
-                    LOG_INF("Received MQTT message on topic %s", expresslink_response);
-                    size_t additional_lines = atoi(expresslink_response);
-                    for (size_t i = 0; i < additional_lines; i++) {
-                        expresslink_read_response_line(expresslink_response, expresslink_response_length);
-                        LOG_INF("%s", expresslink_response);
-
-                        update_c2d(expresslink_response, c2d_count);
-                    }
-                }
-            } else if (expresslink_is_event(expresslink_response, EL_EVENT_SUBACK)) {
-                // do nothing
-            } else if (expresslink_is_event(expresslink_response, EL_EVENT_OTA)) {
-                // do nothing
-            } else {
-                LOG_INF("Ignoring unhandled ExpressLink event: %s", expresslink_response);
-            }
+        if (k_msgq_get(&c2d_msgq, &message, K_NO_WAIT) == 0) {
+            update_c2d(&message);
         }
 
         if (button1_pressed) {
-            expresslink_send_command("AT+SEND1 {\"event_type\":\"button_pressed\",\"value\":1}\n", NULL, 0);
+            publish_button(1);
             k_msleep(50); // lazy debounce
             button1_pressed = false;
 
@@ -224,7 +283,7 @@ void mqtt_pub_sub(void *context, void *dummy1, void *dummy2) {
             update_d2c(1, d2c_count);
         }
         if (button2_pressed) {
-            expresslink_send_command("AT+SEND1 {\"event_type\":\"button_pressed\",\"value\":2}\n", NULL, 0);
+            publish_button(2);
             k_msleep(50); // lazy debounce
             button2_pressed = false;
 
@@ -232,7 +291,7 @@ void mqtt_pub_sub(void *context, void *dummy1, void *dummy2) {
             update_d2c(2, d2c_count);
         }
         if (button3_pressed) {
-            expresslink_send_command("AT+SEND1 {\"event_type\":\"button_pressed\",\"value\":3}\n", NULL, 0);
+            publish_button(3);
             k_msleep(50); // lazy debounce
             button3_pressed = false;
 
@@ -240,7 +299,7 @@ void mqtt_pub_sub(void *context, void *dummy1, void *dummy2) {
             update_d2c(3, d2c_count);
         }
         if (button4_pressed) {
-            expresslink_send_command("AT+SEND1 {\"event_type\":\"button_pressed\",\"value\":4}\n", NULL, 0);
+            publish_button(4);
             k_msleep(50); // lazy debounce
             button4_pressed = false;
 
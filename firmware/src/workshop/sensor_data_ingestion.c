@@ -14,7 +14,8 @@ LOG_MODULE_REGISTER(sensor_data_ingestion);
 
 #include <lvgl.h>
 
-static char *expresslink_response = NULL;
+static volatile bool connected = false;
+static volatile enum mqtt_connection_state connection_state = MQTT_DISCONNECTED;
 
 static lv_obj_t *label_sensor_data_title = NULL;
 #define LABEL_TITLE_X 0
@@ -144,6 +145,32 @@ static void cleanup_ui_display() {
     display_handler();
 }
 
+static const struct mqtt_topic topics[] = {
+    {1, "$aws/rules/demo_badge_sensors", false, .drop = MQTT_DROP_OLDEST},
+};
+
+static void handle_connected(void *user_data) {
+    connected = true;
+}
+
+static void handle_disconnected(void *user_data) {
+    connected = false;
+}
+
+// shown instead of the last update time while not connected
+static void handle_connection_state(enum mqtt_connection_state state, int hint, void *user_data) {
+    connection_state = state;
+}
+
+static const struct mqtt_profile profile = {
+    .name = WORKSHOP_MODULE_SENSOR_DATA_INGESTION,
+    .topics = topics,
+    .topic_count = ARRAY_SIZE(topics),
+    .qos = 1,
+    .connected = handle_connected,
+    .disconnected = handle_disconnected,
+};
+
 void sensor_data_ingestion(void *p1, void *p2, void *p3) {
     int32_t update_rate = (int32_t)p1;
     if (update_rate == 0) {
@@ -152,89 +179,59 @@ void sensor_data_ingestion(void *p1, void *p2, void *p3) {
 
     LOG_INF("starting with update rate of %d ms...", update_rate);
 
-    // max size: 'OK ' + an error message
-    const size_t expresslink_response_length = 128;
-    expresslink_response = k_malloc(expresslink_response_length);
-    if (expresslink_response == NULL) {
-        LOG_ERR("k_malloc failed!");
-    }
-
-    size_t cmd_length = 128;
-    char *cmd = k_malloc(cmd_length);
-    if (cmd == NULL) {
-        LOG_ERR("k_malloc failed!");
-    }
+    static char payload[128]; // copied by mqtt_journal_publish()
+    size_t payload_length = sizeof(payload);
 
     init_ui_display();
 
-    expresslink_reset();
-
-    bool connected = false;
+    connected = false;
+    mqtt_connection_state_subscribe(handle_connection_state, NULL);
+    mqtt_connection_acquire(&profile);
 
     while (true) {
         if (shutdown_request_received()) {
             LOG_INF("Shutting down 'Sensor Data Ingestion' module.");
-            expresslink_reset();
-
-            k_free(expresslink_response);
-            expresslink_response = NULL;
-
-            k_free(cmd);
-            cmd = NULL;
+            mqtt_connection_release(&profile);
+            mqtt_connection_state_unsubscribe(handle_connection_state);
 
             cleanup_ui_display();
 
             return;
         }
 
-        if (expresslink_check_event_pending()) {
-            expresslink_send_command("AT+EVENT?\n", expresslink_response, expresslink_response_length);
-            if (expresslink_is_event(expresslink_response, EL_EVENT_STARTUP)) {
-                expresslink_send_command("AT+CONNECT!\n", NULL, 0);
-            } else if (expresslink_is_event(expresslink_response, EL_EVENT_CONLOST)) {
-                connected = false;
-                LOG_INF("CONLOST EVENT received! Reconnecting ...");
-                expresslink_send_command("AT+CONNECT!\n", NULL, 0);
-            } else if (expresslink_is_event(expresslink_response, EL_EVENT_CONNECT)) {
-                int parameter = atoi(expresslink_response + 2);
-                if (parameter == 0) {
-                    LOG_INF("Successfully connected to AWS IoT Core!");
-                    expresslink_send_command("AT+CONF Topic1=$aws/rules/demo_badge_sensors\n", NULL, 0);
-                    connected = true;
-                } else {
-                    connected = false;
-                    LOG_INF("Connection attempt failed! Reconnecting...");
-                    k_msleep(3000);
-                    expresslink_send_command("AT+CONNECT!\n", NULL, 0);
-                }
-            }
-        }
-
-        if (connected) {
-            sht3xd_sample v;
-            read_sht31_sample(&v);
-            int16_t light = read_ambient_light();
+        sht3xd_sample v;
+        read_sht31_sample(&v);
+        int16_t light = read_ambient_light();
 
-            snprintf(cmd,
-                    cmd_length,
-                    "AT+SEND1 {\"data\":{\"temperature\":%.1f,\"humidity\":%.1f,\"light\":%d,\"source\":\"mqtt\"}}\n",
-                    v.temperature,
-                    v.humidity,
-                    light);
-
-            update_ui_display(
+        int len = snprintf(payload,
+                payload_length,
+                "{\"data\":{\"temperature\":%.1f,\"humidity\":%.1f,\"light\":%d,\"source\":\"mqtt\"}}",
                 v.temperature,
                 v.humidity,
                 light);
 
-            LOG_INF("Sending updated sensor data...");
-            expresslink_send_command(cmd, NULL, 0);
-        }
+        update_ui_display(
+            v.temperature,
+            v.humidity,
+            light);
+
+        // samples are journaled while not connected and replayed with their timestamp later
+        LOG_INF("Sending updated sensor data...");
+        mqtt_journal_publish(&topics[0], 1, payload, MIN(len, payload_length - 1));
 
         const int64_t last_updated_at = k_uptime_get();
         const int64_t deadline = last_updated_at + update_rate;
+        // the module sleeps until the next sample once this one was acknowledged, if that is long enough
+        bool sleep_pending = IS_ENABLED(CONFIG_MQTT_DUTY_CYCLING);
         while (k_uptime_get() < deadline) {
-            lv_label_set_text_fmt(label_last, "last updated %.1fs ago...", MAX(0, k_uptime_get() - last_updated_at) / 1000.0f);
+            if (sleep_pending && connected) {
+                sleep_pending = (mqtt_connection_sleep_until(deadline) == -EBUSY);
+            }
+            if (connected || connection_state == MQTT_SLEEPING) {
+                lv_label_set_text_fmt(label_last, "last updated %.1fs ago...", MAX(0, k_uptime_get() - last_updated_at) / 1000.0f);
+            } else {
+                lv_label_set_text_fmt(label_last, "%s...", mqtt_connection_state_str(connection_state));
+            }
             display_handler();
             k_msleep(100);
         }
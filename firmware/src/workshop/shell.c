@@ -93,6 +93,10 @@ static int cmd_image_transfer(const struct shell *sh, size_t argc, char **argv)
     return 0;
 }
 
+static int cmd_image_benchmark(const struct shell *sh, size_t argc, char **argv) {
+    return image_transfer_benchmark(sh);
+}
+
 static int cmd_sidewalk(const struct shell *sh, size_t argc, char **argv) {
     run(WORKSHOP_MODULE_SIDEWALK, start_sidewalk_sample);
     return 0;
@@ -133,6 +137,7 @@ SHELL_STATIC_SUBCMD_SET_CREATE(sub_workshop,
 	SHELL_CMD(run, &sub_run, "Run a workshop module", NULL),
 	SHELL_CMD(stop, NULL, "Stop any running workshop module", cmd_stop),
 	SHELL_CMD(self_test, NULL, "Run Demo Badge self test", cmd_self_test),
+	SHELL_CMD(image_benchmark, NULL, "Compare per-pixel and row-batched writes of a transferred image to the USB mass storage volume", cmd_image_benchmark),
 	SHELL_SUBCMD_SET_END
 );
 
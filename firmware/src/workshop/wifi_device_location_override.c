@@ -19,7 +19,13 @@ LOG_MODULE_REGISTER(workshop_wifi_device_location_override);
 
 bool workshop_wifi_device_location_override(char *response, const size_t response_len) {
     int ret;
-    size_t buf_length = 1024;
+    // the file is read right behind the "OK " prefix of the response
+    const char prefix[] = "OK ";
+    if (response_len < sizeof(prefix)) {
+        return false;
+    }
+    char *buf = response + strlen(prefix);
+    size_t buf_length = MIN(1024, response_len - strlen(prefix));
 
     struct fs_dirent dirent;
     ret = fs_stat(WORKSHOP_WIFI_DEVICE_LOCATION_OVERRIDE_FILEPATH, &dirent);
@@ -39,18 +45,12 @@ bool workshop_wifi_device_location_override(char *response, const size_t respons
         return false;
     }
 
-    char *buf = k_malloc(buf_length);
-    if (buf == NULL) {
-        fs_close(&file);
-        return false;
-    }
     memset(buf, 0x0, buf_length);
 
     size_t read_len = fs_read(&file, buf, buf_length - 1);
     fs_close(&file);
 
     if (read_len == 1 && buf[0] == '\n') {
-        k_free(buf);
         return false;
     }
     if (read_len > 3 && buf[read_len - 1] == '\n') {
@@ -64,7 +64,6 @@ bool workshop_wifi_device_location_override(char *response, const size_t respons
 
     k_msleep(2000); // delay a bit to mimic the real behaviour of scanning for WiFi networks
 
-    snprintf(response, response_len, "OK %.*s", read_len, buf);
-    k_free(buf);
+    memcpy(response, prefix, strlen(prefix));
     return true;
 }
@@ -0,0 +1,384 @@
+#!/usr/bin/env python3
+
+# Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+# SPDX-License-Identifier: MIT-0
+
+"""
+Benchmark of the ExpressLink command sequences issued by the workshop modules.
+
+Each scenario replays the AT commands of one workshop module (see firmware/src/workshop/) the same way the
+firmware driver does: one command at a time, waiting for the response line and reading the additional lines
+of OKn responses, polling AT+EVENT? for events. By default the scenarios run against the simulator in this
+directory on a pseudo-terminal, pass --port to run them against a real ExpressLink module on a USB-UART adapter.
+
+    ./benchmark.py --latency 20 --jitter 5
+    ./benchmark.py --scenario image_transfer --json results.json
+    ./benchmark.py --port /dev/ttyUSB0 --scenario sensor_data_ingestion
+"""
+
+import argparse
+import json
+import os
+import select
+import statistics
+import sys
+import termios
+import time
+import tty
+
+from simulator import (
+    EVENT_CONNECT,
+    EVENT_MSG,
+    EVENT_OTA,
+    EVENT_PUBACK,
+    EVENT_SHADOW_INIT,
+    ExpressLinkSimulator,
+    PtyTransport,
+    command_verb,
+    parse_latency,
+)
+
+# commands with sub-commands of very different cost are reported separately, e.g. "AT+OTA READ" and "AT+OTA SEEK"
+DETAILED_VERBS = ("AT+OTA", "AT+SHADOW", "AT+BLE", "AT+DIAG")
+
+IMAGE_WIDTH = 240
+IMAGE_HEIGHT = 240
+ROWS_TO_BUFFER = 2
+ROW_SIZE = IMAGE_WIDTH * 2
+
+
+class ExpressLinkClient:
+    """Minimal AT host, mirrors the request/response handling of firmware/src/peripherals/expresslink.c."""
+
+    def __init__(self, path, baudrate=115200, timeout=120.0):
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        tty.setraw(self.fd)
+        attrs = termios.tcgetattr(self.fd)
+        speed = getattr(termios, "B{}".format(baudrate))
+        attrs[4] = attrs[5] = speed
+        termios.tcsetattr(self.fd, termios.TCSANOW, attrs)
+        self.timeout = timeout
+        self.buffer = b""
+        self.latencies = {}
+        self.errors = 0
+        self.bytes_tx = 0
+        self.bytes_rx = 0
+
+    def close(self):
+        os.close(self.fd)
+
+    def write(self, data):
+        self.bytes_tx += len(data)
+        while data:
+            written = os.write(self.fd, data)
+            data = data[written:]
+
+    def readline(self):
+        deadline = time.monotonic() + self.timeout
+        while b"\n" not in self.buffer:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                raise TimeoutError("no response from ExpressLink")
+            readable, _, _ = select.select([self.fd], [], [], remaining)
+            if readable:
+                data = os.read(self.fd, 4096)
+                self.bytes_rx += len(data)
+                self.buffer += data
+        line, self.buffer = self.buffer.split(b"\n", 1)
+        return line.decode(errors="replace").rstrip("\r")
+
+    def command(self, command):
+        """Sends one command, returns (success, response, additional lines)."""
+        start = time.monotonic()
+        self.write((command + "\n").encode())
+        response = self.readline()
+        lines = []
+        if response.startswith("OK") and response[2:3].isdigit():
+            count = int(response[2:].split(" ", 1)[0])
+            lines = [self.readline() for _ in range(count)]
+        latency = (time.monotonic() - start) * 1000.0
+        verb = command_verb(command)
+        if verb in DETAILED_VERBS:
+            verb = " ".join(command.split(" ")[:2])
+        self.latencies.setdefault(verb, []).append(latency)
+
+        success = response.startswith("OK")
+        if not success:
+            self.errors += 1
+        return success, response[3:] if response.startswith("OK ") else response, lines
+
+    def poll_event(self):
+        _, response, _ = self.command("AT+EVENT?")
+        if not response or response == "OK":
+            return None
+        event_id, parameter = response.split(" ")[:2]
+        return int(event_id), int(parameter)
+
+    def wait_for_event(self, event_id, timeout=30.0, poll_interval=0.01):
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            event = self.poll_event()
+            if event is None:
+                time.sleep(poll_interval)
+            elif event[0] == event_id:
+                return event
+        raise TimeoutError("event {} not received".format(event_id))
+
+    def connect(self):
+        self.command("AT+CONNECT!")
+        self.wait_for_event(EVENT_CONNECT)
+
+
+def scenario_mqtt_pub_sub(client, simulator, iterations):
+    client.connect()
+    client.command("AT+CONF Topic1=hello/badge")
+    client.command("AT+CONF Topic2=hello/cloud")
+    client.command("AT+CONF Topic3=hello/world")
+    client.command("AT+SUBSCRIBE2")
+    client.command("AT+SUBSCRIBE3")
+    client.command('AT+SEND1 {"event_type":"connected","value":"Fiat Lux! Welcome!"}')
+    for i in range(iterations):
+        client.command('AT+SEND1 {{"event_type":"button_pressed","value":{}}}'.format(i % 4 + 1))
+        if simulator is not None:
+            simulator.inject_message(2, '{"message":"hello from the cloud %d"}' % i)
+            client.wait_for_event(EVENT_MSG)
+            client.command("AT+GET")
+
+
+def scenario_sensor_data_ingestion(client, simulator, iterations):
+    client.connect()
+    client.command("AT+CONF Topic1=$aws/rules/demo_badge_sensors")
+    for i in range(iterations):
+        client.command('AT+SEND1 {"data":{"temperature":23.4,"humidity":45.6,"light":%d,"source":"mqtt"}}' % i)
+
+
+def scenario_device_location(client, simulator, iterations):
+    client.connect()
+    _, thing_name, _ = client.command("AT+CONF? ThingName")
+    client.command("AT+CONF Topic1=$aws/device_location/%s/get_position_estimate" % thing_name)
+    client.command("AT+CONF Topic2=$aws/device_location/%s/get_position_estimate/accepted" % thing_name)
+    client.command("AT+CONF Topic3=$aws/device_location/%s/get_position_estimate/rejected" % thing_name)
+    client.command("AT+SUBSCRIBE2")
+    client.command("AT+SUBSCRIBE3")
+    for _ in range(iterations):
+        _, scan, _ = client.command("AT+DIAG WIFI SCAN MacAddress Rss")
+        client.command("AT+SEND1 " + scan)
+        if simulator is not None:
+            simulator.inject_message(2, '{"coordinates":[-122.33,47.61]}')
+            client.wait_for_event(EVENT_MSG)
+            client.command("AT+GET")
+
+
+def scenario_digital_twin_and_shadow(client, simulator, iterations):
+    client.connect()
+    client.command("AT+CONF Topic1=demo_badge/sensors")
+    client.command("AT+CONF EnableShadow=1")
+    client.command("AT+SHADOW INIT")
+    client.wait_for_event(EVENT_SHADOW_INIT)
+    client.command("AT+SHADOW SUBSCRIBE")
+    client.command('AT+SHADOW UPDATE {"state":{"reported":{"button_1":0,"button_2":0,"button_3":0,"button_4":0}}}')
+    client.command("AT+SHADOW DOC")
+    client.command("AT+SHADOW GET DOC")
+    for i in range(iterations):
+        client.command('AT+SEND1 {"temperature":23.4,"humidity":45.6,"light":%d,"acceleration_x":0.1,"acceleration_y":0.2,"acceleration_z":9.8}' % i)
+        client.command('AT+SHADOW UPDATE {"state":{"reported":{"button_%d":%d}}}' % (i % 4 + 1, i))
+        client.command("AT+SHADOW GET UPDATE")
+        if simulator is not None:
+            simulator.inject_shadow_delta('{"state":{"led_1":"%d"}}' % (i * 1000))
+        client.command("AT+SHADOW GET DELTA")
+
+
+def scenario_image_transfer(client, simulator, iterations):
+    client.connect()
+    if simulator is not None:
+        simulator.inject_ota(bytes(i & 0xFF for i in range(IMAGE_WIDTH * IMAGE_HEIGHT * 2)))
+    client.wait_for_event(EVENT_OTA)
+    client.command("AT+OTA ACCEPT")
+    client.wait_for_event(EVENT_OTA)
+    for y in range(0, IMAGE_HEIGHT, ROWS_TO_BUFFER):
+        client.command("AT+OTA SEEK %d" % (y * ROW_SIZE))
+        client.command("AT+OTA READ %d" % (ROW_SIZE * ROWS_TO_BUFFER))
+    client.command("AT+OTA CLOSE")
+
+
+def scenario_ble_sensor_peripheral(client, simulator, iterations):
+    client.command('AT+CONF BLEPeripheral={"appearance": "4142"}')
+    client.command('AT+CONF BLEGATT1={"service": "181A", "chr": "2A6E", "read":1, "notify":1 }')
+    client.command('AT+CONF BLEGATT2={"service": "181A", "chr": "2A6F", "read":1, "notify":1 }')
+    client.command("AT+BLE INIT PERIPHERAL")
+    client.command("AT+BLE ADVERTISE")
+    for i in range(iterations):
+        client.command("AT+BLE SET1 %04x" % (2340 + i))
+        client.command("AT+BLE SET2 %04x" % (4560 + i))
+
+
+def scenario_module_switch(client, simulator, iterations):
+    # same sequence as mqtt_connection_release() and mqtt_connection_acquire(), switching from mqtt_pub_sub to
+    # sensor_data_ingestion and back without resetting the module
+    client.connect()
+    client.command("AT+CONF Topic1=hello/badge")
+    client.command("AT+CONF Topic2=hello/cloud")
+    client.command("AT+CONF Topic3=hello/world")
+    client.command("AT+SUBSCRIBE2")
+    client.command("AT+SUBSCRIBE3")
+    for _ in range(iterations):
+        start = time.monotonic()
+        client.command("AT+UNSUBSCRIBE2")
+        client.command("AT+UNSUBSCRIBE3")
+        client.command("AT+GET")
+        client.command("AT+CONNECT?")
+        client.command("AT+CONF Topic1=$aws/rules/demo_badge_sensors")
+        client.command('AT+SEND1 {"data":{"temperature":23.4,"humidity":45.6,"light":0,"source":"mqtt"}}')
+        client.latencies.setdefault("switch to publish", []).append((time.monotonic() - start) * 1000.0)
+
+        client.command("AT+CONNECT?")
+        client.command("AT+CONF Topic1=hello/badge")
+        client.command("AT+SUBSCRIBE2")
+        client.command("AT+SUBSCRIBE3")
+
+
+def scenario_qos1_window(client, simulator, iterations):
+    # same pattern as mqtt_publish() with CONFIG_MQTT_PUBLISH_WINDOW=4: keep sending while fewer than 4
+    # messages wait for their PUBACK, measure the time from AT+SEND to the PUBACK event
+    window = 4
+    client.connect()
+    client.command("AT+CONF QoS=1")
+    client.command("AT+CONF Topic1=$aws/rules/demo_badge_sensors")
+    in_flight = []
+    sent = 0
+    while sent < iterations or in_flight:
+        if sent < iterations and len(in_flight) < window:
+            in_flight.append(time.monotonic())
+            client.command('AT+SEND1 {"data":{"temperature":23.4,"humidity":45.6,"light":%d,"source":"mqtt"}}' % sent)
+            sent += 1
+            continue
+        event = client.wait_for_event(EVENT_PUBACK)
+        if event[1] == 1:
+            client.latencies.setdefault("publish to PUBACK", []).append((time.monotonic() - in_flight.pop(0)) * 1000.0)
+    client.command("AT+CONF QoS=0")
+
+
+def scenario_otw_update(client, simulator, iterations):
+    # same framing as expresslink_firmware_update(): 128-byte writes, one OK per block
+    size = 64 * 1024
+    block_size = 2048
+    client.command("AT+OTW %d,%d" % (size, block_size))
+    start = time.monotonic()
+    chunk = bytes(128)
+    for count in range(128, size + 1, 128):
+        client.write(chunk)
+        if count % block_size == 0:
+            response = client.readline()
+            if not response.startswith("OK"):
+                raise RuntimeError("OTW failed: " + response)
+    response = client.readline()
+    client.latencies.setdefault("OTW transfer", []).append((time.monotonic() - start) * 1000.0)
+    if response != "OK COMPLETE":
+        raise RuntimeError("OTW failed: " + response)
+
+
+SCENARIOS = {
+    "mqtt_pub_sub": scenario_mqtt_pub_sub,
+    "sensor_data_ingestion": scenario_sensor_data_ingestion,
+    "device_location": scenario_device_location,
+    "digital_twin_and_shadow": scenario_digital_twin_and_shadow,
+    "image_transfer": scenario_image_transfer,
+    "ble_sensor_peripheral": scenario_ble_sensor_peripheral,
+    "module_switch": scenario_module_switch,
+    "qos1_window": scenario_qos1_window,
+    "otw_update": scenario_otw_update,
+}
+
+
+def percentile(samples, p):
+    samples = sorted(samples)
+    return samples[min(len(samples) - 1, int(len(samples) * p / 100.0))]
+
+
+def run_scenario(name, path, simulator, iterations):
+    if simulator is not None:
+        simulator.reset()
+    client = ExpressLinkClient(path)
+    try:
+        if simulator is None:
+            # real module: start from a clean state
+            client.command("AT+RESET")
+            time.sleep(2.5)
+        start = time.monotonic()
+        SCENARIOS[name](client, simulator, iterations)
+        duration = time.monotonic() - start
+    finally:
+        client.close()
+
+    commands = sum(len(v) for v in client.latencies.values())
+    return {
+        "scenario": name,
+        "duration_s": round(duration, 3),
+        "commands": commands,
+        "commands_per_s": round(commands / duration, 1) if duration > 0 else 0,
+        "errors": client.errors,
+        "bytes_tx": client.bytes_tx,
+        "bytes_rx": client.bytes_rx,
+        "latency_ms": {
+            verb: {
+                "count": len(samples),
+                "p50": round(statistics.median(samples), 2),
+                "p95": round(percentile(samples, 95), 2),
+                "max": round(max(samples), 2),
+            }
+            for verb, samples in sorted(client.latencies.items())
+        },
+    }
+
+
+def print_result(result):
+    print("")
+    print("{scenario}: {commands} commands in {duration_s} s ({commands_per_s} commands/s), {errors} errors, "
+          "TX {bytes_tx} bytes, RX {bytes_rx} bytes".format(**result))
+    print("  {:<20} {:>7} {:>9} {:>9} {:>9}".format("command", "count", "p50 ms", "p95 ms", "max ms"))
+    for verb, latency in result["latency_ms"].items():
+        print("  {:<20} {:>7} {:>9.2f} {:>9.2f} {:>9.2f}".format(verb, latency["count"], latency["p50"], latency["p95"], latency["max"]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark the workshop module ExpressLink command sequences")
+    parser.add_argument("--scenario", action="append", choices=sorted(SCENARIOS), help="scenario to run, may be repeated (default: all)")
+    parser.add_argument("--iterations", type=int, default=20, help="number of publish/update iterations per scenario")
+    parser.add_argument("--port", help="serial port of a real ExpressLink module instead of the simulator")
+    parser.add_argument("--latency", action="append", help="simulator response latency in ms, either for all commands or per verb (e.g. AT+SEND=80)")
+    parser.add_argument("--jitter", type=float, default=0.0, help="simulator latency jitter in ms (+/-)")
+    parser.add_argument("--connect-time", type=float, default=500.0, help="simulator connection time in ms")
+    parser.add_argument("--seed", type=int, default=42, help="simulator random seed")
+    parser.add_argument("--json", help="write the results to this file, e.g. to compare runs")
+    args = parser.parse_args()
+
+    simulator = None
+    transport = None
+    path = args.port
+    if path is None:
+        latency, latency_per_verb = parse_latency(args.latency)
+        simulator = ExpressLinkSimulator(latency, latency_per_verb, args.jitter, args.connect_time, seed=args.seed)
+        transport = PtyTransport(simulator)
+        transport.start()
+        path = transport.slave_path
+
+    results = []
+    try:
+        for name in args.scenario or SCENARIOS:
+            if simulator is None and name in ("image_transfer",):
+                print("skipping {}: needs event injection from the simulator".format(name), file=sys.stderr)
+                continue
+            result = run_scenario(name, path, simulator, args.iterations)
+            print_result(result)
+            results.append(result)
+    finally:
+        if transport is not None:
+            transport.stop()
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(results, f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
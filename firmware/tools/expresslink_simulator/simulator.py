@@ -0,0 +1,528 @@
+#!/usr/bin/env python3
+
+# Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+# SPDX-License-Identifier: MIT-0
+
+"""
+Host-side AWS IoT ExpressLink simulator.
+
+Speaks the ExpressLink AT protocol on a pseudo-terminal, so host tools (and the benchmark in this directory)
+can be exercised without the physical module. Every command is answered after a configurable latency and jitter,
+events can be injected interactively, from a script, or through the Python API.
+
+    ./simulator.py --latency 20 --jitter 5
+    ./simulator.py --latency AT+SEND=80 --latency AT+OTA=15 --script events.txt
+
+Control commands (stdin or --script, each script line may be prefixed with a delay in milliseconds):
+
+    event <id> [parameter]       queue an event, e.g. "event 3" for CONLOST
+    message <topic> <payload>    queue an MQTT message on topic index <topic> and a MSG event
+    ota <file>                   propose a host OTA image (OTA event 2), it arrives after "AT+OTA ACCEPT" (OTA event 5)
+    delta <json>                 queue a shadow delta document and a SHADOW_DELTA event
+    conlost                      drop the connection and queue a CONLOST event
+    stats                        print the command statistics
+
+The ExpressLink EVENT pin cannot be emulated on a pty, hosts have to poll "AT+EVENT?".
+"""
+
+import argparse
+import os
+import random
+import select
+import statistics
+import sys
+import termios
+import threading
+import time
+import tty
+
+EVENT_MSG = 1
+EVENT_STARTUP = 2
+EVENT_CONLOST = 3
+EVENT_OTA = 5
+EVENT_CONNECT = 6
+EVENT_SUBACK = 8
+EVENT_PUBACK = 10
+EVENT_SHADOW_INIT = 20
+EVENT_SHADOW_DOC = 22
+EVENT_SHADOW_UPDATE = 23
+EVENT_SHADOW_DELTA = 24
+EVENT_SHADOW_SUBACK = 26
+
+EVENT_MNEMONICS = {
+    EVENT_MSG: "MSG",
+    EVENT_STARTUP: "STARTUP",
+    EVENT_CONLOST: "CONLOST",
+    EVENT_OTA: "OTA",
+    EVENT_CONNECT: "CONNECT",
+    EVENT_SUBACK: "SUBACK",
+    EVENT_PUBACK: "PUBACK",
+    EVENT_SHADOW_INIT: "SHADOW INIT",
+    EVENT_SHADOW_DOC: "SHADOW DOC",
+    EVENT_SHADOW_UPDATE: "SHADOW UPDATE",
+    EVENT_SHADOW_DELTA: "SHADOW DELTA",
+    EVENT_SHADOW_SUBACK: "SHADOW SUBACK",
+}
+
+OTA_STATE_PROPOSED = 2
+OTA_STATE_ARRIVED = 5
+
+DEFAULT_CONF = {
+    "About": "ExpressLink Simulator",
+    "Version": "2.4.4",
+    "TechSpec": "v2.1.1",
+    "ThingName": "simulated-badge",
+    "Endpoint": "example-ats.iot.us-east-1.amazonaws.com",
+}
+
+CERTIFICATE_LINES = ["-----BEGIN CERTIFICATE-----"] + ["MIIDWTCCAkGgAwIBAgIUSIMULATEDSIMULATEDSIMULATEDSIMULATEDSIMULATED"] * 18 + ["-----END CERTIFICATE-----"]
+
+
+def command_verb(command):
+    """'AT+SEND1 {...}' -> 'AT+SEND', 'AT+CONF? Version' -> 'AT+CONF?'"""
+    verb = command.split(" ", 1)[0]
+    return verb.rstrip("0123456789")
+
+
+def parse_latency(values):
+    """['20', 'AT+SEND=80'] -> (20.0, {'AT+SEND': 80.0})"""
+    default = 10.0
+    per_verb = {}
+    for value in values or []:
+        if "=" in value:
+            verb, ms = value.split("=", 1)
+            per_verb[verb] = float(ms)
+        else:
+            default = float(value)
+    return default, per_verb
+
+
+class ExpressLinkSimulator:
+    def __init__(self, latency=10.0, latency_per_verb=None, jitter=0.0, connect_time=500.0, wifi_networks=8, seed=None):
+        self.latency = latency
+        self.latency_per_verb = latency_per_verb or {}
+        self.jitter = jitter
+        self.connect_time = connect_time
+        self.wifi_networks = wifi_networks
+        self.random = random.Random(seed)
+
+        self.lock = threading.Lock()
+        self.stats = {}
+        self.bytes_rx = 0
+        self.bytes_tx = 0
+        self.reset()
+
+    def reset(self):
+        with self.lock:
+            self.conf = dict(DEFAULT_CONF)
+            self.connected = False
+            self.connect_pending_at = None
+            self.sleeping = False
+            self.sleeps = 0
+            self.events = [(EVENT_STARTUP, 0)]
+            self.messages = {}
+            self.shadow_doc = '{"state":{"reported":{}}}'
+            self.shadow_delta = None
+            self.shadow_update = None
+            self.ota_image = None
+            self.ota_accepted = False
+            self.ota_offset = 0
+            self.otw_remaining = 0
+            self.otw_block_size = 0
+            self.otw_block_received = 0
+
+    # event injection API, safe to call from any thread
+
+    def inject_event(self, event_id, parameter=0):
+        with self.lock:
+            self.events.append((event_id, parameter))
+
+    def inject_message(self, topic, payload):
+        with self.lock:
+            self.messages.setdefault(topic, []).append(payload)
+            self.events.append((EVENT_MSG, topic))
+
+    def inject_ota(self, image):
+        with self.lock:
+            self.ota_image = image
+            self.ota_accepted = False
+            self.ota_offset = 0
+            self.events.append((EVENT_OTA, OTA_STATE_PROPOSED))
+
+    def inject_shadow_delta(self, document):
+        with self.lock:
+            self.shadow_delta = document
+            self.events.append((EVENT_SHADOW_DELTA, 0))
+
+    def inject_conlost(self):
+        with self.lock:
+            self.connected = False
+            self.events.append((EVENT_CONLOST, 0))
+
+    # protocol
+
+    def response_delay(self, verb):
+        latency = self.latency_per_verb.get(verb, self.latency)
+        latency += self.random.uniform(-self.jitter, self.jitter)
+        return max(0.0, latency) / 1000.0
+
+    def record(self, verb, seconds):
+        entry = self.stats.setdefault(verb, [])
+        entry.append(seconds * 1000.0)
+
+    def handle_command(self, command):
+        """Returns the response lines for one AT command line (without line ending)."""
+        with self.lock:
+            self._update_connection()
+            # the WAKE pin cannot be emulated on a pty, any command wakes the module up
+            self.sleeping = False
+            if command == "AT":
+                return ["OK"]
+            if not command.startswith("AT+"):
+                return ["ERR2 PARSE ERROR"]
+
+            verb = command_verb(command)
+            argument = command[len(verb):]
+            index = ""
+            while argument[:1].isdigit():
+                index += argument[0]
+                argument = argument[1:]
+            argument = argument[1:] if argument.startswith(" ") else argument
+
+            handler = getattr(self, "_cmd_" + verb[3:].replace("?", "_query").replace("!", "_nonblocking").lower(), None)
+            if handler is None:
+                return ["ERR3 COMMAND NOT FOUND"]
+            return handler(index, argument)
+
+    def _update_connection(self):
+        if self.connect_pending_at is not None and time.monotonic() >= self.connect_pending_at:
+            self.connect_pending_at = None
+            self.connected = True
+            self.events.append((EVENT_CONNECT, 0))
+
+    def _cmd_connect(self, index, argument):
+        time.sleep(self.connect_time / 1000.0)
+        self.connected = True
+        return ["OK 1 CONNECTED"]
+
+    def _cmd_connect_nonblocking(self, index, argument):
+        self.connect_pending_at = time.monotonic() + self.connect_time / 1000.0
+        return ["OK"]
+
+    def _cmd_connect_query(self, index, argument):
+        return ["OK {} {}".format(1 if self.connected else 0, "CONNECTED" if self.connected else "DISCONNECTED")]
+
+    def _cmd_disconnect(self, index, argument):
+        self.connected = False
+        return ["OK"]
+
+    def _cmd_sleep(self, index, argument):
+        if argument and not argument.isdigit():
+            return ["ERR2 PARSE ERROR"]
+        # the connection is lost while sleeping, without a CONLOST event
+        self.connected = False
+        self.connect_pending_at = None
+        self.sleeping = True
+        self.sleeps += 1
+        return ["OK"]
+
+    def _cmd_reset(self, index, argument):
+        self.connected = False
+        self.events = [(EVENT_STARTUP, 0)]
+        return ["OK"]
+
+    def _cmd_factory_reset(self, index, argument):
+        self.conf = dict(DEFAULT_CONF)
+        return self._cmd_reset(index, argument)
+
+    def _cmd_event_query(self, index, argument):
+        if not self.events:
+            return ["OK"]
+        event_id, parameter = self.events.pop(0)
+        return ["OK {} {} {}".format(event_id, parameter, EVENT_MNEMONICS.get(event_id, ""))]
+
+    def _cmd_conf(self, index, argument):
+        if "=" not in argument:
+            return ["ERR2 PARSE ERROR"]
+        key, value = argument.split("=", 1)
+        self.conf[key] = value
+        return ["OK"]
+
+    def _cmd_conf_query(self, index, argument):
+        if argument == "Certificate pem":
+            return ["OK{}".format(len(CERTIFICATE_LINES))] + CERTIFICATE_LINES
+        if argument not in self.conf:
+            return ["ERR7 INVALID KEY NAME"]
+        return ["OK " + self.conf[argument]]
+
+    def _cmd_send(self, index, argument):
+        if not self.connected:
+            return ["ERR14 UNABLE TO CONNECT"]
+        if "Topic" + index not in self.conf:
+            return ["ERR6 INVALID INDEX"]
+        if self.conf.get("QoS") == "1":
+            self.events.append((EVENT_PUBACK, int(index)))
+        return ["OK"]
+
+    def _cmd_subscribe(self, index, argument):
+        if not self.connected:
+            return ["ERR14 UNABLE TO CONNECT"]
+        self.events.append((EVENT_SUBACK, int(index or 0)))
+        return ["OK"]
+
+    def _cmd_unsubscribe(self, index, argument):
+        return ["OK"]
+
+    def _cmd_get(self, index, argument):
+        topics = [int(index)] if index else sorted(self.messages)
+        for topic in topics:
+            if self.messages.get(topic):
+                payload = self.messages[topic].pop(0)
+                return ["OK1 " + self.conf.get("Topic{}".format(topic), str(topic)), payload]
+        return ["OK"]
+
+    def _cmd_shadow(self, index, argument):
+        if argument == "INIT":
+            self.events.append((EVENT_SHADOW_INIT, 0))
+            return ["OK"]
+        if argument == "SUBSCRIBE":
+            self.events.append((EVENT_SHADOW_SUBACK, 0))
+            return ["OK"]
+        if argument == "UNSUBSCRIBE":
+            return ["OK"]
+        if argument == "DOC":
+            self.events.append((EVENT_SHADOW_DOC, 0))
+            return ["OK"]
+        if argument.startswith("UPDATE "):
+            self.shadow_update = argument[len("UPDATE "):]
+            self.events.append((EVENT_SHADOW_UPDATE, 0))
+            return ["OK"]
+        if argument == "GET DOC":
+            return ["OK 1 " + self.shadow_doc]
+        if argument == "GET DELTA":
+            delta, self.shadow_delta = self.shadow_delta, None
+            return ["OK 1 " + delta] if delta else ["OK 0"]
+        if argument == "GET UPDATE":
+            update, self.shadow_update = self.shadow_update, None
+            return ["OK 1 " + update] if update else ["OK 0"]
+        return ["ERR2 PARSE ERROR"]
+
+    def _cmd_ota(self, index, argument):
+        words = argument.split()
+        if not words:
+            return ["ERR2 PARSE ERROR"]
+        if words[0] == "ACCEPT":
+            if self.ota_image is None:
+                return ["ERR18 NO OTA"]
+            self.ota_accepted = True
+            # the download from the cloud is not simulated, the image arrives immediately
+            self.events.append((EVENT_OTA, OTA_STATE_ARRIVED))
+            return ["OK"]
+        if words[0] == "SEEK":
+            self.ota_offset = int(words[1]) if len(words) > 1 else 0
+            return ["OK"]
+        if words[0] == "READ":
+            if not self.ota_accepted:
+                return ["ERR18 NO OTA"]
+            count = int(words[1])
+            data = self.ota_image[self.ota_offset:self.ota_offset + count]
+            self.ota_offset += len(data)
+            checksum = sum(data) & 0xFFFF
+            return ["OK {:x} {} {:04X}".format(len(data), data.hex().upper(), checksum)]
+        if words[0] in ("CLOSE", "FLUSH"):
+            self.ota_image = None
+            self.ota_accepted = False
+            return ["OK"]
+        return ["ERR2 PARSE ERROR"]
+
+    def _cmd_diag(self, index, argument):
+        if not argument.startswith("WIFI SCAN"):
+            return ["ERR3 COMMAND NOT FOUND"]
+        aps = []
+        for i in range(self.wifi_networks):
+            mac = ":".join("{:02x}".format((i * 37 + j * 11) & 0xFF) for j in range(6))
+            aps.append('{{"MacAddress":"{}","Rss":{}}}'.format(mac, -40 - i))
+        return ['OK {{"WiFiAccessPoints":[{}]}}'.format(",".join(aps))]
+
+    def _cmd_ble(self, index, argument):
+        return ["OK"]
+
+    def _cmd_otw(self, index, argument):
+        try:
+            size, block_size = (int(v) for v in argument.split(","))
+        except ValueError:
+            return ["ERR2 PARSE ERROR"]
+        self.otw_remaining = size
+        self.otw_block_size = block_size
+        self.otw_block_received = 0
+        return ["OK"]
+
+    def handle_otw_data(self, data):
+        """Consumes raw firmware bytes after AT+OTW, returns the response lines."""
+        responses = []
+        with self.lock:
+            for _ in range(len(data)):
+                self.otw_remaining -= 1
+                self.otw_block_received += 1
+                if self.otw_block_received == self.otw_block_size:
+                    self.otw_block_received = 0
+                    responses.append("OK")
+                if self.otw_remaining == 0:
+                    responses.append("OK COMPLETE")
+                    break
+        return responses
+
+    @property
+    def otw_active(self):
+        return self.otw_remaining > 0
+
+    def print_stats(self, file=sys.stderr):
+        print("{:<20} {:>7} {:>8} {:>8} {:>8}".format("command", "count", "p50 ms", "p95 ms", "max ms"), file=file)
+        for verb, samples in sorted(self.stats.items()):
+            samples = sorted(samples)
+            p95 = samples[min(len(samples) - 1, int(len(samples) * 0.95))]
+            print("{:<20} {:>7} {:>8.1f} {:>8.1f} {:>8.1f}".format(verb, len(samples), statistics.median(samples), p95, samples[-1]), file=file)
+        print("RX: {} bytes, TX: {} bytes".format(self.bytes_rx, self.bytes_tx), file=file)
+
+
+class PtyTransport:
+    """Runs the simulator on the master side of a pseudo-terminal, the host opens slave_path."""
+
+    def __init__(self, simulator, verbose=False):
+        self.simulator = simulator
+        self.verbose = verbose
+        self.master, self.slave = os.openpty()
+        tty.setraw(self.slave)
+        attrs = termios.tcgetattr(self.slave)
+        attrs[3] &= ~termios.ECHO
+        termios.tcsetattr(self.slave, termios.TCSANOW, attrs)
+        self.slave_path = os.ttyname(self.slave)
+        self.running = False
+        self.thread = None
+
+    def start(self):
+        self.running = True
+        self.thread = threading.Thread(target=self.run, daemon=True)
+        self.thread.start()
+
+    def stop(self):
+        self.running = False
+        if self.thread is not None:
+            self.thread.join()
+
+    def write_lines(self, lines):
+        data = "".join(line + "\r\n" for line in lines).encode()
+        self.simulator.bytes_tx += len(data)
+        os.write(self.master, data)
+        if self.verbose:
+            for line in lines:
+                print("< " + line[:120], file=sys.stderr)
+
+    def run(self):
+        buffer = b""
+        while self.running:
+            readable, _, _ = select.select([self.master], [], [], 0.1)
+            if not readable:
+                continue
+            data = os.read(self.master, 4096)
+            self.simulator.bytes_rx += len(data)
+            buffer += data
+
+            while buffer:
+                if self.simulator.otw_active:
+                    count = min(len(buffer), self.simulator.otw_remaining)
+                    responses = self.simulator.handle_otw_data(buffer[:count])
+                    buffer = buffer[count:]
+                    if responses:
+                        self.write_lines(responses)
+                    continue
+
+                end = buffer.find(b"\n")
+                if end < 0:
+                    break
+                line = buffer[:end].decode(errors="replace").rstrip("\r")
+                buffer = buffer[end + 1:]
+                if not line:
+                    continue
+                if self.verbose:
+                    print("> " + line[:120], file=sys.stderr)
+
+                verb = command_verb(line)
+                start = time.monotonic()
+                time.sleep(self.simulator.response_delay(verb))
+                responses = self.simulator.handle_command(line)
+                self.write_lines(responses)
+                self.simulator.record(verb, time.monotonic() - start)
+
+
+def run_control_command(simulator, line):
+    words = line.split(" ", 2)
+    if not words or not words[0]:
+        return
+    command = words[0]
+    if command == "event":
+        simulator.inject_event(int(words[1]), int(words[2]) if len(words) > 2 else 0)
+    elif command == "message":
+        simulator.inject_message(int(words[1]), words[2])
+    elif command == "ota":
+        with open(words[1], "rb") as f:
+            simulator.inject_ota(f.read())
+    elif command == "delta":
+        simulator.inject_shadow_delta(line.split(" ", 1)[1])
+    elif command == "conlost":
+        simulator.inject_conlost()
+    elif command == "stats":
+        simulator.print_stats()
+    else:
+        print("unknown control command: " + line, file=sys.stderr)
+
+
+def run_script(simulator, path):
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line or line.startswith("#"):
+                continue
+            delay, _, command = line.partition(" ")
+            if delay.isdigit():
+                time.sleep(int(delay) / 1000.0)
+            else:
+                command = line
+            run_control_command(simulator, command)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="AWS IoT ExpressLink simulator on a pseudo-terminal")
+    parser.add_argument("--latency", action="append", help="response latency in ms, either for all commands or per verb (e.g. AT+SEND=80), may be repeated")
+    parser.add_argument("--jitter", type=float, default=0.0, help="uniformly distributed latency jitter in ms (+/-)")
+    parser.add_argument("--connect-time", type=float, default=500.0, help="time to establish a connection in ms")
+    parser.add_argument("--wifi-networks", type=int, default=8, help="number of access points reported by AT+DIAG WIFI SCAN")
+    parser.add_argument("--script", help="control commands to run, one per line, optionally prefixed with a delay in ms")
+    parser.add_argument("--seed", type=int, help="random seed for reproducible jitter")
+    parser.add_argument("--verbose", action="store_true", help="log all commands and responses")
+    args = parser.parse_args()
+
+    latency, latency_per_verb = parse_latency(args.latency)
+    simulator = ExpressLinkSimulator(latency, latency_per_verb, args.jitter, args.connect_time, args.wifi_networks, args.seed)
+    transport = PtyTransport(simulator, args.verbose)
+    transport.start()
+    print("ExpressLink simulator listening on " + transport.slave_path, file=sys.stderr)
+
+    if args.script:
+        threading.Thread(target=run_script, args=(simulator, args.script), daemon=True).start()
+
+    try:
+        for line in sys.stdin:
+            run_control_command(simulator, line.strip())
+        # stdin closed, e.g. when running in the background
+        while True:
+            time.sleep(1)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        transport.stop()
+        simulator.print_stats()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,133 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+// Unit tests and microbenchmark of src/hex.c on the host, see README.md.
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hex.h"
+#include "test_harness.h"
+
+// the macro hex.c replaced, no validation
+#define HEX_TO_BYTE(_a, _b) (((((_a) % 32 + 9) % 25) << 4) + (((_b) % 32 + 9) % 25))
+
+// one AT+OTA READ block of the image transfer: 2 rows of 240 RGB565 pixels
+#define BLOCK_SIZE (960)
+#define IMAGE_BLOCKS (120)
+
+static void test_decode_byte(void) {
+    CHECK(hex_decode_byte('0', '0') == 0x00);
+    CHECK(hex_decode_byte('f', 'F') == 0xFF);
+    CHECK(hex_decode_byte('A', '5') == 0xA5);
+    CHECK(hex_decode_byte('5', '3') == 'S');
+
+    const char *invalid = "gG:/@` \n";
+    for (const char *c = invalid; *c; c++) {
+        CHECK(hex_decode_byte(*c, '0') == -EINVAL);
+        CHECK(hex_decode_byte('0', *c) == -EINVAL);
+    }
+    CHECK(hex_decode_byte((char)0x80, '0') == -EINVAL);
+    CHECK(hex_decode_byte('0', (char)0xB0) == -EINVAL); // '0' + 0x80
+}
+
+static void test_all_digits(void) {
+    // every byte value, both cases, compared with the old macro
+    for (int v = 0; v < 256; v++) {
+        char upper[3], lower[3];
+        snprintf(upper, sizeof(upper), "%02X", v);
+        snprintf(lower, sizeof(lower), "%02x", v);
+        CHECK(hex_decode_byte(upper[0], upper[1]) == v);
+        CHECK(hex_decode_byte(lower[0], lower[1]) == v);
+        CHECK(HEX_TO_BYTE(upper[0], upper[1]) == v);
+    }
+
+    // every character, 22 of them are hex digits
+    int valid = 0;
+    for (int c = 0; c < 256; c++) {
+        valid += hex_decode_byte((char)c, '0') >= 0;
+    }
+    CHECK(valid == 22);
+}
+
+static void test_decode(void) {
+    uint8_t out[8];
+    CHECK(hex_decode("", 0, out, sizeof(out)) == 0);
+    CHECK(hex_decode("0102abCD", 8, out, sizeof(out)) == 4);
+    CHECK(memcmp(out, "\x01\x02\xab\xcd", 4) == 0);
+
+    CHECK(hex_decode("012", 3, out, sizeof(out)) == -EINVAL);
+    CHECK(hex_decode("01x2", 4, out, sizeof(out)) == -EINVAL);
+    CHECK(hex_decode("0102", 4, out, 1) == -ENOBUFS);
+    // validated up to hex_length only
+    CHECK(hex_decode("0102zz", 4, out, sizeof(out)) == 2);
+}
+
+static void test_decode_in_place(void) {
+    char buffer[] = "53494430DEADbeef 1234";
+    CHECK(hex_decode(buffer, 16, (uint8_t *)buffer, sizeof(buffer)) == 8);
+    CHECK(memcmp(buffer, "SID0\xde\xad\xbe\xef", 8) == 0);
+    CHECK(strcmp(buffer + 16, " 1234") == 0); // untouched behind the digits
+
+    // invalid digit at the very end of a long buffer
+    static char block[BLOCK_SIZE * 2 + 1];
+    memset(block, 'a', BLOCK_SIZE * 2);
+    block[BLOCK_SIZE * 2 - 1] = 'g';
+    CHECK(hex_decode(block, BLOCK_SIZE * 2, (uint8_t *)block, BLOCK_SIZE) == -EINVAL);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void benchmark(int images) {
+    static char hex[BLOCK_SIZE * 2];
+    static uint8_t out[BLOCK_SIZE];
+    srand(42);
+    for (size_t i = 0; i < sizeof(hex); i++) {
+        hex[i] = "0123456789ABCDEF"[rand() % 16];
+    }
+
+    volatile uint8_t sink = 0;
+    double start = now();
+    for (int n = 0; n < images * IMAGE_BLOCKS; n++) {
+        for (size_t i = 0; i < BLOCK_SIZE; i++) {
+            out[i] = HEX_TO_BYTE(hex[i * 2], hex[i * 2 + 1]);
+        }
+        sink ^= out[n % BLOCK_SIZE];
+    }
+    double macro_time = now() - start;
+
+    start = now();
+    for (int n = 0; n < images * IMAGE_BLOCKS; n++) {
+        if (hex_decode(hex, sizeof(hex), out, sizeof(out)) != BLOCK_SIZE) {
+            failures++;
+        }
+        sink ^= out[n % BLOCK_SIZE];
+    }
+    double table_time = now() - start;
+
+    double mb = (double)images * IMAGE_BLOCKS * sizeof(hex) / 1e6;
+    printf("%d images, %.1f MB of hex:\n", images, mb);
+    printf("  HEX_TO_BYTE: %8.2f ms, %7.1f MB/s (no validation)\n", macro_time * 1e3, mb / macro_time);
+    printf("  hex_decode:  %8.2f ms, %7.1f MB/s\n", table_time * 1e3, mb / table_time);
+}
+
+int main(int argc, char **argv) {
+    test_decode_byte();
+    test_all_digits();
+    test_decode();
+    test_decode_in_place();
+    test_summary();
+
+    if (argc > 1 && strcmp(argv[1], "--benchmark") == 0) {
+        benchmark(argc > 2 ? atoi(argv[2]) : 100);
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,213 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+// Round-trip tests of src/image_codec.c on the host, see README.md.
+// encode() mirrors encodeImage() of companion_web_app/src/image_codec.ts.
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image_codec.h"
+#include "test_harness.h"
+
+#define WIDTH (240)
+#define HEIGHT (240)
+#define PIXELS (WIDTH * HEIGHT)
+#define ROW_BUFFER (2 * WIDTH * 2) // 2 rows, like image_transfer.c
+
+static int wrap(int d, int bits) {
+    int range = 1 << bits;
+    return ((d + range / 2) & (range - 1)) - range / 2;
+}
+
+static int floor_half(int d) {
+    return d >= 0 ? d / 2 : -((-d + 1) / 2);
+}
+
+static size_t encode(const uint16_t *pixels, size_t count, uint8_t *out, uint8_t flags) {
+    uint16_t index[64] = {0};
+    size_t o = IMAGE_HEADER_SIZE;
+    uint16_t previous = 0;
+    int run = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        uint16_t px = flags & IMAGE_FLAG_LOSSY ? pixels[i] & 0xF79E : pixels[i];
+        if (px == previous) {
+            if (++run == 62) {
+                out[o++] = 0xC0 | (run - 1);
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            out[o++] = 0xC0 | (run - 1);
+            run = 0;
+        }
+
+        int h = ((px >> 11) * 3 + ((px >> 5) & 0x3F) * 5 + (px & 0x1F) * 7) & 0x3F;
+        if (index[h] == px) {
+            out[o++] = h;
+        } else {
+            index[h] = px;
+            int dr = wrap((px >> 11) - (previous >> 11), 5);
+            int dg = wrap(((px >> 5) & 0x3F) - ((previous >> 5) & 0x3F), 6);
+            int db = wrap((px & 0x1F) - (previous & 0x1F), 5);
+            int drg = dr - floor_half(dg);
+            int dbg = db - floor_half(dg);
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                out[o++] = 0x40 | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2);
+            } else if (drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+                out[o++] = 0x80 | (dg + 32);
+                out[o++] = ((drg + 8) << 4) | (dbg + 8);
+            } else {
+                out[o++] = 0xFE;
+                out[o++] = px >> 8;
+                out[o++] = px & 0xFF;
+            }
+        }
+        previous = px;
+    }
+    if (run > 0) {
+        out[o++] = 0xC0 | (run - 1);
+    }
+
+    size_t length = o - IMAGE_HEADER_SIZE;
+    memcpy(out, "Q565", 4);
+    out[4] = WIDTH >> 8;
+    out[5] = WIDTH & 0xFF;
+    out[6] = HEIGHT >> 8;
+    out[7] = HEIGHT & 0xFF;
+    out[8] = flags;
+    out[9] = 0;
+    out[10] = length >> 24;
+    out[11] = length >> 16;
+    out[12] = length >> 8;
+    out[13] = length;
+    return o;
+}
+
+static uint8_t decoded[PIXELS * 2];
+static size_t decoded_length;
+
+static int collect(size_t offset, const uint8_t *data, size_t len, void *user_data) {
+    (void)user_data;
+    if (offset != decoded_length || offset + len > sizeof(decoded) || len > ROW_BUFFER) {
+        return -EFAULT;
+    }
+    memcpy(&decoded[offset], data, len);
+    decoded_length += len;
+    return 0;
+}
+
+// decodes in chunks of chunk bytes, like the blocks of AT+OTA READ
+static int decode(const uint8_t *image, size_t length, size_t chunk) {
+    static uint8_t rows[ROW_BUFFER];
+    struct image_header header;
+    struct image_decoder dec;
+
+    int ret = image_header_parse(image, length, &header);
+    if (ret != 0) {
+        return ret;
+    }
+    if (header.length != length - IMAGE_HEADER_SIZE) {
+        return -EINVAL;
+    }
+
+    decoded_length = 0;
+    image_decoder_init(&dec, header.width * header.height, rows, sizeof(rows), collect, NULL);
+    for (size_t i = IMAGE_HEADER_SIZE; i < length; i += chunk) {
+        ret = image_decoder_write(&dec, &image[i], i + chunk < length ? chunk : length - i);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+    return image_decoder_finish(&dec);
+}
+
+static int matches(const uint16_t *pixels, uint16_t mask) {
+    for (size_t i = 0; i < PIXELS; i++) {
+        if (((decoded[i * 2] << 8) | decoded[i * 2 + 1]) != (pixels[i] & mask)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static uint16_t pixels[PIXELS];
+static uint8_t encoded[IMAGE_HEADER_SIZE + PIXELS * 3];
+
+static void test_image(const char *name) {
+    size_t length = encode(pixels, PIXELS, encoded, 0);
+    const size_t chunks[] = {1, 2, 3, 7, 960, 1984, sizeof(encoded)};
+    for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+        CHECK(decode(encoded, length, chunks[c]) == 0);
+        CHECK(decoded_length == PIXELS * 2);
+        CHECK(matches(pixels, 0xFFFF));
+    }
+
+    size_t lossy_length = encode(pixels, PIXELS, encoded, IMAGE_FLAG_LOSSY);
+    CHECK(decode(encoded, lossy_length, 960) == 0);
+    CHECK(matches(pixels, 0xF79E));
+
+    printf("%-10s %6u bytes (%5.1fx), lossy %6u bytes (%5.1fx)\n", name,
+           (unsigned)length, PIXELS * 2.0 / length, (unsigned)lossy_length, PIXELS * 2.0 / lossy_length);
+}
+
+static uint16_t rgb(int r, int g, int b) {
+    return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+}
+
+static void test_corrupt(void) {
+    for (size_t i = 0; i < PIXELS; i++) {
+        pixels[i] = rgb(i % WIDTH, i / WIDTH, 128);
+    }
+    size_t length = encode(pixels, PIXELS, encoded, 0);
+
+    CHECK(decode(encoded, length - 1, 960) == -EINVAL || decode(encoded, length - 1, 960) == -ENODATA);
+
+    encoded[IMAGE_HEADER_SIZE + 5] = 0xFF;
+    CHECK(decode(encoded, length, 960) == -EINVAL);
+
+    encoded[0] = 'X';
+    CHECK(decode(encoded, length, 960) == -ENOMSG);
+
+    // more pixels than the header announces
+    encode(pixels, PIXELS, encoded, 0);
+    encoded[7] = HEIGHT - 1;
+    CHECK(decode(encoded, length, 960) == -EINVAL);
+}
+
+int main(void) {
+    srand(42);
+
+    for (size_t i = 0; i < PIXELS; i++) {
+        pixels[i] = rgb(i % WIDTH, i / WIDTH, (i % WIDTH + i / WIDTH) / 2);
+    }
+    test_image("gradient");
+
+    // a logo: flat areas and sharp edges
+    for (size_t i = 0; i < PIXELS; i++) {
+        int x = i % WIDTH - WIDTH / 2, y = i / WIDTH - HEIGHT / 2;
+        pixels[i] = x * x + y * y < 80 * 80 ? (abs(x) < 20 ? rgb(255, 153, 0) : rgb(35, 47, 62)) : rgb(255, 255, 255);
+    }
+    test_image("logo");
+
+    // a photo: smooth areas with sensor noise
+    for (size_t i = 0; i < PIXELS; i++) {
+        int x = i % WIDTH, y = i / WIDTH;
+        pixels[i] = rgb(100 + x / 4 + rand() % 8, 80 + y / 3 + rand() % 8, 60 + (x + y) / 8 + rand() % 8);
+    }
+    test_image("photo");
+
+    for (size_t i = 0; i < PIXELS; i++) {
+        pixels[i] = rand();
+    }
+    test_image("noise");
+
+    test_corrupt();
+
+    return test_summary();
+}
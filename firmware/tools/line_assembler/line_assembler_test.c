@@ -0,0 +1,157 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+// Tests of src/line_assembler.c on the host, see README.md.
+// The receive path of expresslink.c is modelled: the UART stores DMA chunks in a ring buffer which drops
+// what does not fit, and readline() copies out the contiguous spans of the ring as they arrive.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "line_assembler.h"
+#include "test_harness.h"
+
+#define RING_SIZE (4096)     // CONFIG_EXPRESSLINK_RX_RING_SIZE
+#define DMA_CHUNK (512)      // CONFIG_EXPRESSLINK_RX_DMA_BUFFER_SIZE
+#define LINE_LENGTH (4096)   // CONFIG_EXPRESSLINK_RESPONSE_LINE_LENGTH
+
+struct ring {
+    uint8_t data[RING_SIZE];
+    size_t head; // total bytes put
+    size_t tail; // total bytes consumed
+    size_t dropped;
+};
+
+// like ring_buf_put() from uart_cb
+static void ring_put(struct ring *r, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (r->head - r->tail == RING_SIZE) {
+            r->dropped += len - i;
+            return;
+        }
+        r->data[r->head++ % RING_SIZE] = data[i];
+    }
+}
+
+// like ring_buf_get_claim(), the span ends where the ring wraps around
+static size_t ring_claim(struct ring *r, uint8_t **span) {
+    size_t offset = r->tail % RING_SIZE;
+    size_t available = r->head - r->tail;
+    *span = &r->data[offset];
+    return available < RING_SIZE - offset ? available : RING_SIZE - offset;
+}
+
+// Sends stream in DMA chunks and reads lines like readline() after every chunk, i.e. the reader keeps up.
+// Returns the number of lines read into lines.
+static size_t receive(struct ring *r, const char *stream, size_t length, char lines[][LINE_LENGTH], size_t *dropped, size_t max_lines) {
+    static char buffer[LINE_LENGTH];
+    struct line_assembler line;
+    line_assembler_init(&line, buffer, sizeof(buffer));
+    size_t count = 0;
+
+    for (size_t sent = 0; sent < length;) {
+        size_t n = length - sent < DMA_CHUNK ? length - sent : DMA_CHUNK;
+        ring_put(r, (const uint8_t *)stream + sent, n);
+        sent += n;
+
+        uint8_t *span;
+        size_t span_length;
+        while ((span_length = ring_claim(r, &span)) > 0) {
+            r->tail += line_assembler_put(&line, span, span_length);
+            if (line.complete) {
+                if (count < max_lines) {
+                    strcpy(lines[count], line_assembler_finish(&line));
+                    dropped[count] = line.dropped;
+                }
+                count++;
+                line_assembler_init(&line, buffer, sizeof(buffer));
+            }
+        }
+    }
+    return count;
+}
+
+static char *make_line(size_t length, const char *ending) {
+    char *s = malloc(length + strlen(ending) + 1);
+    for (size_t i = 0; i < length; i++) {
+        s[i] = 'A' + i % 26;
+    }
+    strcpy(s + length, ending);
+    return s;
+}
+
+static void test_line_wrapping_around(size_t length) {
+    static struct ring r;
+    static char lines[2][LINE_LENGTH];
+    size_t dropped[2];
+    memset(&r, 0, sizeof(r));
+    r.head = r.tail = 1000; // the line wraps around the end of the ring
+
+    char *s = make_line(length, "\r\n");
+    size_t count = receive(&r, s, strlen(s), lines, dropped, 2);
+    CHECK(count == 1);
+    CHECK(r.dropped == 0);
+    CHECK(dropped[0] == 0);
+    CHECK(strlen(lines[0]) == length);
+    CHECK(memcmp(lines[0], s, length) == 0);
+    free(s);
+}
+
+static void test_line_longer_than_buffer(void) {
+    static struct ring r;
+    static char lines[2][LINE_LENGTH];
+    size_t dropped[2];
+    memset(&r, 0, sizeof(r));
+
+    // the line ending is still found, the line is truncated, and the next line is complete
+    char *s = make_line(LINE_LENGTH + 500, "\nOK\r\n");
+    size_t count = receive(&r, s, strlen(s), lines, dropped, 2);
+    CHECK(count == 2);
+    CHECK(strlen(lines[0]) == LINE_LENGTH - 1);
+    CHECK(dropped[0] == 500 + 1); // the rest of the line
+    CHECK(strcmp(lines[1], "OK") == 0);
+    CHECK(dropped[1] == 0);
+    free(s);
+}
+
+static void test_several_lines_per_span(void) {
+    static struct ring r;
+    static char lines[4][LINE_LENGTH];
+    size_t dropped[4];
+    memset(&r, 0, sizeof(r));
+
+    const char *s = "OK2 2 lines\r\nfirst\nsecond\r\n\r\n";
+    size_t count = receive(&r, s, strlen(s), lines, dropped, 4);
+    CHECK(count == 4);
+    CHECK(strcmp(lines[0], "OK2 2 lines") == 0);
+    CHECK(strcmp(lines[1], "first") == 0);
+    CHECK(strcmp(lines[2], "second") == 0);
+    CHECK(strcmp(lines[3], "") == 0);
+}
+
+static void test_carriage_return_inside_line(void) {
+    static char buffer[16];
+    struct line_assembler line;
+    line_assembler_init(&line, buffer, sizeof(buffer));
+
+    // only a carriage return right before the line ending is stripped, also if they arrive in different spans
+    CHECK(line_assembler_put(&line, (const uint8_t *)"a\rb\r", 4) == 4);
+    CHECK(!line.complete);
+    CHECK(line_assembler_put(&line, (const uint8_t *)"\nrest", 5) == 1);
+    CHECK(line.complete);
+    CHECK(line_assembler_put(&line, (const uint8_t *)"rest", 4) == 0);
+    CHECK(strcmp(line_assembler_finish(&line), "a\rb") == 0);
+}
+
+int main(void) {
+    test_line_wrapping_around(100);
+    test_line_wrapping_around(RING_SIZE / 2);
+    test_line_wrapping_around(LINE_LENGTH - 2); // the carriage return and the terminator fill the rest
+    test_line_longer_than_buffer(); // and longer than the ring
+    test_several_lines_per_span();
+    test_carriage_return_inside_line();
+
+    return test_summary();
+}
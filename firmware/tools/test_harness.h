@@ -0,0 +1,28 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+// Checks shared by the host tests in tools/, see README.md.
+
+#ifndef TEST_HARNESS_H
+#define TEST_HARNESS_H
+
+#include <stdio.h>
+
+static int failures = 0;
+
+// a failed check is reported and counted, the test goes on
+#define CHECK(_cond)                                                    \
+    do {                                                                \
+        if (!(_cond)) {                                                 \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #_cond);     \
+            failures++;                                                 \
+        }                                                               \
+    } while (0)
+
+// prints the result, returns the exit status of the test
+static inline int test_summary(void) {
+    printf("%s\n", failures ? "tests FAILED" : "tests passed");
+    return failures ? 1 : 0;
+}
+
+#endif // TEST_HARNESS_H
@@ -0,0 +1,123 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: MIT-0
+
+// Tests of src/wifi_scan.c on the host, see README.md.
+// scan() mirrors _cmd_diag() of tools/expresslink_simulator/simulator.py.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wifi_scan.h"
+#include "test_harness.h"
+
+#define MAX_ACCESS_POINTS (64) // like device_location.c
+
+static char result[16384];
+
+static size_t scan(size_t networks) {
+    size_t o = snprintf(result, sizeof(result), "{\"WiFiAccessPoints\":[");
+    for (size_t i = 0; i < networks; i++) {
+        o += snprintf(result + o,
+                      sizeof(result) - o,
+                      "%s{\"MacAddress\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"Rss\":%d}",
+                      i > 0 ? "," : "",
+                      (unsigned)((i * 37) & 0xFF),
+                      (unsigned)((i * 37 + 11) & 0xFF),
+                      (unsigned)((i * 37 + 22) & 0xFF),
+                      (unsigned)((i * 37 + 33) & 0xFF),
+                      (unsigned)((i * 37 + 44) & 0xFF),
+                      (unsigned)((i * 37 + 55) & 0xFF),
+                      -40 - (int)i);
+    }
+    o += snprintf(result + o, sizeof(result) - o, "]}");
+    return o;
+}
+
+static void parse(struct wifi_scan_parser *p, struct wifi_access_point *aps, const char *s, size_t length, size_t chunk) {
+    wifi_scan_parser_init(p, aps, MAX_ACCESS_POINTS);
+    for (size_t i = 0; i < length; i += chunk) {
+        wifi_scan_parser_put(p, s + i, i + chunk < length ? chunk : length - i);
+    }
+}
+
+static void test_round_trip(size_t networks) {
+    struct wifi_access_point aps[MAX_ACCESS_POINTS];
+    struct wifi_scan_parser p;
+    size_t length = scan(networks);
+
+    // the scan result arrives in chunks of any size, e.g. split at the end of the RX ring
+    const size_t chunks[] = {1, 2, 7, 512, sizeof(result)};
+    for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+        parse(&p, aps, result, length, chunks[c]);
+        CHECK(p.found == networks);
+        CHECK(p.count == (networks < MAX_ACCESS_POINTS ? networks : MAX_ACCESS_POINTS));
+    }
+
+    // formatted like the scan result, so the stored access points appear in it
+    char json[WIFI_ACCESS_POINT_JSON_LENGTH + 1];
+    for (size_t i = 0; i < p.count; i++) {
+        size_t n = wifi_access_point_to_json(&aps[i], json, sizeof(json));
+        CHECK(n == strlen(json));
+        CHECK(strstr(result, json) != NULL);
+    }
+}
+
+static void test_strongest_kept(void) {
+    struct wifi_access_point aps[MAX_ACCESS_POINTS];
+    struct wifi_scan_parser p;
+
+    // the signal gets weaker with every access point of scan(), so reverse the order to exercise the replacement
+    char reversed[sizeof(result)];
+    size_t networks = MAX_ACCESS_POINTS + 20;
+    scan(networks);
+    size_t o = snprintf(reversed, sizeof(reversed), "{\"WiFiAccessPoints\":[");
+    for (size_t i = networks; i-- > 0;) {
+        char *object = result;
+        for (size_t j = 0; j <= i; j++) {
+            object = strchr(object + 1, '{');
+        }
+        o += snprintf(reversed + o, sizeof(reversed) - o, "%s%.*s", i < networks - 1 ? "," : "", (int)(strchr(object, '}') - object + 1), object);
+    }
+    o += snprintf(reversed + o, sizeof(reversed) - o, "]}");
+
+    parse(&p, aps, reversed, o, 3);
+    CHECK(p.found == networks);
+    CHECK(p.count == MAX_ACCESS_POINTS);
+    for (size_t i = 0; i < p.count; i++) {
+        CHECK(aps[i].rss > -40 - MAX_ACCESS_POINTS);
+    }
+}
+
+static void test_format_variants(void) {
+    struct wifi_access_point aps[MAX_ACCESS_POINTS];
+    struct wifi_scan_parser p;
+
+    // whitespace, upper case hex digits, other fields and the order of the fields do not matter,
+    // access points without a valid MAC address or RSS are skipped
+    const char *s = "{ \"WiFiAccessPoints\" : [ { \"Rss\" : -61 , \"MacAddress\" : \"AB:CD:EF:12:34:56\" },"
+                    "{\"MacAddress\":\"ab:cd:ef:12:34\",\"Rss\":-50},{\"MacAddress\":\"01:02:03:04:05:06\"},"
+                    "{\"Ssid\":\"x:{},\\\"\",\"MacAddress\":\"01:02:03:04:05:07\",\"Rss\":-70} ] }";
+    parse(&p, aps, s, strlen(s), 5);
+    CHECK(p.found == 2);
+    CHECK(p.count == 2);
+    CHECK(aps[0].mac[0] == 0xAB && aps[0].mac[5] == 0x56 && aps[0].rss == -61);
+    CHECK(aps[1].mac[5] == 0x07 && aps[1].rss == -70);
+
+    char json[WIFI_ACCESS_POINT_JSON_LENGTH + 1];
+    struct wifi_access_point weakest = {{0xff, 0xff, 0xff, 0xff, 0xff, 0xff}, -128};
+    CHECK(wifi_access_point_to_json(&weakest, json, sizeof(json)) == WIFI_ACCESS_POINT_JSON_LENGTH);
+    CHECK(strcmp(json, "{\"MacAddress\":\"ff:ff:ff:ff:ff:ff\",\"Rss\":-128}") == 0);
+}
+
+int main(void) {
+    test_round_trip(0);
+    test_round_trip(8); // simulator.py default
+    test_round_trip(MAX_ACCESS_POINTS);
+    test_round_trip(200); // 9 KiB of JSON, more than the response line
+    test_strongest_kept();
+    test_format_variants();
+
+    return test_summary();
+}